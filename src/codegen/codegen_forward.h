@@ -7,6 +7,7 @@ typedef struct IRInstruction IRInstruction;
 typedef struct IRBlock IRBlock;
 typedef struct IRFunction IRFunction;
 typedef struct IR IR;
+typedef struct LoopInfo LoopInfo;
 
 typedef usz RegisterDescriptor;
 typedef struct RegisterPool RegisterPool;
@@ -126,6 +127,9 @@ enum ComparisonType {
   F(PHI)                                                         \
   F(COPY)                                                        \
                                                                  \
+  /** Choose one of two values based on a condition. **/         \
+  F(SELECT)                                                      \
+                                                                 \
   ALL_BINARY_INSTRUCTION_TYPES(F)                                \
                                                                  \
   F(STATIC_REF)                                                  \
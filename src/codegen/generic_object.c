@@ -204,9 +204,11 @@ void generic_object_as_elf_x86_64(GenericObjectFile *object, FILE *f) {
     switch (sym->type) {
     case GOBJ_SYMTYPE_STATIC:
       elf_sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_OBJECT);
+      elf_sym.st_value = sym->byte_offset;
       break;
     case GOBJ_SYMTYPE_EXPORT:
       elf_sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_OBJECT);
+      elf_sym.st_value = sym->byte_offset;
       break;
     case GOBJ_SYMTYPE_EXTERNAL:
       elf_sym.st_shndx = 0;
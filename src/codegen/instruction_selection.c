@@ -48,6 +48,7 @@ typedef enum ISelTokenKind {
   TOKEN_KW_DISCARD,
   TOKEN_KW_CLOBBERS,
   TOKEN_KW_IS,
+  TOKEN_KW_COST,
 
   TOKEN_SEMICOLON,
 
@@ -92,6 +93,7 @@ static const char *isel_token_kind_to_string(ISelTokenKind kind) {
   case TOKEN_KW_DISCARD: return "discard";
   case TOKEN_KW_CLOBBERS: return "clobbers";
   case TOKEN_KW_IS: return "is";
+  case TOKEN_KW_COST: return "cost";
   case TOKEN_IDENTIFIER: return "identifier";
   case TOKEN_INTEGER: return "integer";
   }
@@ -122,6 +124,9 @@ typedef struct ISelParser {
   unsigned int pattern_instruction_index;
   // Index of operand being parsed within instruction.
   unsigned int operand_index;
+  // Whether the instruction being parsed is one to match, rather than
+  // one to emit.
+  bool parsing_input;
 
   const char *beg;
   const char *end;
@@ -145,8 +150,10 @@ static void isel_env_init_common(ISelEnvironment *env) {
   ALL_SHARED_IR_AND_MIR_INSTRUCTION_TYPES(ADD_OPCODE);
 #undef ADD_OPCODE
 
-  STATIC_ASSERT(MPSEUDO_COUNT == 2, "Exhaustive handling of MIR pseudo-instructions in instruction selection global environment initialisation");
+  STATIC_ASSERT(MPSEUDO_COUNT == 4, "Exhaustive handling of MIR pseudo-instructions in instruction selection global environment initialisation");
   isel_env_add_opcode(env, "MPSEUDO_R2R", MPSEUDO_R2R);
+  isel_env_add_opcode(env, "MPSEUDO_SPILL_REG", MPSEUDO_SPILL_REG);
+  isel_env_add_opcode(env, "MPSEUDO_UNSPILL_REG", MPSEUDO_UNSPILL_REG);
 
   isel_env_add_integer(env, "COMPARE_EQ", (isz)COMPARE_EQ);
   isel_env_add_integer(env, "COMPARE_NE", (isz)COMPARE_NE);
@@ -439,12 +446,13 @@ static void isel_next_number(ISelParser *p) {
 static const struct {
   span kw;
   ISelTokenKind kind;
-} keywords[14] = {
+} keywords[15] = {
   {literal_span_raw("match"), TOKEN_KW_MATCH},
   {literal_span_raw("emit"), TOKEN_KW_EMIT},
   {literal_span_raw("discard"), TOKEN_KW_DISCARD},
   {literal_span_raw("clobbers"), TOKEN_KW_CLOBBERS},
   {literal_span_raw("is"), TOKEN_KW_IS},
+  {literal_span_raw("cost"), TOKEN_KW_COST},
   {literal_span_raw("Register"), TOKEN_OPKIND_REGISTER},
   {literal_span_raw("Immediate"), TOKEN_OPKIND_IMMEDIATE},
   {literal_span_raw("Name"), TOKEN_OPKIND_NAME},
@@ -673,6 +681,8 @@ static MIROperand isel_parse_operand(ISelParser *p) {
       if (out.kind != MIR_OP_IMMEDIATE)
         ERR_AT(expr_loc, "Cannot initialise this type of operand with integer expression");
       out.value.imm = value.integer;
+      // An immediate to match only matches this value.
+      if (p->parsing_input) out.value_constraint_kind = MIR_OP_IMMEDIATE;
     } else if (value.kind == ISEL_ENV_REGISTER) {
       if (out.kind != MIR_OP_REGISTER)
         ERR_AT(expr_loc, "Cannot initialise this type of operand with register expression");
@@ -803,7 +813,7 @@ static MIRInstruction *isel_parse_inst_spec(ISelParser *p) {
   return out;
 }
 
-///<match-pattern> ::= "match" <inst-spec> { <inst-spec> } ( "emit" | "discard" ) ( <inst-block> | <inst-spec> )
+///<match-pattern> ::= "match" [ "cost" INTEGER ] <inst-spec> { <inst-spec> } ( "emit" | "discard" ) ( <inst-block> | <inst-spec> )
 static ISelPattern isel_parse_match(ISelParser *p) {
   ISelPattern out = {0};
   out.local = isel_env_create_empty(16);
@@ -815,13 +825,26 @@ static ISelPattern isel_parse_match(ISelParser *p) {
   // Yeet "match" keyword.
   isel_next_tok(p);
 
+  // Parse cost, if present.
+  bool has_cost = false;
+  if (p->tok.kind == TOKEN_KW_COST) {
+    // Yeet "cost" keyword.
+    isel_next_tok(p);
+    if (p->tok.kind != TOKEN_INTEGER) ERR("Expected integer cost following `cost` keyword");
+    out.cost = p->tok.integer;
+    has_cost = true;
+    isel_next_tok(p);
+  }
+
   // Parse instructions to match in the pattern until the emit keyword is reached.
   p->pattern_instruction_index = 0;
+  p->parsing_input = true;
   while (p->tok.kind != TOKEN_KW_EMIT && p->tok.kind != TOKEN_KW_DISCARD) {
     if (p->tok.kind == TOKEN_EOF) ICE("ISel reached EOF while parsing input pattern instructions of match definition");
     MIRInstruction *inst = isel_parse_inst_spec(p);
     vector_push(out.input, inst);
   }
+  p->parsing_input = false;
 
   if (p->tok.kind == TOKEN_KW_EMIT) {
     // Yeet "emit" keyword.
@@ -855,6 +878,9 @@ static ISelPattern isel_parse_match(ISelParser *p) {
     isel_next_tok(p);
   } else ERR("Unrecognised token following match pattern instructions");
 
+  // By default, a pattern costs as much as the instructions it emits.
+  if (!has_cost) out.cost = out.output.size;
+
   p->local = NULL;
 
   return out;
@@ -976,6 +1002,128 @@ ISelPatterns isel_parse_file(const char *filepath) {
   return out;
 }
 
+ISelPatterns isel_patterns_from_table(const ISelTable *table) {
+  ISelPatterns patterns = {0};
+  for (usz i = 0; i < table->pattern_count; ++i) {
+    const ISelTablePattern *table_pattern = table->patterns + i;
+    ISelPattern pattern = {0};
+    pattern.cost = table_pattern->cost;
+
+    for (usz j = 0; j < table_pattern->input_count + table_pattern->output_count; ++j) {
+      const ISelTableInstruction *table_inst = j < table_pattern->input_count
+        ? table->instructions + table_pattern->input + j
+        : table->instructions + table_pattern->output + j - table_pattern->input_count;
+
+      MIRInstruction *inst = mir_makenew(table_inst->opcode);
+      for (usz k = 0; k < table_inst->operand_count; ++k)
+        mir_add_op(inst, table->operands[table_inst->operands + k]);
+      for (usz k = 0; k < table_inst->clobber_count; ++k)
+        vector_push(inst->clobbers, table->clobbers[table_inst->clobbers + k]);
+
+      if (j < table_pattern->input_count) vector_push(pattern.input, inst);
+      else vector_push(pattern.output, inst);
+    }
+
+    vector_push(patterns, pattern);
+  }
+  return patterns;
+}
+
+static void isel_write_table_operand(FILE *file, MIROperand *op) {
+  fprint(file, "  { .kind = %d", (int) op->kind);
+  switch (op->kind) {
+  default: break;
+  case MIR_OP_REGISTER:
+    fprint(file, ", .value.reg = { %Z, %u, %d }",
+           op->value.reg.value, op->value.reg.size, (int) op->value.reg.defining_use);
+    break;
+  case MIR_OP_IMMEDIATE: fprint(file, ", .value.imm = %D", op->value.imm); break;
+  case MIR_OP_OP_REF:
+    fprint(file, ", .value.op_ref = { %u, %u }",
+           op->value.op_ref.pattern_instruction_index, op->value.op_ref.operand_index);
+    break;
+  case MIR_OP_INST_REF: fprint(file, ", .value.inst_ref = %u", op->value.inst_ref); break;
+  }
+
+  switch (op->value_constraint_kind) {
+  default: ICE("Unhandled value constraint kind %d", (int) op->value_constraint_kind);
+  case MIR_OP_NONE: break;
+  case MIR_OP_OP_REF:
+    fprint(file, ", .value_constraint_kind = %d, .value_constraint.op_ref = { %u, %u }",
+           (int) op->value_constraint_kind,
+           op->value_constraint.op_ref.pattern_instruction_index,
+           op->value_constraint.op_ref.operand_index);
+    break;
+  case MIR_OP_INST_REF:
+    fprint(file, ", .value_constraint_kind = %d, .value_constraint.inst_ref = %u",
+           (int) op->value_constraint_kind, op->value_constraint.inst_ref);
+    break;
+  case MIR_OP_IMMEDIATE:
+    fprint(file, ", .value_constraint_kind = %d", (int) op->value_constraint_kind);
+    break;
+  }
+  fprint(file, " },\n");
+}
+
+void isel_write_table(FILE *file, ISelPatterns patterns, const char *name) {
+  fprint(file, "/// Generated from an ISel pattern file by `intc --isel-tablegen`; do not edit.\n\n");
+
+  // Every array gets a trailing zero entry, so that none of them are
+  // empty, as that is not valid C.
+  fprint(file, "static const MIROperand %s_operands[] = {\n", name);
+  foreach (pattern, patterns) {
+    foreach_val (inst, pattern->input) { FOREACH_MIR_OPERAND(inst, op) isel_write_table_operand(file, op); }
+    foreach_val (inst, pattern->output) { FOREACH_MIR_OPERAND(inst, op) isel_write_table_operand(file, op); }
+  }
+  fprint(file, "  {0}\n};\n\n");
+
+  fprint(file, "static const MIROperandRegister %s_clobbers[] = {\n", name);
+  foreach (pattern, patterns) {
+    foreach_val (inst, pattern->input) {
+      foreach (r, inst->clobbers) fprint(file, "  { %Z, %u, 0 },\n", r->value, r->size);
+    }
+    foreach_val (inst, pattern->output) {
+      foreach (r, inst->clobbers) fprint(file, "  { %Z, %u, 0 },\n", r->value, r->size);
+    }
+  }
+  fprint(file, "  {0}\n};\n\n");
+
+  usz operands = 0, clobbers = 0;
+  fprint(file, "static const ISelTableInstruction %s_instructions[] = {\n", name);
+  foreach (pattern, patterns) {
+    for (usz j = 0; j < pattern->input.size + pattern->output.size; ++j) {
+      MIRInstruction *inst = j < pattern->input.size
+        ? pattern->input.data[j]
+        : pattern->output.data[j - pattern->input.size];
+      ASSERT(inst->clobbers.size <= UINT8_MAX, "Too many clobbers in ISel pattern instruction");
+      fprint(file, "  { %u, %u, %u, %Z, %Z },\n", inst->opcode, (unsigned) inst->operand_count,
+             (unsigned) inst->clobbers.size, operands, clobbers);
+      operands += inst->operand_count;
+      clobbers += inst->clobbers.size;
+    }
+  }
+  fprint(file, "  {0}\n};\n\n");
+
+  usz instructions = 0;
+  fprint(file, "static const ISelTablePattern %s_patterns[] = {\n", name);
+  foreach (pattern, patterns) {
+    fprint(file, "  { %Z, %Z, %Z, %Z, %Z },\n", instructions, pattern->input.size,
+           instructions + pattern->input.size, pattern->output.size, pattern->cost);
+    instructions += pattern->input.size + pattern->output.size;
+  }
+  fprint(file, "  {0}\n};\n\n");
+
+  fprint(file,
+         "static const ISelTable %s = {\n"
+         "  .patterns = %s_patterns,\n"
+         "  .pattern_count = %Z,\n"
+         "  .instructions = %s_instructions,\n"
+         "  .operands = %s_operands,\n"
+         "  .clobbers = %s_clobbers,\n"
+         "};\n",
+         name, name, patterns.size, name, name, name);
+}
+
 bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructions) {
   /// A pattern that is larger than the instructions given means it will never match.
   if (pattern.input.size > instructions.size) return false;
@@ -1009,6 +1157,9 @@ bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructi
       switch (op_pattern->value_constraint_kind) {
       default: ICE("Unhandled value constraint kind %d", (int)op_pattern->value_constraint_kind);
       case MIR_OP_NONE: break;
+      case MIR_OP_IMMEDIATE: {
+        if (op->value.imm != op_pattern->value.imm) return false;
+      } break;
       case MIR_OP_OP_REF: {
         // RESOLVE INSTRUCTION REFERENCE
         ASSERT(op_pattern->value_constraint.op_ref.pattern_instruction_index < instructions.size,
@@ -1047,231 +1198,584 @@ bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructi
 }
 
 
-typedef Vector(usz) ISelRegisterValues;
+#define VREG_SET_BITS (sizeof(usz) * 8)
+
+/// Mark the first use of each virtual register in a function as its
+/// defining use, for RA.
+///
+/// A use is a defining use if the register does not appear on any path
+/// from the entry to it, ignoring back edges. Since the CFG without its
+/// back edges is acyclic, a single pass over the blocks in reverse
+/// postorder suffices: the registers seen on entry to a block are those
+/// seen at the end of any of its forward predecessors.
+static void calculate_defining_uses(MIRFunction *f) {
+  MIRBlockVector rpo = mir_blocks_reverse_postorder(f);
+  usz count = f->blocks.size;
+
+  /// Virtual registers are numbered from MIR_ARCH_START.
+  usz vreg_count = 0;
+  foreach_val (block, rpo) {
+    foreach_val (inst, block->instructions) {
+      if (inst->reg >= MIR_ARCH_START && inst->reg - MIR_ARCH_START >= vreg_count)
+        vreg_count = inst->reg - MIR_ARCH_START + 1;
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START && op->value.reg.value - MIR_ARCH_START >= vreg_count)
+          vreg_count = op->value.reg.value - MIR_ARCH_START + 1;
+      }
+    }
+  }
 
-static void mark_defining_uses(ISelRegisterValues *regs_seen, MIRBlock *block) {
-  foreach_val (inst, block->instructions) {
-    FOREACH_MIR_OPERAND(inst, op) {
-      if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START) {
-        if (!vector_contains(*regs_seen, op->value.reg.value)) {
+  usz words = (vreg_count + VREG_SET_BITS - 1) / VREG_SET_BITS;
+  usz *seen = calloc(count * words + 1, sizeof(usz));
+
+  /// Unreachable blocks are not in the RPO; their index is -1, so they
+  /// are skipped like the sources of back edges.
+  usz *rpo_index = malloc((count ? count : 1) * sizeof(usz));
+  memset(rpo_index, 0xff, (count ? count : 1) * sizeof(usz));
+  foreach_index (i, rpo) rpo_index[rpo.data[i]->id] = i;
+
+#define SEEN(block) (seen + (block)->id * words)
+#define IS_SEEN(set, vreg) ((set)[((vreg) - MIR_ARCH_START) / VREG_SET_BITS] >> (((vreg) - MIR_ARCH_START) % VREG_SET_BITS) & 1)
+#define SET_SEEN(set, vreg) ((set)[((vreg) - MIR_ARCH_START) / VREG_SET_BITS] |= (usz) 1 << (((vreg) - MIR_ARCH_START) % VREG_SET_BITS))
+
+  foreach_index (i, rpo) {
+    MIRBlock *block = rpo.data[i];
+    usz *set = SEEN(block);
+    foreach_val (pred, block->predecessors) {
+      if (rpo_index[pred->id] >= i) continue;
+      usz *pred_set = SEEN(pred);
+      for (usz w = 0; w < words; ++w) set[w] |= pred_set[w];
+    }
+
+    foreach_val (inst, block->instructions) {
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START && !IS_SEEN(set, op->value.reg.value)) {
           op->value.reg.defining_use = true;
-          vector_push(*regs_seen, op->value.reg.value);
+          SET_SEEN(set, op->value.reg.value);
         }
       }
+      // Calls define their result register without it being an
+      // operand, so later uses of it are not defining uses.
+      if (inst->reg >= MIR_ARCH_START) SET_SEEN(set, inst->reg);
     }
   }
+
+#undef SEEN
+#undef IS_SEEN
+#undef SET_SEEN
+
+  free(rpo_index);
+  free(seen);
+  vector_delete(rpo);
 }
 
-/// NOTE: Pass empty vectors for visited and doubly_visited when
-/// calling on entry of function.
-static void calculate_defining_uses_for_block(ISelRegisterValues *regs_seen, MIRBlock *block, MIRBlockVector *visited, MIRBlockVector *doubly_visited) {
-  /// Don't visit the same block thrice.
-  if (vector_contains(*visited, block)) {
-    if (vector_contains(*doubly_visited, block))
-      return;
-    else vector_push(*doubly_visited, block);
-  } else vector_push(*visited, block);
-
-  // At each block of the function, starting at the entry, walk the
-  // control flow. The first operand usage of a virtual register will
-  // be set to a defining use (i.e. the first place that that register
-  // must be classified as "in use" by the register allocator).
-
-  mark_defining_uses(regs_seen, block);
-
-  // To follow control flow of an exit block, we stop.
-  if (block->is_exit) return;
-
-  // If a block has only a single successor, we don't need to do
-  // anything fancy; just follow the simple control flow for as long as
-  // possible.
-  while (block->successors.size == 1) {
-    block = vector_front(block->successors);
-    mark_defining_uses(regs_seen, block);
+/// Find the first operand of an input of `pattern` after the one at
+/// `index` that must be the result of the input at `index`. Return false
+/// if there is none; otherwise, store the index of the input that uses
+/// it in `user` and that of the operand in `operand`, unless NULL.
+static bool isel_pattern_user(ISelPattern *pattern, usz index, usz *user, usz *operand) {
+  for (usz i = index + 1; i < pattern->input.size; ++i) {
+    MIRInstruction *inst = pattern->input.data[i];
+    FOREACH_MIR_OPERAND(inst, op) {
+      if (op->value_constraint_kind != MIR_OP_INST_REF || op->value_constraint.inst_ref != index) continue;
+      if (user) *user = i;
+      if (operand) *operand = (usz) (op - opbase);
+      return true;
+    }
   }
-  // If a block has multiple successors, we will "remember" the
-  // registers that we had seen at the beginning, and reset
-  // to that after following each one.
-  // To follow control flow, we sometimes have to come back to a
-  // block after reaching the exit, as some blocks have multiple
-  // successors. We use recursion for this.
-  foreach_val (successor, block->successors) {
-    // Copy registers seen.
-    ISelRegisterValues regs_seen_copy = {0};
-    vector_append(regs_seen_copy, *regs_seen);
-
-    calculate_defining_uses_for_block(&regs_seen_copy, successor, visited, doubly_visited);
-
-    vector_delete(regs_seen_copy);
+  return false;
+}
+
+/// Maps each virtual register of the function being selected (minus
+/// MIR_ARCH_START) to a number.
+typedef Vector(usz) ISelVregMap;
+
+/// Entry in the definition map for a register defined more than once.
+#define ISEL_DEF_AMBIGUOUS ((usz) -1)
+
+/// Return a pointer to the entry for `vreg` in `map`, growing the map
+/// with zeroed entries if need be.
+static usz *isel_vreg_entry(ISelVregMap *map, usz vreg) {
+  ASSERT(vreg >= MIR_ARCH_START, "Not a virtual register: %Z", vreg);
+  usz index = vreg - MIR_ARCH_START;
+  if (index >= map->size) {
+    usz old_size = map->size;
+    vector_resize(*map, index + 1);
+    memset(map->data + old_size, 0, (map->size - old_size) * sizeof *map->data);
   }
+  return map->data + index;
 }
 
-void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
-  if (!mir.size) return;
-  if (!patterns.size) return;
+/// Add the virtual register operands of `inst` to the use counts in
+/// `uses`, or remove them if `remove` is set.
+static void isel_count_uses(ISelVregMap *uses, MIRInstruction *inst, bool remove) {
+  FOREACH_MIR_OPERAND(inst, op) {
+    if (op->kind != MIR_OP_REGISTER || op->value.reg.value < MIR_ARCH_START) continue;
+    usz *count = isel_vreg_entry(uses, op->value.reg.value);
+    if (remove) {
+      ASSERT(*count, "Use count of virtual register %Z underflowed", op->value.reg.value);
+      --*count;
+    } else ++*count;
+  }
+}
 
-  ISelEnvironment env = isel_env_create(1024);
+/// Return true iff the result of each of the instructions that `pattern`
+/// matches at the start of `instructions`, except for the last one, is
+/// used by nothing but operands of the match that the pattern requires
+/// to be that result. If it were used elsewhere, applying the pattern
+/// would leave that use without a definition.
+static bool isel_results_used_within(ISelPattern *pattern, MIRInstructionVector instructions, ISelVregMap *uses) {
+  usz n = pattern->input.size;
+  for (usz i = 0; i + 1 < n; ++i) {
+    usz reg = instructions.data[i]->reg;
+    if (reg < MIR_ARCH_START) continue;
+    usz count = 0;
+    for (usz j = i + 1; j < n; ++j) {
+      MIRInstruction *inst = instructions.data[j];
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind != MIR_OP_REGISTER || op->value.reg.value != reg) continue;
+        MIROperand *op_pattern = mir_get_op(pattern->input.data[j], (usz) (op - opbase));
+        if (op_pattern->value_constraint_kind != MIR_OP_INST_REF || op_pattern->value_constraint.inst_ref != i) return false;
+        count++;
+      }
+    }
+    if (*isel_vreg_entry(uses, reg) != count) return false;
+  }
+  return true;
+}
+
+#define ISEL_BINARY_CASE(type, ...) case CAT(MIR_, type):
+
+/// Return true iff `inst` may be moved past any instructions that do
+/// not redefine its operands, and, if it is a load, past any that do not
+/// write to memory either.
+static bool isel_is_movable(MIRInstruction *inst) {
+  FOREACH_MIR_OPERAND(inst, op)
+    if (op->kind == MIR_OP_REGISTER && op->value.reg.value < MIR_ARCH_START) return false;
+
+  /// These may trap, so keep them where they are.
+  if (inst->opcode == MIR_DIV || inst->opcode == MIR_MOD) return false;
+
+  switch (inst->opcode) {
+    ALL_BINARY_INSTRUCTION_TYPES(ISEL_BINARY_CASE)
+    case MIR_IMMEDIATE:
+    case MIR_LOAD:
+    case MIR_COPY:
+    case MIR_STATIC_REF:
+    case MIR_FUNC_REF:
+    case MIR_ZERO_EXTEND:
+    case MIR_SIGN_EXTEND:
+    case MIR_TRUNCATE:
+    case MIR_BITCAST:
+    case MIR_NOT:
+      return true;
+    default: return false;
+  }
+}
+
+#undef ISEL_BINARY_CASE
+
+/// Map each virtual register defined in `block` to one plus the index
+/// of its definition in the block, or to ISEL_DEF_AMBIGUOUS if it has
+/// more than one there (e.g. copies that lower a PHI).
+static void isel_index_definitions(MIRBlock *block, ISelVregMap *defs) {
+  foreach_val (inst, block->instructions)
+    if (inst->reg >= MIR_ARCH_START) *isel_vreg_entry(defs, inst->reg) = 0;
+  foreach_index (i, block->instructions) {
+    MIRInstruction *inst = block->instructions.data[i];
+    if (inst->reg < MIR_ARCH_START) continue;
+    usz *def = isel_vreg_entry(defs, inst->reg);
+    *def = *def ? ISEL_DEF_AMBIGUOUS : i + 1;
+  }
+}
+
+/// Bind the inputs of `pattern`, whose inputs must form a def-use tree,
+/// to the instruction at index `root` in `block` and the definitions of
+/// its operands in the block, back to front. On success, `window` holds
+/// the bound instructions and `positions` their indices, in block order.
+static bool isel_bind_tree(ISelPattern *pattern, MIRBlock *block, usz root, ISelVregMap *defs, MIRInstructionVector *window, usz *positions) {
+  usz n = pattern->input.size;
+  vector_resize(*window, n);
+  window->data[n - 1] = block->instructions.data[root];
+  positions[n - 1] = root;
+
+  for (usz i = n - 1; i-- > 0;) {
+    usz user = 0, operand = 0;
+    (void) isel_pattern_user(pattern, i, &user, &operand);
+
+    MIRInstruction *inst = window->data[user];
+    if (operand >= inst->operand_count) return false;
+    MIROperand *op = mir_get_op(inst, operand);
+    if (op->kind != MIR_OP_REGISTER || op->value.reg.value < MIR_ARCH_START) return false;
+
+    /// The inputs of a pattern are in def-before-use order, so the
+    /// definitions must appear in the block in the same order.
+    usz def = *isel_vreg_entry(defs, op->value.reg.value);
+    if (!def || def == ISEL_DEF_AMBIGUOUS || def - 1 >= positions[i + 1]) return false;
+    positions[i] = def - 1;
+    window->data[i] = block->instructions.data[def - 1];
+  }
+
+  return true;
+}
 
-  // TODO: Everything past this point is temporary and will change :P
-  // We will eventually use a modified Aho-Corasick pattern matching
-  // algorithm, but for now use a quite naive implementation just to get
-  // things started without needing to build an entire Aho-Corasick trie,
-  // calculate fail nodes, etc.
-
-  // FOR NOW: Sort patterns largest-first, and simply iterate all the
-  // patterns every time we have instructions to match. This is FOR NOW
-  // because I'm sure the time complexity is n-squared at this point :^&
-
-  // Sort patterns such that the ones with the most elements in the
-  // input vector come first.
-  foreach_index (i, patterns) {
-    // Can't swap last with last, so don't try.
-    if (i == patterns.size - 1) break;
-    // Find longest in rest of vector
-    ISelPattern *pattern_to_swap = patterns.data + i;
-    ISelPattern *largest = pattern_to_swap;
-    for (size_t j = i + 1; j < patterns.size; ++j) {
-      ISelPattern *largest_candidate = patterns.data + j;
-      if (largest_candidate->input.size > largest->input.size)
-        largest = largest_candidate;
+/// Return true iff the first `n - 1` of the `n` instructions at
+/// `positions` in `block` may be moved right in front of the last one.
+static bool isel_can_sink(MIRBlock *block, usz *positions, usz n) {
+  for (usz i = 0; i + 1 < n; ++i) {
+    MIRInstruction *inst = block->instructions.data[positions[i]];
+    bool adjacent = positions[n - 1] - positions[i] == n - 1 - i;
+    if (adjacent) continue;
+    if (!isel_is_movable(inst)) return false;
+
+    usz next = i + 1;
+    for (usz p = positions[i] + 1; p < positions[n - 1]; ++p) {
+      if (p == positions[next]) {
+        next++;
+        continue;
+      }
+
+      MIRInstruction *passed = block->instructions.data[p];
+      if (inst->opcode == MIR_LOAD && !isel_is_movable(passed)) return false;
+      FOREACH_MIR_OPERAND(inst, op)
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value == passed->reg) return false;
     }
-    if (pattern_to_swap != largest) {
-      ISelPattern tmp = *pattern_to_swap;
-      *pattern_to_swap = *largest;
-      *largest = tmp;
+  }
+  return true;
+}
+
+/// Move the instructions in `window` but the last one, which are at
+/// `positions` in `block`, right in front of the last one, keeping the
+/// order of everything else.
+static void isel_sink(MIRBlock *block, MIRInstructionVector window, usz *positions) {
+  usz n = window.size;
+  usz root = positions[n - 1];
+  usz to = positions[0], next = 0;
+  for (usz from = positions[0]; from < root; ++from) {
+    if (next < n - 1 && from == positions[next]) {
+      next++;
+      continue;
     }
+    block->instructions.data[to++] = block->instructions.data[from];
+  }
+  for (usz i = 0; i + 1 < n; ++i) block->instructions.data[to++] = window.data[i];
+  ASSERT(to == root, "Sinking instructions must not move the root of the tree");
+}
+
+/// A transition of the pattern matching automaton on an opcode.
+typedef struct ISelMatchTransition {
+  uint32_t opcode;
+  usz state;
+} ISelMatchTransition;
+
+/// A state of the pattern matching automaton, i.e. a node in the trie
+/// of the opcode sequences of all pattern inputs.
+typedef struct ISelMatchState {
+  /// Outgoing transitions, sorted by opcode.
+  Vector(ISelMatchTransition) transitions;
+  /// Patterns whose input opcodes spell out the path to this state, in
+  /// the order they appear in the pattern file. Operand kinds and value
+  /// constraints of these are only checked once this state is reached.
+  Vector(usz) accepts;
+} ISelMatchState;
+
+/// Matching automaton for a set of patterns; state 0 is the start state.
+typedef struct ISelMatcher {
+  Vector(ISelMatchState) states;
+  /// Length of the longest pattern input, i.e. the depth of the trie.
+  usz longest_pattern_length;
+  /// Patterns with more than one input in which every input but the
+  /// last is referenced by a later one, i.e. whose inputs form a def-use
+  /// tree rooted at the last one.
+  Vector(usz) trees;
+} ISelMatcher;
+
+/// Return the index of the first transition in `state` on an opcode
+/// greater than or equal to `opcode`.
+static usz isel_matcher_lower_bound(ISelMatchState *state, uint32_t opcode) {
+  usz lo = 0, hi = state->transitions.size;
+  while (lo < hi) {
+    usz mid = lo + (hi - lo) / 2;
+    if (state->transitions.data[mid].opcode < opcode) lo = mid + 1;
+    else hi = mid;
   }
+  return lo;
+}
 
-  usz longest_pattern_length = patterns.data->input.size;
+/// Return the state reached from `state` on `opcode`, or 0 if there is none.
+static usz isel_matcher_step(ISelMatcher *m, usz state, uint32_t opcode) {
+  ISelMatchState *s = m->states.data + state;
+  usz i = isel_matcher_lower_bound(s, opcode);
+  if (i < s->transitions.size && s->transitions.data[i].opcode == opcode)
+    return s->transitions.data[i].state;
+  return 0;
+}
 
-  // Instructions currently being expanded/dealt with.
-  MIRInstructionVector instructions = {0};
+static ISelMatcher isel_matcher_build(ISelPatterns patterns) {
+  ISelMatcher m = {0};
+  ISelMatchState start = {0};
+  vector_push(m.states, start);
+
+  foreach_index (p, patterns) {
+    ISelPattern *pattern = patterns.data + p;
+    ASSERT(pattern->input.size, "ISel pattern without input instructions");
+    if (pattern->input.size > m.longest_pattern_length)
+      m.longest_pattern_length = pattern->input.size;
+
+    usz state = 0;
+    foreach_val (inst, pattern->input) {
+      usz next = isel_matcher_step(&m, state, inst->opcode);
+      if (!next) {
+        ISelMatchState new_state = {0};
+        vector_push(m.states, new_state);
+        next = m.states.size - 1;
+
+        ISelMatchState *s = m.states.data + state;
+        ISelMatchTransition transition = { inst->opcode, next };
+        vector_insert_index(s->transitions, isel_matcher_lower_bound(s, inst->opcode), transition);
+      }
+      state = next;
+    }
+    vector_push(m.states.data[state].accepts, p);
+
+    bool tree = pattern->input.size > 1;
+    for (usz i = 0; tree && i + 1 < pattern->input.size; ++i)
+      tree = isel_pattern_user(pattern, i, NULL, NULL);
+    if (tree) vector_push(m.trees, p);
+  }
+
+  return m;
+}
+
+static void isel_matcher_delete(ISelMatcher *m) {
+  foreach (state, m->states) {
+    vector_delete(state->transitions);
+    vector_delete(state->accepts);
+  }
+  vector_delete(m->states);
+  vector_delete(m->trees);
+}
+
+/// Within `block`, move the operand definitions of each instruction
+/// that match a tree pattern together with it right in front of it, if
+/// that is legal, so that the pattern can then be applied as usual. For
+/// instance, this turns
+///
+///   a = load x; b = load y; c = mul b, 3; d = add a, c; store d, x
+///
+/// into `b = load y; c = mul b, 3; a = load x; d = add a, c; store d, x`,
+/// the last three of which may become a single read-modify-write add.
+/// Of several patterns that apply to an instruction, the one with the
+/// most inputs wins. `defs`, `window`, and `positions` are scratch space.
+static void isel_gather_trees(ISelMatcher *m, ISelPatterns patterns, MIRBlock *block, ISelVregMap *uses, ISelVregMap *defs, MIRInstructionVector *window, usz *positions) {
+  isel_index_definitions(block, defs);
+
+  for (usz root = block->instructions.size; root-- > 0;) {
+    uint32_t opcode = block->instructions.data[root]->opcode;
+    ISelPattern *best = NULL;
+    foreach (p, m->trees) {
+      ISelPattern *pattern = patterns.data + *p;
+      if (vector_back(pattern->input)->opcode != opcode) continue;
+      if (best && best->input.size >= pattern->input.size) continue;
+      if (!isel_bind_tree(pattern, block, root, defs, window, positions)) continue;
+      if (!isel_does_pattern_match(*pattern, *window)) continue;
+      if (!isel_results_used_within(pattern, *window, uses)) continue;
+      if (!isel_can_sink(block, positions, pattern->input.size)) continue;
+      best = pattern;
+    }
+    if (!best) continue;
+
+    (void) isel_bind_tree(best, block, root, defs, window, positions);
+    if (positions[0] + best->input.size - 1 != root) {
+      isel_sink(block, *window, positions);
+      isel_index_definitions(block, defs);
+    }
+
+    // Don't consider the instructions of this tree again.
+    root -= best->input.size - 1;
+  }
+
+  // Don't leave definitions of this block behind for the next one.
+  foreach_val (inst, block->instructions)
+    if (inst->reg >= MIR_ARCH_START) *isel_vreg_entry(defs, inst->reg) = 0;
+}
+
+/// Return the pattern to apply at the start of `instructions`, or NULL
+/// if no pattern matches there.
+///
+/// This estimates the cheapest cover of `instructions` back to front:
+/// covering the instructions from index k onward costs the least of one
+/// plus the cost from k + 1 onward, for leaving instruction k as-is, and
+/// the cost of each pattern that matches at k plus the cost from the end
+/// of its input onward. Of the patterns that match at the start, the one
+/// with the cheapest cover wins; ties go to the longer pattern and then
+/// to the one that comes first in the pattern file. Patterns that would
+/// discard a result that is used elsewhere (see `uses`) never match.
+///
+/// `cover_costs` must have room for `instructions.size + 1` elements.
+static ISelPattern *isel_matcher_select(ISelMatcher *m, ISelPatterns patterns, MIRInstructionVector instructions, ISelVregMap *uses, usz *cover_costs) {
+  ISelPattern *best = NULL;
+  usz best_cost = 0;
+  usz n = instructions.size;
+  cover_costs[n] = 0;
+  for (usz k = n; k-- > 0;) {
+    MIRInstructionVector rest = { instructions.data + k, n - k, n - k };
+    cover_costs[k] = 1 + cover_costs[k + 1];
+
+    usz state = 0;
+    foreach_val (inst, rest) {
+      state = isel_matcher_step(m, state, inst->opcode);
+      if (!state) break;
+      foreach (p, m->states.data[state].accepts) {
+        ISelPattern *pattern = patterns.data + *p;
+        if (!isel_does_pattern_match(*pattern, rest)) continue;
+        if (!isel_results_used_within(pattern, rest, uses)) continue;
+
+        usz cost = pattern->cost + cover_costs[k + pattern->input.size];
+        if (cost < cover_costs[k]) cover_costs[k] = cost;
+        if (k == 0 && (!best || cost < best_cost || (cost == best_cost && pattern->input.size > best->input.size))) {
+          best = pattern;
+          best_cost = cost;
+        }
+      }
+    }
+  }
+  return best;
+}
+
+void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
+  if (!mir.size) return;
+  if (!patterns.size) return;
+
+  ISelEnvironment env = isel_env_create(1024);
+
+  // Patterns are matched using a trie of the opcode sequences of their
+  // inputs, so each step costs at most the square of the length of the
+  // longest pattern, regardless of how many patterns there are. Since we always
+  // match at the front of the instructions still to be selected, there
+  // is no need for Aho-Corasick-style failure links.
+  ISelMatcher matcher = isel_matcher_build(patterns);
+  usz *cover_costs = calloc(matcher.longest_pattern_length + 1, sizeof(usz));
+
+  // Instructions still to be selected, in *reverse* order, so that the
+  // next one is at the back and consuming or prepending instructions
+  // does not need to shift the rest.
+  MIRInstructionVector pending = {0};
+  // The next (up to) `longest_pattern_length` pending instructions, in order.
+  MIRInstructionVector window = {0};
+  // Output instructions of the pattern being expanded.
+  MIRInstructionVector expanded = {0};
+  // Number of uses of each virtual register of the current function.
+  ISelVregMap uses = {0};
+  // Scratch space for matching def-use trees.
+  ISelVregMap defs = {0};
+  usz *positions = calloc(matcher.longest_pattern_length + 1, sizeof(usz));
 
   foreach_val (f, mir) {
     if (!ir_func_is_definition(f->origin)) continue;
 
+    vector_clear(uses);
+    foreach_val (bb, f->blocks)
+      foreach_val (inst, bb->instructions)
+        isel_count_uses(&uses, inst, false);
+
     foreach_val (bb, f->blocks) {
-      vector_clear(instructions);
-      // Instructions that will be output.
-      MIRInstructionVector new_instructions = {0};
+      if (isel_match_trees)
+        isel_gather_trees(&matcher, patterns, bb, &uses, &defs, &window, positions);
 
-      // Amount of instructions that have been pushed to the
-      // instructions vector for instruction selection. Used to continue
-      // pushing instructions where we left off.
-      usz instructions_handled = 0;
+      vector_clear(pending);
+      foreach_ptr_rev (inst, bb->instructions) vector_push(pending, inst);
 
-      /// This label acts as a point of continuation when we need to
-      /// (potentially) (re)fill the instructions vector and then pattern
-      /// match on it.
-    add_instructions:
-      for (; instructions_handled < bb->instructions.size; ++instructions_handled) {
-        // Add (up to) `longest_pattern_length` instructions to the instructions vector.
-        if (instructions.size >= longest_pattern_length) break;
+      // Instructions that will be output.
+      MIRInstructionVector new_instructions = {0};
 
-        MIRInstruction *inst = bb->instructions.data[instructions_handled];
+      while (pending.size) {
+        vector_clear(window);
+        for (usz i = 0; i < matcher.longest_pattern_length && i < pending.size; ++i)
+          vector_push(window, pending.data[pending.size - 1 - i]);
 
-        vector_push(instructions, inst);
-      }
+        ISelPattern *pattern = isel_matcher_select(&matcher, patterns, window, &uses, cover_costs);
 
-      bool matched = false;
-      foreach (pattern, patterns) {
-        if (isel_does_pattern_match(*pattern, instructions)) {
-          matched = true;
-
-          // Remove first N instructions where N is the amount of
-          // instructions that matched in the pattern.
-          // Put these in a "pattern input" tmp buffer as we remove them.
-          MIRInstructionVector pattern_input = {0};
-          for (usz j = 0; j < pattern->input.size; ++j) {
-            vector_push(pattern_input, vector_front(instructions));
-            vector_remove_index(instructions, 0);
-          }
+        // If none of the patterns matched, emit the next instruction
+        // into the output as-is.
+        if (!pattern) {
+          vector_push(new_instructions, vector_pop(pending));
+          continue;
+        }
 
-          // Prepend output instructions from pattern to instructions.
-          // Iterate over the pattern output instructions, making a
-          // copy of each and populating operands as necessary,
-          // corresponding to pattern references.
-          MIRInstruction *last_input_inst = vector_back(pattern_input);
-          foreach_index (i, pattern->output) {
-            MIRInstruction *pattern_inst = pattern->output.data[i];
-            MIRInstruction *out = mir_makecopy(pattern_inst);
-            if (i == pattern->output.size - 1)
-              out->reg = last_input_inst->reg;
-            else out->reg = MIR_ARCH_START + f->inst_count++;
-            out->origin = last_input_inst->origin;
-            out->block = bb;
-
-            FOREACH_MIR_OPERAND(out, op) {
-              // Resolve operand and instruction pattern references...
-              if (op->kind == MIR_OP_OP_REF) {
-                ASSERT(op->value.op_ref.pattern_instruction_index < pattern_input.size + pattern->output.size,
-                       "Invalid pattern instruction index in operand reference (parser went wrong)");
-                MIRInstruction *inst = NULL;
-                if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
-                  usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
-                  ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
-                  // Self-reference or backward-reference
-                  if (pattern_output_inst_index == i) inst = out;
-                  else inst = instructions.data[pattern_output_inst_index];
-                }
-                else inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
-
-                // Get operand from resolved instruction reference
-                ASSERT(op->value.op_ref.operand_index < inst->operand_count,
-                       "Invalid operand index (parser went wrong)");
-
-                *op = *mir_get_op(inst, op->value.op_ref.operand_index);
-
-              } else if (op->kind == MIR_OP_INST_REF) {
-                ASSERT(op->value.inst_ref < pattern_input.size + pattern->output.size,
-                       "Invalid pattern instruction index in instruction reference (parser went wrong)");
-                if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
-                  usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
-                  ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
-                  // Self-reference
-                  if (pattern_output_inst_index == i) {
-                    *op = mir_op_reference(out);
-                  } else {
-                    // Create a register reference to the OUTPUT instruction corresponding to the referenced *pattern* output instruction.
-                    MIRInstruction *inst = instructions.data[pattern_output_inst_index];
-                    *op = mir_op_reference(inst);
-                  }
+        pattern->hits++;
+
+        // The matched instructions are the first N of the window.
+        MIRInstruction **pattern_input = window.data;
+        usz pattern_input_size = pattern->input.size;
+        pending.size -= pattern_input_size;
+        for (usz i = 0; i < pattern_input_size; ++i)
+          isel_count_uses(&uses, pattern_input[i], true);
+
+        // Iterate over the pattern output instructions, making a copy
+        // of each and populating operands as necessary, corresponding
+        // to pattern references.
+        vector_clear(expanded);
+        MIRInstruction *last_input_inst = pattern_input[pattern_input_size - 1];
+        foreach_index (i, pattern->output) {
+          MIRInstruction *pattern_inst = pattern->output.data[i];
+          MIRInstruction *out = mir_makecopy(pattern_inst);
+          if (i == pattern->output.size - 1)
+            out->reg = last_input_inst->reg;
+          else out->reg = MIR_ARCH_START + f->inst_count++;
+          out->origin = last_input_inst->origin;
+          out->block = bb;
+
+          FOREACH_MIR_OPERAND(out, op) {
+            // Resolve operand and instruction pattern references...
+            if (op->kind == MIR_OP_OP_REF) {
+              ASSERT(op->value.op_ref.pattern_instruction_index < pattern_input_size + pattern->output.size,
+                     "Invalid pattern instruction index in operand reference (parser went wrong)");
+              MIRInstruction *inst = NULL;
+              if (op->value.op_ref.pattern_instruction_index >= pattern_input_size) {
+                usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input_size;
+                ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
+                // Self-reference or backward-reference
+                if (pattern_output_inst_index == i) inst = out;
+                else inst = expanded.data[pattern_output_inst_index];
+              }
+              else inst = pattern_input[op->value.op_ref.pattern_instruction_index];
+
+              // Get operand from resolved instruction reference
+              ASSERT(op->value.op_ref.operand_index < inst->operand_count,
+                     "Invalid operand index (parser went wrong)");
+
+              *op = *mir_get_op(inst, op->value.op_ref.operand_index);
+
+            } else if (op->kind == MIR_OP_INST_REF) {
+              ASSERT(op->value.inst_ref < pattern_input_size + pattern->output.size,
+                     "Invalid pattern instruction index in instruction reference (parser went wrong)");
+              if (op->value.op_ref.pattern_instruction_index >= pattern_input_size) {
+                usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input_size;
+                ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
+                // Self-reference
+                if (pattern_output_inst_index == i) {
+                  *op = mir_op_reference(out);
                 } else {
-                  MIRInstruction *inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
+                  // Create a register reference to the OUTPUT instruction corresponding to the referenced *pattern* output instruction.
+                  MIRInstruction *inst = expanded.data[pattern_output_inst_index];
                   *op = mir_op_reference(inst);
                 }
+              } else {
+                MIRInstruction *inst = pattern_input[op->value.op_ref.pattern_instruction_index];
+                *op = mir_op_reference(inst);
               }
             }
-
-            vector_insert(instructions, instructions.data + i, out);
           }
 
-          vector_delete(pattern_input);
-
-          // Again attempt to pattern match and do all this over again, until nothing happens.
-          break;
-        }
-      }
-      // If we get through *all* of the patterns, and none of them
-      // matched, we can pop an instruction off the front and emit it
-      // into the output, before going back to the "add instructions"
-      // bit.
-      if (!matched) {
-        if (instructions.size) {
-          // Add front of `instructions` to emission output.
-          vector_push(new_instructions, instructions.data[0]);
-          // Pop instruction.
-          vector_remove_index(instructions, 0);
+          isel_count_uses(&uses, out, false);
+          vector_push(expanded, out);
         }
-      }
-
-      // If there are more instructions in this block to match
-      // against, go back and them, pattern match again, etc.
-      if (instructions_handled < bb->instructions.size)
-        goto add_instructions;
 
-      // Otherwise, if there are remaining instructions, go again.
-      if (instructions.size != 0) goto add_instructions;
+        // Prepend the output instructions to the pending ones, so that
+        // they are pattern matched again, until nothing happens.
+        foreach_ptr_rev (out, expanded) vector_push(pending, out);
+      }
 
       // Fully handled instructions of block; replace old instructions with newly selected ones.
       MIRInstructionVector tmp = bb->instructions;
@@ -1282,23 +1786,23 @@ void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
   } // foreach_ptr (MIRFunction*, f, ...)
 
   // Mark defining uses of virtual register operands for RA.
-  ISelRegisterValues vregs_seen = {0};
-  MIRBlockVector visited = {0};
-  MIRBlockVector doubly_visited = {0};
   foreach_val (f, mir) {
     if (!ir_func_is_definition(f->origin)) continue;
 
     MIRBlock *entry = vector_front(f->blocks);
     ASSERT(entry->is_entry, "First block within MIRFunction is not entry point; we should do more work to find the entry, sorry");
 
-    // NOTE: This function is an absolute doozy; check it out, iff you must.
-    calculate_defining_uses_for_block(&vregs_seen, entry, &visited, &doubly_visited);
-
+    calculate_defining_uses(f);
   }
 
-  vector_delete(vregs_seen);
-
-  vector_delete(instructions);
+  vector_delete(defs);
+  vector_delete(uses);
+  free(positions);
+  vector_delete(expanded);
+  vector_delete(window);
+  vector_delete(pending);
+  free(cover_costs);
+  isel_matcher_delete(&matcher);
   isel_env_delete(&env);
 }
 
@@ -1359,3 +1863,27 @@ void isel_print_patterns(ISelPatterns *patterns, OpcodeMnemonicFunction opcode_m
     isel_print_pattern(pattern, opcode_mnemonic);
   }
 }
+
+void isel_print_stats(ISelPatterns *patterns, OpcodeMnemonicFunction opcode_mnemonic) {
+  Vector(ISelPattern *) applied = {0};
+  foreach (pattern, *patterns) {
+    if (pattern->hits) vector_push(applied, pattern);
+  }
+
+  // Sort by number of hits, most first; keep file order otherwise.
+  for (usz i = 1; i < applied.size; ++i) {
+    ISelPattern *pattern = applied.data[i];
+    usz j = i;
+    for (; j > 0 && applied.data[j - 1]->hits < pattern->hits; --j)
+      applied.data[j] = applied.data[j - 1];
+    applied.data[j] = pattern;
+  }
+
+  print("================ ISel Stats ================\n");
+  print("%Z of %Z patterns applied\n", applied.size, patterns->size);
+  foreach_val (pattern, applied) {
+    print("\n%Z hits (pattern %Z, cost %Z)", pattern->hits, (usz) (pattern - patterns->data), pattern->cost);
+    isel_print_pattern(pattern, opcode_mnemonic);
+  }
+  vector_delete(applied);
+}
@@ -3,6 +3,7 @@
 
 #include <codegen/codegen_forward.h>
 #include <codegen/machine_ir.h>
+#include <stdio.h>
 
 typedef enum ISelEnvironmentEntryKind {
   ISEL_ENV_NONE,
@@ -57,14 +58,73 @@ typedef struct ISelPattern {
   MIRInstructionVector input;
   MIRInstructionVector output;
   ISelEnvironment local;
+
+  /// Cost of the emitted instructions, as given in the pattern file, or
+  /// the number of emitted instructions by default. Of several patterns
+  /// that match, ISel picks the one that leads to the cheapest cover.
+  usz cost;
+
+  /// Number of times this pattern was applied; see `--isel-stats`.
+  usz hits;
 } ISelPattern;
 typedef Vector(ISelPattern) ISelPatterns;
 
 ISelPatterns isel_parse_file(const char *filepath);
 
+/// Patterns compiled to static C tables at build time, so that the
+/// pattern file need not be read and parsed on every run. Pattern
+/// instructions, operands, and clobbers are stored in flat arrays; each
+/// pattern or instruction refers to a slice of these by index and count.
+typedef struct ISelTableInstruction {
+  uint32_t opcode;
+  uint8_t operand_count;
+  uint8_t clobber_count;
+  usz operands;
+  usz clobbers;
+} ISelTableInstruction;
+
+typedef struct ISelTablePattern {
+  usz input;
+  usz input_count;
+  usz output;
+  usz output_count;
+  usz cost;
+} ISelTablePattern;
+
+typedef struct ISelTable {
+  const ISelTablePattern *patterns;
+  usz pattern_count;
+  const ISelTableInstruction *instructions;
+  const MIROperand *operands;
+  const MIROperandRegister *clobbers;
+} ISelTable;
+
+/// If set, patterns are parsed from this file instead of using the
+/// built-in tables; useful when working on the patterns themselves.
+extern const char *isel_patterns_filepath;
+
+/// Create patterns from a table generated by `isel_write_table()`.
+ISelPatterns isel_patterns_from_table(const ISelTable *table);
+
+/// Write C source code defining a `static const ISelTable` with the
+/// given name that contains the given patterns.
+void isel_write_table(FILE *file, ISelPatterns patterns, const char *name);
+
 /// Return true iff given instructions match pattern.
 bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructions);
 
+/// If set (the default), patterns with more than one input are also
+/// matched against def-use trees within a block, not just against
+/// adjacent instructions; see `isel_do_selection()`.
+extern bool isel_match_trees;
+
+/// Select instructions for the given functions, in place.
+///
+/// A pattern with more than one input only ever applies if the results
+/// of all of its inputs but the last are used by nothing but the rest of
+/// the pattern. If `isel_match_trees` is set, the single-use operand
+/// definitions of an instruction that match such a pattern together
+/// with it are moved right in front of it first, where that is legal.
 void isel_do_selection(MIRFunctionVector mir, ISelPatterns);
 
 void isel_patterns_delete(ISelPatterns *patterns);
@@ -73,4 +133,10 @@ void isel_print_mir_operand(MIROperand *operand);
 void isel_print_pattern(ISelPattern *pattern, OpcodeMnemonicFunction opcode_mnemonic);
 void isel_print_patterns(ISelPatterns *patterns, OpcodeMnemonicFunction opcode_mnemonic);
 
+/// Whether to print how often each pattern was applied after ISel.
+extern bool print_isel_stats;
+
+/// Print the patterns that were applied, most frequently applied first.
+void isel_print_stats(ISelPatterns *patterns, OpcodeMnemonicFunction opcode_mnemonic);
+
 #endif /* INSTRUCTION_SELECTION_H */
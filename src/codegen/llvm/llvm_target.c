@@ -128,7 +128,7 @@ static bool is_noop_bitcast(IRInstruction *inst) {
 /// values, whereas LLVM does not; furthermore, we it also considers
 /// immediates values, whereas LLVM always inlines them.
 static bool llvm_is_numbered_value(IRInstruction *inst) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all IR instructions");
   switch (ir_kind(inst)) {
     case IR_COUNT: break;
     case IR_IMMEDIATE:   /// Inlined.
@@ -161,6 +161,7 @@ static bool llvm_is_numbered_value(IRInstruction *inst) {
 
     case IR_LOAD:
     case IR_PHI:
+    case IR_SELECT:
     case IR_ADD:
     case IR_SUB:
     case IR_MUL:
@@ -236,7 +237,7 @@ void emit_string_data(LLVMContext *ctx, span s, bool print_type) {
 /// operands of instructions.
 static void emit_value(LLVMContext *ctx, IRInstruction *value, bool print_type) {
   string_buffer *out = &ctx->out;
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all IR instructions");
 
   /// Emit the type if requested.
   if (print_type) {
@@ -328,6 +329,7 @@ static void emit_value(LLVMContext *ctx, IRInstruction *value, bool print_type)
     case IR_CALL:
     case IR_LOAD:
     case IR_PHI:
+    case IR_SELECT:
     case IR_ADD:
     case IR_SUB:
     case IR_MUL:
@@ -453,7 +455,7 @@ static void emit_pointer_add(
 /// instructions in other places, see `emit_value`.
 static void emit_instruction(LLVMContext *ctx, IRInstruction *inst) {
   string_buffer *out = &ctx->out;
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all IR instructions");
   switch (ir_kind(inst)) {
     case IR_COUNT: UNREACHABLE();
 
@@ -602,6 +604,20 @@ static void emit_instruction(LLVMContext *ctx, IRInstruction *inst) {
       format_to(out, "\n");
       break;
 
+    /// Selects need their condition narrowed to a bool, just like
+    /// conditional branches.
+    case IR_SELECT:
+      format_to(out, "    %%i1.%u = icmp ne ", ir_id(inst));
+      emit_value(ctx, ir_select_cond(inst), true);
+      format_to(out, ", 0\n");
+      emit_instruction_index(ctx, inst);
+      format_to(out, "select i1 %%i1.%u, ", ir_id(inst));
+      emit_value(ctx, ir_select_then(inst), true);
+      format_to(out, ", ");
+      emit_value(ctx, ir_select_else(inst), true);
+      format_to(out, "\n");
+      break;
+
     /// In LLVM, comparisons return an i1. However, we don’t have
     /// bools yet in intercept, so we need to convert the result
     /// back to whatever type Intercept wants it to be.
@@ -253,6 +253,7 @@ MIRBlock *mir_block_makenew(MIRFunction *function, span name) {
   MIRBlock* bb = calloc(1, sizeof(*bb));
   bb->function = function;
   bb->name = string_dup(name);
+  bb->id = function->blocks.size;
   vector_push(function->blocks, bb);
   return bb;
 }
@@ -291,12 +292,13 @@ MIRInstruction *mir_from_ir_copy(MIRFunction *function, IRInstruction *copy) {
 
 /// Return non-zero iff given instruction needs a register.
 static bool needs_register(IRInstruction *instruction) {
-  STATIC_ASSERT(IR_COUNT == 40, "Exhaustively handle all instruction types");
+  STATIC_ASSERT(IR_COUNT == 41, "Exhaustively handle all instruction types");
   ASSERT(instruction);
   switch (ir_kind(instruction)) {
     case IR_LOAD:
     case IR_PHI:
     case IR_COPY:
+    case IR_SELECT:
     case IR_IMMEDIATE:
     case IR_INTRINSIC:
     case IR_CALL:
@@ -348,115 +350,242 @@ static void remove_inlined(MIRFunction *function) {
   vector_delete(instructions_to_remove);
 }
 
+/// Insert copies from the arguments of the given phis that are
+/// associated with a predecessor into the phis’ virtual registers.
+///
+/// \param into The block to insert the copies into.
+/// \param index The index at which to insert them.
+static void phi2copy_insert(
+  MIRFunction *function,
+  MIRInstructionVector *phis,
+  IRBlock *pred,
+  MIRBlock *into,
+  usz index
+) {
+  /// Collect the values.
+  MIRInstructionVector targets = {0};
+  IRInstructionVector values = {0};
+  foreach_val (instruction, *phis) {
+    IRInstruction *phi = instruction->origin;
+    for (usz i = 0; i < ir_phi_args_count(phi); i++) {
+      const IRPhiArgument *arg = ir_phi_arg(phi, i);
+      if (arg->block != pred) continue;
+      if (!needs_register(arg->value)) {
+        print("\n\n%31Offending block%m:\n");
+        ir_print_block(stdout, ir_parent(arg->value));
+        ICE("Block ends with instruction that does not return value.");
+      }
+
+      vector_push(targets, instruction);
+      vector_push(values, arg->value);
+      break;
+    }
+  }
+
+  /// A single copy can be inserted directly. If there are multiple
+  /// phis, then one of them may be an argument of another; since the
+  /// copies are supposed to happen in parallel, go through temporaries
+  /// first (the register allocator can coalesce those).
+  ///
+  /// The copies take their size from the phi they belong to.
+  if (targets.size == 1) {
+    MIRInstruction *copy = mir_makenew(MIR_COPY);
+    copy->origin = targets.data[0]->origin;
+    mir_add_op(copy, mir_op_reference_ir(function, values.data[0]));
+    mir_insert_instruction_with_reg(into, copy, index, targets.data[0]->reg);
+  } else {
+    MIRInstructionVector temps = {0};
+    foreach_index (i, targets) {
+      MIRInstruction *temp = mir_makenew(MIR_COPY);
+      temp->origin = targets.data[i]->origin;
+      mir_add_op(temp, mir_op_reference_ir(function, values.data[i]));
+      mir_insert_instruction(into, temp, index++);
+      vector_push(temps, temp);
+    }
+
+    foreach_index (i, targets) {
+      MIRInstruction *copy = mir_makenew(MIR_COPY);
+      copy->origin = targets.data[i]->origin;
+      mir_add_op(copy, mir_op_reference(temps.data[i]));
+      mir_insert_instruction_with_reg(into, copy, index++, targets.data[i]->reg);
+    }
+
+    vector_delete(temps);
+  }
+
+  vector_delete(targets);
+  vector_delete(values);
+}
+
 /// For each argument of each phi instruction, add in a copy to the phi's virtual register.
 static void phi2copy(MIRFunction *function) {
-  IRBlock *last_block = NULL;
-  MIRInstructionVector instructions_to_remove = {0};
-  foreach_val (block, function->blocks) {
-    vector_clear(instructions_to_remove);
+  MIRInstructionVector phis = {0};
+  IRBlockVector preds = {0};
+
+  /// Note: this adds blocks to the function, so don’t use foreach here.
+  for (usz block_index = 0; block_index < function->blocks.size; block_index++) {
+    MIRBlock *block = function->blocks.data[block_index];
+    vector_clear(phis);
+    vector_clear(preds);
     foreach_val (instruction, block->instructions) {
       if (instruction->opcode != MIR_PHI) continue;
       IRInstruction *phi = instruction->origin;
-      ASSERT(ir_parent(phi) != last_block, "Multiple PHI instructions in a single block are not allowed!");
-      last_block = ir_parent(phi);
 
       /// Single PHI argument means that we can replace it with a simple copy.
-      usz args_count = ir_phi_args_count(phi);
-      if (args_count == 1) {
+      if (ir_phi_args_count(phi) == 1) {
         instruction->opcode = MIR_COPY;
         mir_op_clear(instruction);
         mir_add_op(instruction, mir_op_reference_ir(function, ir_phi_arg(phi, 0)->value));
         continue;
       }
 
-      /// For each of the PHI arguments, we basically insert a copy.
-      /// Where we insert it depends on some complicated factors
-      /// that have to do with control flow.
-      for (usz i = 0; i < args_count; i++) {
-        STATIC_ASSERT(IR_COUNT == 40, "Handle all branch types");
-        const IRPhiArgument *arg = ir_phi_arg(phi, i);
-        IRInstruction *branch = ir_terminator(arg->block);
-        switch (ir_kind(branch)) {
+      vector_push(phis, instruction);
+      for (usz i = 0; i < ir_phi_args_count(phi); i++) {
+        IRBlock *pred = ir_phi_arg(phi, i)->block;
+        if (!vector_contains(preds, pred)) vector_push(preds, pred);
+      }
+    }
+
+    /// For each predecessor, we basically insert a copy for every PHI.
+    /// Where we insert them depends on some complicated factors that
+    /// have to do with control flow.
+    foreach_val (pred, preds) {
+      STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types");
+      IRInstruction *branch = ir_terminator(pred);
+      switch (ir_kind(branch)) {
         /// If the predecessor returns or is unreachable, then the PHI
         /// is never going to be reached, so we can just ignore
         /// this argument.
         case IR_UNREACHABLE:
         case IR_RETURN: continue;
 
-        /// For direct branches, we just insert the copy before the branch.
+        /// For direct branches, we just insert the copies before the branch.
         case IR_BRANCH: {
-          if (needs_register(arg->value)) {
-            MIRInstruction *copy = mir_makenew(MIR_COPY);
-            MIRInstruction *value_mir = ir_mir(arg->value);
-            ASSERT(value_mir);
-            ASSERT(value_mir->block);
-            copy->block = value_mir->block;
-            copy->reg = instruction->reg;
-            mir_add_op(copy, mir_op_reference_ir(function, arg->value));
-            // Insert copy before branch machine instruction.
-            // mir_push_before(branch->machine_inst, copy);
-            MIRInstructionVector *instructions = &value_mir->block->instructions;
-            vector_insert(*instructions, instructions->data + (instructions->size - 1), copy);
-          } else {
-            print("\n\n%31Offending block%m:\n");
-            ir_print_block(stdout, ir_parent(arg->value));
-            ICE("Block ends with instruction that does not return value.");
-          }
+          MIRBlock *pred_mir = ir_mir(pred);
+          phi2copy_insert(function, &phis, pred, pred_mir, pred_mir->instructions.size - 1);
         } break;
 
-        /// Indirect branches are a bit more complicated. We need to insert an
-        /// additional block for the copy instruction and replace the branch
+        /// Conditional branches are a bit more complicated. We need to insert an
+        /// additional block for the copy instructions and replace the branch
         /// to the phi block with a branch to that block.
         case IR_BRANCH_CONDITIONAL: {
-
-          // Create a COPY of the argument into the MIR PHI's vreg.
-          // When we eventually remove the MIR PHI, what will be left is a bunch
-          // of copies into the same virtual register. RA can then fill this virtual
-          // register in with a single register and boom our PHI is codegenned
-          // properly.
-          MIRInstruction *copy = mir_makenew(MIR_COPY);
-          mir_add_op(copy, mir_op_reference_ir(function, arg->value));
-          copy->reg = instruction->reg;
-
           // Possible FIXME: This relies on backend filling empty block
           // names with something.
           MIRBlock *critical_edge_trampoline = mir_block_makenew(function, literal_span(""));
-          mir_push_into_block(function, critical_edge_trampoline, copy);
+
           // Branch to phi block from critical edge
           MIRInstruction *critical_edge_branch = mir_makenew(MIR_BRANCH);
-          critical_edge_branch->block = instruction->block;
+          mir_add_op(critical_edge_branch, mir_op_block(block));
           mir_push_into_block(function, critical_edge_trampoline, critical_edge_branch);
 
+          // Create COPYs of the arguments into the MIR PHIs’ vregs.
+          // When we eventually remove the MIR PHIs, what will be left
+          // is a bunch of copies into the same virtual register. RA can
+          // then fill each virtual register in with a single register
+          // and boom our PHI is codegenned properly.
+          phi2copy_insert(function, &phis, pred, critical_edge_trampoline, 0);
+
           // The critical edge trampoline block is now complete. This
           // means we can replace the branch of the argument block to that
           // of this critical edge trampoline.
 
           // Condition is first operand, then the "then" branch, then "else".
-          IRBlock *phi_parent = ir_parent(phi);
           MIRInstruction *branch_mir = ir_mir(branch);
           MIROperand *branch_then = mir_get_op(branch_mir, 1);
           MIROperand *branch_else = mir_get_op(branch_mir, 2);
-          if (branch_then->value.block->origin == phi_parent)
-            *branch_then = mir_op_block(critical_edge_trampoline);
-          else {
-            ASSERT(branch_else->value.block->origin == phi_parent,
-                   "Branch to phi block is neither true nor false branch of conditional branch!");
-            *branch_else = mir_op_block(critical_edge_trampoline);
-          }
+          ASSERT(branch_then->value.block == block || branch_else->value.block == block,
+                 "Branch to phi block is neither true nor false branch of conditional branch!");
+          if (branch_then->value.block == block) *branch_then = mir_op_block(critical_edge_trampoline);
+          if (branch_else->value.block == block) *branch_else = mir_op_block(critical_edge_trampoline);
+
+          // CFG
+          MIRBlock *pred_mir = ir_mir(pred);
+          foreach (succ, pred_mir->successors)
+            if (*succ == block) *succ = critical_edge_trampoline;
+          foreach (p, block->predecessors)
+            if (*p == pred_mir) *p = critical_edge_trampoline;
+          vector_push(critical_edge_trampoline->successors, block);
+          vector_push(critical_edge_trampoline->predecessors, pred_mir);
         } break;
+
         default: UNREACHABLE();
-        }
+      }
+    }
+
+    foreach_val (to_remove, phis) {
+      vector_remove_element(block->instructions, to_remove);
+    }
+  }
+
+  vector_delete(phis);
+  vector_delete(preds);
+}
+
+static void mir_functions_bottom_up_impl(MIRFunction *f, MIRFunctionVector *visited, MIRFunctionVector *out) {
+  if (vector_contains(*visited, f)) return;
+  vector_push(*visited, f);
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      if (inst->opcode != MIR_CALL || !inst->operand_count) continue;
+      MIROperand *callee = mir_get_op(inst, 0);
+      if (callee->kind == MIR_OP_FUNCTION)
+        mir_functions_bottom_up_impl(callee->value.function, visited, out);
+    }
+  }
+  vector_push(*out, f);
+}
 
-        // Add index of phi instruction to list of instructions to remove.
-        vector_push(instructions_to_remove, instruction);
+MIRFunctionVector mir_functions_bottom_up(MIRFunctionVector functions) {
+  MIRFunctionVector visited = {0};
+  MIRFunctionVector out = {0};
+  foreach_val (f, functions) mir_functions_bottom_up_impl(f, &visited, &out);
+  vector_delete(visited);
+  return out;
+}
+
+MIRBlockVector mir_blocks_reverse_postorder(MIRFunction *function) {
+  usz count = function->blocks.size;
+  u8 *visited = calloc(count ? count : 1, 1);
+  MIRBlockVector postorder = {0};
+
+  foreach_index (i, function->blocks) function->blocks.data[i]->id = i;
+
+  /// Iterative depth-first search; each path entry records a block and
+  /// the index of the next successor to visit.
+  typedef struct PathEntry { MIRBlock *block; usz next; } PathEntry;
+  Vector(PathEntry) path = {0};
+  foreach_val (root, function->blocks) {
+    if (!root->is_entry || visited[root->id]) continue;
+    PathEntry entry = {root, 0};
+    vector_push(path, entry);
+    visited[root->id] = 1;
+    while (path.size) {
+      PathEntry *top = &vector_back(path);
+      if (top->next == top->block->successors.size) {
+        vector_push(postorder, top->block);
+        (void) vector_pop(path);
+        continue;
       }
 
-      foreach_val (to_remove, instructions_to_remove) {
-        vector_remove_element(block->instructions, to_remove);
+      MIRBlock *succ = top->block->successors.data[top->next++];
+      if (!visited[succ->id]) {
+        visited[succ->id] = 1;
+        PathEntry next = {succ, 0};
+        vector_push(path, next);
       }
     }
   }
-  vector_delete(instructions_to_remove);
+
+  /// Reverse the postorder in place.
+  for (usz i = 0; i < postorder.size / 2; ++i) {
+    MIRBlock *tmp = postorder.data[i];
+    postorder.data[i] = postorder.data[postorder.size - 1 - i];
+    postorder.data[postorder.size - 1 - i] = tmp;
+  }
+
+  vector_delete(path);
+  free(visited);
+  return postorder;
 }
 
 MIRFunctionVector mir_from_ir(CodegenContext *context) {
@@ -483,7 +612,7 @@ MIRFunctionVector mir_from_ir(CodegenContext *context) {
       IRBlock *bb = mir_bb->origin;
       ASSERT(bb, "Origin of general MIR block not set (what gives?)");
 
-      STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+      STATIC_ASSERT(IR_COUNT == 41, "Handle all IR instructions");
       FOREACH_INSTRUCTION(inst, bb) {
         switch (ir_kind(inst)) {
 
@@ -649,6 +778,15 @@ MIRFunctionVector mir_from_ir(CodegenContext *context) {
           ir_mir(inst, mir);
           mir_push_into_block(function, mir_bb, mir);
         } break;
+        case IR_SELECT: {
+          MIRInstruction *mir = mir_makenew(MIR_SELECT);
+          mir->origin = inst;
+          mir_add_op(mir, mir_op_reference_ir(function, ir_select_cond(inst)));
+          mir_add_op(mir, mir_op_reference_ir(function, ir_select_then(inst)));
+          mir_add_op(mir, mir_op_reference_ir(function, ir_select_else(inst)));
+          ir_mir(inst, mir);
+          mir_push_into_block(function, mir_bb, mir);
+        } break;
         case IR_STATIC_REF: {
           MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
           ir_mir(inst, mir);
@@ -721,7 +859,7 @@ const char *mir_operand_kind_string(MIROperandKind opkind) {
 }
 
 const char *mir_common_opcode_mnemonic(uint32_t opcode) {
-  STATIC_ASSERT(MIR_COUNT == 39, "Exhaustive handling of MIRCommonOpcodes (string conversion)");
+  STATIC_ASSERT(MIR_COUNT == 40, "Exhaustive handling of MIRCommonOpcodes (string conversion)");
   switch ((MIROpcodeCommon)opcode) {
   case MIR_IMMEDIATE: return "m.immediate";
   case MIR_INTRINSIC: return "m.intrinsic";
@@ -732,6 +870,7 @@ const char *mir_common_opcode_mnemonic(uint32_t opcode) {
   case MIR_TRUNCATE: return "m.truncate";
   case MIR_BITCAST: return "m.bitcast";
   case MIR_COPY: return "m.copy";
+  case MIR_SELECT: return "m.select";
   case MIR_LOAD: return "m.load";
   case MIR_RETURN: return "m.return";
   case MIR_BRANCH: return "m.branch";
@@ -768,6 +907,8 @@ const char *mir_common_opcode_mnemonic(uint32_t opcode) {
   switch ((MIROpcodePseudo)opcode) {
   case MPSEUDO_START: return "pseudo:start";
   case MPSEUDO_R2R: return "pseudo:r2r";
+  case MPSEUDO_SPILL_REG: return "pseudo:spill";
+  case MPSEUDO_UNSPILL_REG: return "pseudo:unspill";
   case MPSEUDO_END: return "pseudo:end";
   case MPSEUDO_COUNT: return "pseudo:count";
   }
@@ -27,8 +27,12 @@ typedef enum MIROpcodePseudo {
   // equal to another, but you still need to move between them.
   MPSEUDO_R2R,
 
-  // TODO: MPSEUDO_SPILL_REG    Save register, somehow
-  // TODO: MPSEUDO_UNSPILL_REG  Restore register, somehow
+  // Save a register to the stack; inserted by the register allocator.
+  // MPSEUDO_SPILL_REG(Register value, Local slot)
+  MPSEUDO_SPILL_REG,
+  // Restore a register from the stack; inserted by the register allocator.
+  // MPSEUDO_UNSPILL_REG(Local slot, Register value)
+  MPSEUDO_UNSPILL_REG,
 
   MPSEUDO_END,
   MPSEUDO_COUNT = MPSEUDO_END - MPSEUDO_START
@@ -86,7 +90,8 @@ typedef struct MIROperand {
   /// Used *only* by instruction selection.
   // When `value_constraint_kind` is not equal to MIR_OP_NONE,
   // instruction selection will ensure equality of the referenced
-  // operand/instruction during pattern expansion.
+  // operand/instruction during pattern expansion. MIR_OP_IMMEDIATE
+  // means the operand must be equal to this operand's immediate.
   MIROperandKind value_constraint_kind;
   union {
     MIROperandOpRef op_ref;
@@ -120,6 +125,11 @@ typedef struct MIRInstruction {
 
   MIROperandRegisters clobbers;
 
+  /// Calls only: bitmask of the hardware registers that must be saved
+  /// around the call, because they hold values that are live across it
+  /// and the callee may clobber them. Set by register allocation.
+  usz save_across;
+
   MIRBlock *block;
 
   // Keep track of originating IR instruction.
@@ -143,6 +153,10 @@ typedef struct MIRBlock {
   string name;
   MIRInstructionVector instructions;
 
+  /// Index of this block within the blocks of its function. Passes
+  /// that reorder or remove blocks must renumber them.
+  usz id;
+
   MIRFunction *function;
   IRBlock *origin;
   MIRBlock* lowered;
@@ -180,6 +194,12 @@ typedef struct MIRFunction {
 
   MIRBlockVector blocks;
 
+  /// Bitmask of the hardware registers that a call to this function
+  /// may clobber. Only valid if `clobbers_known` is set, which backends
+  /// do once the function has been fully lowered.
+  usz clobbers;
+  bool clobbers_known;
+
   IRFunction *origin;
 } MIRFunction;
 
@@ -255,6 +275,18 @@ void mir_push_with_reg(MIRFunction *mir, MIRInstruction *mi, MIRRegister reg);
 /// DEPRECATED
 MIRInstruction *mir_find_by_vreg(MIRFunction *mir, size_t reg);
 
+/// Return the given functions ordered such that every function comes
+/// after the functions it calls directly, except where calls are
+/// recursive. Caller is responsible for calling vector_delete().
+MIRFunctionVector mir_functions_bottom_up(MIRFunctionVector functions);
+
+/// Return the blocks of the given function that are reachable from its
+/// entry, in reverse postorder of a depth-first search that visits
+/// successors in order. An edge from A to B is a retreating edge (i.e. a
+/// back edge, for reducible control flow) iff B does not come after A. Also renumbers the `id`s of all
+/// blocks of the function. Caller is responsible for calling vector_delete().
+MIRBlockVector mir_blocks_reverse_postorder(MIRFunction *function);
+
 /// Create an MIR function from an IR function.
 MIRFunction *mir_function(IRFunction *ir_f);
 
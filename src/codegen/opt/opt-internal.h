@@ -8,6 +8,7 @@
 #include <codegen/opt/opt.h>
 #include <ir/dom.h>
 #include <ir/ir.h>
+#include <ir/loops.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
@@ -17,12 +17,35 @@ typedef Vector(IRBlock *) BlockVector;
     changed = true;                                                                    \
   }
 
+/// Fold an ordered comparison of two immediates. Comparisons are
+/// always signed, so the operands are sign-extended from their size.
+#define IR_REDUCE_COMPARISON(op)                                             \
+  IRInstruction *lhs = ir_lhs(i);                                            \
+  IRInstruction *rhs = ir_rhs(i);                                            \
+  if (ir_kind(lhs) == IR_IMMEDIATE && ir_kind(rhs) == IR_IMMEDIATE) {        \
+    usz size = type_sizeof(ir_typeof(lhs));                                  \
+    bool value = sign_extend_from_size(ir_imm(lhs), size)                    \
+      op sign_extend_from_size(ir_imm(rhs), size);                           \
+    ir_replace(i, ir_create_immediate(ctx, ir_typeof(i), value));            \
+    changed = true;                                                          \
+  }
+
+static u64 truncate_to_size(u64 value, usz size) {
+  return size < 8 ? value & ((1ull << (size * 8)) - 1) : value;
+}
+
+static i64 sign_extend_from_size(u64 value, usz size) {
+  if (size >= 8) return (i64) value;
+  u64 sign = 1ull << (size * 8 - 1);
+  return (i64) ((truncate_to_size(value, size) ^ sign) - sign);
+}
+
 static bool power_of_two(u64 value) {
   return value > 0 && (value & (value - 1)) == 0;
 }
 
 static bool has_side_effects(IRInstruction *i) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
   switch (ir_kind(i)) {
     /// These do NOT have side effects.
     case IR_IMMEDIATE:
@@ -38,6 +61,8 @@ static bool has_side_effects(IRInstruction *i) {
     case IR_SIGN_EXTEND:
     case IR_TRUNCATE:
     case IR_BITCAST:
+    case IR_COPY:
+    case IR_SELECT:
     case IR_POISON:
       ALL_BINARY_INSTRUCTION_CASES()
       return false;
@@ -55,7 +80,7 @@ static bool has_side_effects(IRInstruction *i) {
 
 /// Check if this instruction may clobber memory.
 static bool clobbers_memory(IRInstruction *inst){
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
   switch (ir_kind(inst)) {
     case IR_COUNT: UNREACHABLE();
 
@@ -230,16 +255,16 @@ static bool opt_instcombine(CodegenContext *ctx, IRFunction *f) {
         } break;
 
         case IR_LT: {
-          IR_REDUCE_BINARY(<);
+          IR_REDUCE_COMPARISON(<)
         } break;
         case IR_LE: {
-          IR_REDUCE_BINARY(<=);
+          IR_REDUCE_COMPARISON(<=)
         } break;
         case IR_GT: {
-          IR_REDUCE_BINARY(>);
+          IR_REDUCE_COMPARISON(>)
         } break;
         case IR_GE: {
-          IR_REDUCE_BINARY(>=);
+          IR_REDUCE_COMPARISON(>=)
         } break;
         case IR_NE: {
           IR_REDUCE_BINARY(!=)
@@ -316,6 +341,18 @@ static bool opt_instcombine(CodegenContext *ctx, IRFunction *f) {
           changed = true;
         } break;
 
+        /// Simplify selects whose result is known.
+        case IR_SELECT: {
+          IRInstruction *cond = ir_select_cond(i);
+          if (ir_kind(cond) == IR_IMMEDIATE) {
+            ir_replace_uses(i, ir_imm(cond) ? ir_select_then(i) : ir_select_else(i));
+            changed = true;
+          } else if (ir_select_then(i) == ir_select_else(i)) {
+            ir_replace_uses(i, ir_select_then(i));
+            changed = true;
+          }
+        } break;
+
         /// Simplify indirect calls to direct calls.
         case IR_CALL: {
           if (ir_call_is_direct(i)) break;
@@ -479,328 +516,1707 @@ static bool opt_tail_call_elim(IRFunction *f) {
 }
 
 /// ===========================================================================
-///  Mem2Reg
+///  Scalar replacement of aggregates
 /// ===========================================================================
-static bool opt_mem2reg(IRFunction *f) {
-  bool changed = false;
-
-  /// A stack variable.
-  typedef struct {
-    IRInstruction *alloca;
-    IRInstruction *store;
-    Vector(IRInstruction *) loads;
-    bool unoptimisable;
-  } stack_var;
-  Vector(stack_var) vars = {0};
-
-  /// Collect all stack variables that are stored into once, and
-  /// whose address is never taken.
-  FOREACH_BLOCK (b, f) {
-    FOREACH_INSTRUCTION (i, b) {
-      switch (ir_kind(i)) {
-        default: break;
-
-        /// New variable.
-        case IR_ALLOCA: {
-          stack_var v = {0};
-          v.alloca = i;
-          vector_push(vars, v);
-        } break;
+/// A load or store of (part of) an aggregate stack variable.
+typedef struct {
+  IRInstruction *inst;
+  usz offset;
+  Type *type;
+  bool whole;
+} sroa_access;
 
-        /// Record the first store into a variable.
-        case IR_STORE: {
-          foreach (a, vars) {
-            if (!a->unoptimisable && a->alloca == ir_store_addr(i)) {
-              /// If there are multiple stores, mark the variable as unoptimisable.
-              if (a->store) a->unoptimisable = true;
-              else a->store = i;
-              break;
-            }
-          }
-        } break;
+/// A part of an aggregate that is replaced by a scalar variable.
+typedef struct {
+  usz offset;
+  Type *type;
+  IRInstruction *alloca;
+} sroa_slot;
 
-        /// Record all loads; also check for loads before the first store.
-        case IR_LOAD: {
-          foreach (a, vars) {
-            if (!a->unoptimisable && a->alloca ==ir_operand(i)) {
-              /// Load before store.
-              if (!a->store) {
-                a->unoptimisable = true;
-                CodegenContext *ctx = ir_context(f);
-                issue_diagnostic(
-                  DIAG_WARN,
-                  ctx->ast->filename.data,
-                  as_span(ctx->ast->source),
-                  ir_location(f), /// FIXME: Should be location of the load.
-                  "Load of uninitialised variable in function %S",
-                  ir_name(f)
-                );
-              } else {
-                vector_push(a->loads, i);
-              }
-              break;
-            }
-          }
-        } break;
-      }
-    }
-  }
+typedef Vector(sroa_access) sroa_accesses;
 
-  /// Optimise all optimisable variables.
-  foreach (a, vars) {
-    /// If the variable is unoptimisable, do nothing.
-    ///
-    /// Since we don’t have `addressof` instructions or anything like
-    /// that, check if the address is taken anywhere by checking if
-    /// there are any uses of the alloca excepting the store and loads.
-    if (a->unoptimisable || !a->store || ir_use_count(a->alloca) != a->loads.size + 1) {
-      vector_delete(a->loads);
-      continue;
-    }
+/// Collect all loads and stores through an address that is \p offset
+/// bytes into an aggregate of \p size bytes.
+///
+/// \return False if the address escapes or is used in any other way.
+static bool sroa_collect(IRInstruction *addr, usz offset, usz size, sroa_accesses *accesses) {
+  FOREACH_USER (u, addr) {
+    switch (ir_kind(u)) {
+      default: return false;
 
-    /// If we get here, we can yeet the variable.
-    changed = true;
+      case IR_COPY:
+      case IR_BITCAST:
+        if (!sroa_collect(u, offset, size, accesses)) return false;
+        break;
 
-    /// Replace all loads with the stored value.
-    foreach_val (i, a->loads) ir_replace(i, ir_store_value(a->store));
-    vector_delete(a->loads);
+      /// Constant offsets only.
+      case IR_ADD: {
+        IRInstruction *other = ir_lhs(u) == addr ? ir_rhs(u) : ir_lhs(u);
+        if (ir_kind(other) != IR_IMMEDIATE || ir_imm(other) >= size - offset) return false;
+        if (!sroa_collect(u, offset + ir_imm(other), size, accesses)) return false;
+      } break;
 
-    /// Remove the store.
-    ir_remove(a->store);
+      case IR_LOAD:
+        vector_push(*accesses, ((sroa_access){u, offset, ir_typeof(u), false}));
+        break;
 
-    /// Remove the alloca.
-    ir_remove(a->alloca);
+      case IR_STORE:
+        if (ir_store_value(u) == addr) return false;
+        vector_push(*accesses, ((sroa_access){u, offset, ir_typeof(ir_store_value(u)), false}));
+        break;
+    }
   }
 
-  vector_delete(vars);
-  return changed;
+  return true;
 }
 
-/// ===========================================================================
-///  Analyse functions.
-/// ===========================================================================
-/// This function returns whether the pure attribute of the function has changed,
-/// *not* whether it’s pure or not.
-bool opt_check_pure(IRFunction *f) {
-  /// Iterate over all instructions and check if they have nonlocal side effects.
-  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
-    if (!has_side_effects(i)) continue;
-    if (ir_is_branch(i)) continue;
-
-    /// Even if an instruction generally has side effects, the function
-    /// may still be pure, e.g. if the instruction is a call to a pure
-    /// function or a store to a local variable.
-    switch (ir_kind(i)) {
+/// Check that nothing in between two instructions in the same block
+/// may write to memory.
+static bool sroa_nothing_written_between(IRInstruction *from, IRInstruction *to) {
+  if (ir_parent(from) != ir_parent(to)) return false;
+  for (IRInstruction **it = ir_it(from) + 1; it < ir_end(ir_parent(from)); it++) {
+    if (*it == to) return true;
+    STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions that may write to memory");
+    switch (ir_kind(*it)) {
+      default: break;
       case IR_STORE:
-        if (ir_kind(ir_store_addr(i)) == IR_ALLOCA) continue;
-        break;
       case IR_CALL:
-        if (ir_call_is_direct(i) && ir_attribute(ir_callee(i).func, FUNC_ATTR_PURE)) continue;
-        break;
-      default: break;
+      case IR_INTRINSIC:
+        return false;
     }
-
-    /// Function is not pure.
-    if (!ir_attribute(f, FUNC_ATTR_PURE)) return false;
-    ir_attribute(f, FUNC_ATTR_PURE, false);
-    return true;
   }
 
-  /// Function is pure.
-  if (ir_attribute(f, FUNC_ATTR_PURE)) return false;
-  ir_attribute(f, FUNC_ATTR_PURE, true);
-  return true;
+  return false;
 }
 
-/// Check if a function is a leaf function. This function returns whether
-/// the leaf attribute of the function has changed, *not* whether it’s a
-/// leaf or not.
-bool opt_check_leaf(IRFunction *f) {
-  /// A leaf function may not contain any calls except for recursive tail calls
-  /// or tail calls to other leaf functions.
-  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
-    if (ir_kind(i) != IR_CALL) continue;
-    if (ir_call_is_direct(i) && ir_call_tail(i)) {
-      IRFunction *callee = ir_callee(i).func;
-      if (callee == f || ir_attribute(callee, FUNC_ATTR_LEAF)) continue;
-    }
+/// Check if an instruction is one of the accesses of a variable.
+static bool sroa_is_access(sroa_accesses *accesses, IRInstruction *i) {
+  foreach (a, *accesses)
+    if (a->inst == i)
+      return true;
+  return false;
+}
 
-    /// Function is not a leaf.
-    if (!ir_attribute(f, FUNC_ATTR_LEAF)) return false;
-    ir_attribute(f, FUNC_ATTR_LEAF, false);
-    return true;
+/// Get the address \p offset bytes after \p addr as a pointer to \p type.
+///
+/// The address is cast even if the offset is zero, since \p addr points
+/// to the aggregate, and the backend needs to know the size of the
+/// member that is actually accessed.
+static IRInstruction *sroa_offset(CodegenContext *ctx, IRInstruction *before, IRInstruction *addr, usz offset, Type *type) {
+  if (offset) {
+    IRInstruction *imm = ir_insert_before(before, ir_create_immediate(ctx, t_integer, offset));
+    addr = ir_insert_before(before, ir_create_add(ctx, addr, imm));
   }
 
-  /// Function is a leaf.
-  if (ir_attribute(f, FUNC_ATTR_LEAF)) return false;
-  ir_attribute(f, FUNC_ATTR_LEAF, true);
-  return true;
+  Type *ptr = ast_make_type_pointer(ctx->ast, (loc){0}, type);
+  return ir_insert_before(before, ir_create_bitcast(ctx, ptr, addr));
 }
 
-/// Check whether a function does not return. This function returns whether
-/// the noreturn attribute of the function has changed, *not* whether it actually
-/// returns or not.
-///
-/// If a function is marked as noreturn, then that means that it NEVER returns.
-/// A function that only sometimes doesn’t return is *not* noreturn.
-bool opt_check_noreturn(IRFunction *f) {
-  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
-    /// A function that contains a tail call returns, unless the callee does not return.
-    ///
-    /// Checking regular calls doesn’t help, since we’re checking whether a function may
-    /// return, not whether it might not return; tail calls, however, are different, since
-    /// they are basically like return statements. We don’t care whether or not regular calls
-    /// return, but if a tail call returns, then we must also return.
-    IRType kind = ir_kind(i);
-    if (kind == IR_CALL && ir_call_tail(i)) {
-      /// If the call is a direct call, we can check the noreturn attribute of the callee.
-      /// We can’t know whether an indirect call returns, so we must assume that we return.
-      if (!ir_call_is_direct(i) || !ir_attribute(ir_callee(i).func, FUNC_ATTR_NORETURN)) goto may_return;
+/// Split up a single aggregate stack variable.
+static bool sroa_split(CodegenContext *ctx, IRInstruction *alloca) {
+  usz size = ir_alloca_size(alloca);
+  sroa_accesses accesses = {0};
+  Vector(sroa_slot) slots = {0};
+  bool ok = sroa_collect(alloca, 0, size, &accesses);
+  bool has_whole = false;
+
+  /// Accesses of the entire aggregate must be copies from or to
+  /// somewhere else; we copy the parts instead. Everything else
+  /// must access a scalar member.
+  foreach (a, accesses) {
+    if (!ok) break;
+    Type *t = a->type;
+    usz sz = type_sizeof(t);
+    if (type_is_struct(t) || type_is_array(t)) {
+      if (a->offset != 0 || sz != size) ok = false;
+      else if (ir_kind(a->inst) == IR_LOAD) {
+        FOREACH_USER (u, a->inst) {
+          if (
+            ir_kind(u) != IR_STORE ||
+            ir_store_value(u) != a->inst ||
+            ir_store_addr(u) == a->inst ||
+            sroa_is_access(&accesses, u) ||
+            !sroa_nothing_written_between(a->inst, u)
+          ) {
+            ok = false;
+            break;
+          }
+        }
+      } else {
+        IRInstruction *value = ir_store_value(a->inst);
+        ok = ir_kind(value) == IR_LOAD &&
+             !sroa_is_access(&accesses, value) &&
+             sroa_nothing_written_between(value, a->inst);
+      }
+
+      a->whole = true;
+      has_whole = true;
+      continue;
     }
 
-    /// If a return instruction is encountered, then this function obviously returns.
-    else if (kind == IR_RETURN) {
-    may_return:
-      if (!ir_attribute(f, FUNC_ATTR_NORETURN)) return false;
-      ir_attribute(f, FUNC_ATTR_NORETURN, false);
-      return true;
+    if (sz == 0 || sz > 8 || a->offset + sz > size) {
+      ok = false;
+      break;
     }
-  }
 
-  /// Function does not return.
-  if (ir_attribute(f, FUNC_ATTR_NORETURN)) return false;
-  ir_attribute(f, FUNC_ATTR_NORETURN, true);
-  return true;
-}
+    /// Accesses must not partially overlap.
+    sroa_slot *slot = NULL;
+    foreach (sl, slots) {
+      usz sl_size = type_sizeof(sl->type);
+      if (sl->offset == a->offset && sl_size == sz) slot = sl;
+      else if (sl->offset < a->offset + sz && a->offset < sl->offset + sl_size) ok = false;
+    }
 
-/// Check if a function is referenced by this instruction.
-typedef Map(IRFunction*, bool) FuncBoolMap;
-static void check_function_references(IRInstruction *inst, FuncBoolMap *referenced) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instructions that can reference a function");
-  switch (ir_kind(inst)) {
-    default: break;
-    case IR_FUNC_REF: map_set(*referenced, ir_func_ref_func(inst), true); break;
-    case IR_CALL: {
-      /// Only non-recursive direct calls count as references.
-      IRFunction *callee = ir_callee(inst).func;
-      if (ir_call_is_direct(inst) && ir_parent(ir_parent(inst)) != callee)
-        map_set(*referenced, callee, true);
-    } break;
+    if (!slot) vector_push(slots, ((sroa_slot){a->offset, t, NULL}));
   }
-}
 
-/// Analyse functions to determine whether they’re pure, leaf functions, etc.
-bool opt_analyse_functions(CodegenContext *ctx) {
-  bool ever_changed = false, changed;
-  FuncBoolMap referenced_functions = {0};
-  do {
-    map_clear(referenced_functions);
-    changed = false;
+  /// If we copy the entire aggregate, the slots must cover all of it.
+  if (ok && has_whole) {
+    usz covered = 0;
+    foreach (sl, slots) covered += type_sizeof(sl->type);
+    ok = covered == size;
+  }
 
-    /// Check function attributes.
-    foreach_val (f, ctx->functions) {
-      switch (ir_linkage(f)) {
-        case LINKAGE_IMPORTED:
-        case LINKAGE_REEXPORTED:
-          continue;
+  if (!ok || !slots.size) {
+    vector_delete(accesses);
+    vector_delete(slots);
+    return false;
+  }
 
-        case LINKAGE_LOCALVAR:
-        case LINKAGE_INTERNAL:
-          map_set(referenced_functions, f, false);
-          break;
+  /// Create the scalar variables.
+  foreach (sl, slots) sl->alloca = ir_insert_before(alloca, ir_create_alloca(ctx, sl->type));
 
-        case LINKAGE_EXPORTED:
-        case LINKAGE_USED:
-          map_set(referenced_functions, f, true);
-          break;
-      }
+  /// And replace the accesses. The address computations and the
+  /// aggregate itself are left to DCE.
+  foreach (a, accesses) {
+    if (!a->whole) {
+      sroa_slot *slot = NULL;
+      foreach (sl, slots)
+        if (sl->offset == a->offset)
+          slot = sl;
 
-      changed |= opt_check_pure(f);
-      changed |= opt_check_leaf(f);
-      changed |= opt_check_noreturn(f);
+      if (ir_kind(a->inst) == IR_LOAD) ir_replace(a->inst, ir_create_load(ctx, a->type, slot->alloca));
+      else ir_replace(a->inst, ir_create_store(ctx, ir_store_value(a->inst), slot->alloca));
+      continue;
     }
 
-    /// The entry point is always referenced.
-    map_set(referenced_functions, ctx->entry, true);
-
-    /// Check if the functions are ever referenced.
-    FOREACH_INSTRUCTION_IN_CONTEXT (i, b, f, ctx)
-      check_function_references(i, &referenced_functions);
+    /// Copy from this aggregate.
+    if (ir_kind(a->inst) == IR_LOAD) {
+      IRInstructionVector stores = {0};
+      FOREACH_USER (u, a->inst) vector_push(stores, u);
+      foreach_val (store, stores) {
+        foreach (sl, slots) {
+          IRInstruction *value = ir_insert_before(store, ir_create_load(ctx, sl->type, sl->alloca));
+          IRInstruction *dest = sroa_offset(ctx, store, ir_store_addr(store), sl->offset, sl->type);
+          ir_insert_before(store, ir_create_store(ctx, value, dest));
+        }
+        ir_remove(store);
+      }
 
-    /// Also check in global variables.
-    foreach_val (var, ctx->static_vars)
-      if (var->init)
-        check_function_references(var->init, &referenced_functions);
+      vector_delete(stores);
+      ir_remove(a->inst);
+    }
 
-    /// Delete functions that are never referenced.
-    foreach (entry, referenced_functions) {
-      if (!entry->value) {
-        ir_delete_function(entry->key);
-        changed = true;
+    /// Copy into this aggregate.
+    else {
+      IRInstruction *source = ir_operand(ir_store_value(a->inst));
+      foreach (sl, slots) {
+        IRInstruction *addr = sroa_offset(ctx, a->inst, source, sl->offset, sl->type);
+        IRInstruction *value = ir_insert_before(a->inst, ir_create_load(ctx, sl->type, addr));
+        ir_insert_before(a->inst, ir_create_store(ctx, value, sl->alloca));
       }
+      ir_remove(a->inst);
     }
+  }
 
-    if (changed) ever_changed = true;
-  } while (changed);
-
-  map_delete(referenced_functions);
-  return ever_changed;
+  vector_delete(accesses);
+  vector_delete(slots);
+  return true;
 }
 
-/// Remove stores and references to global variables that are
-/// not exported and never loaded from or passed to an instruction
-/// that clobbers memory.
-static bool opt_remove_globals(CodegenContext *ctx) {
-  /// If a variable is only ever used by stores and variable references,
-  /// then we can remove it.
-  foreach_val (var, ctx->static_vars) {
-    var->referenced = false;
-    foreach_val (ref, var->references) {
-      FOREACH_USER(user, ref) {
-        /// If the user is not a store or if the variable is the value
-        /// being stored, and not the address being stored, to, we can’t
-        /// remove it.
-        if (ir_kind(user) != IR_STORE || ir_store_value(user) == ref) {
-          var->referenced = true;
-          goto next;
-        }
-      }
-    }
-
-    next:;
+/// Split aggregate stack variables whose address is never taken and
+/// whose members are only accessed at constant offsets into a separate
+/// variable per member, which mem2reg can then promote to registers.
+static bool opt_sroa(CodegenContext *ctx, IRFunction *f) {
+  IRInstructionVector allocas = {0};
+  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
+    if (ir_kind(i) != IR_ALLOCA) continue;
+    Type *t = ir_typeof(i);
+    if (!type_is_pointer(t) && !type_is_reference(t)) continue;
+    Type *elem = type_get_element(t);
+    if (type_is_struct(elem) || type_is_array(elem)) vector_push(allocas, i);
   }
 
-  /// Remove all stores to such variables.
   bool changed = false;
-  foreach_val (var, ctx->static_vars) {
-    if (var->referenced) continue;
-    foreach_val (ref, var->references) {
-      for (usz i = 0, count = ir_use_count(ref); i < count; i++) {
-        IRInstruction *user = ir_user_get(ref, 0 /** (!) **/);
-        ASSERT(ir_kind(user) == IR_STORE);
-        ir_remove(user);
-        changed = true;
-      }
-    }
-  }
-
+  foreach_val (a, allocas) changed |= sroa_split(ctx, a);
+  vector_delete(allocas);
   return changed;
 }
 
 /// ===========================================================================
-///  Block reordering etc.
+///  Mem2Reg
 /// ===========================================================================
-/// Map containing the predecessors of each block.
-typedef MultiMap(IRBlock*, IRBlock*) Predecessors;
+/// A stack variable that we’re promoting to SSA form.
+typedef struct {
+  IRInstruction *alloca;
 
-/// Collect the predecessors of each block and
-/// remove unreachable blocks.
+  /// Type of the variable’s value; every load and store has this type.
+  Type *type;
+
+  /// Whether the variable is ever loaded from.
+  bool loaded;
+
+  /// Blocks in which the variable is stored to.
+  IRBlockVector def_blocks;
+
+  /// Reaching definitions while renaming.
+  IRInstructionVector stack;
+
+  /// Value of the variable if there is no reaching definition.
+  IRInstruction *undef;
+  bool warned;
+} mem2reg_var;
+
+/// A PHI that we’ve inserted for a variable.
+typedef struct {
+  IRInstruction *phi;
+  usz var;
+} mem2reg_phi;
+
+typedef struct {
+  IRFunction *f;
+  DominatorTree dom;
+  Vector(mem2reg_var) vars;
+  Vector(mem2reg_phi) phis;
+  IRInstructionVector to_remove;
+
+  /// Index + 1 of the variable of each alloca we’re promoting and
+  /// each PHI we’ve inserted, indexed by instruction ID; 0 otherwise.
+  Vector(usz) var_of;
+
+  /// Variables pushed onto their stacks while renaming, in order.
+  Vector(usz) pushed;
+} mem2reg_state;
+
+/// Get the variable of an alloca or inserted PHI, if there is one.
+static mem2reg_var *mem2reg_var_of(mem2reg_state *s, IRInstruction *i) {
+  usz n = s->var_of.data[ir_id(i)];
+  return n ? s->vars.data + n - 1 : NULL;
+}
+
+/// Get the variable whose address this is, if we’re promoting it.
+static mem2reg_var *mem2reg_find_var(mem2reg_state *s, IRInstruction *addr) {
+  return ir_kind(addr) == IR_ALLOCA ? mem2reg_var_of(s, addr) : NULL;
+}
+
+/// Get the variable that a PHI was inserted for.
+static mem2reg_var *mem2reg_phi_var(mem2reg_state *s, IRInstruction *phi) {
+  return ir_kind(phi) == IR_PHI ? mem2reg_var_of(s, phi) : NULL;
+}
+
+/// Push a definition of a variable.
+static void mem2reg_push(mem2reg_state *s, mem2reg_var *v, IRInstruction *value) {
+  vector_push(v->stack, value);
+  vector_push(s->pushed, (usz) (v - s->vars.data));
+}
+
+/// Check if a load or store of this type can be promoted.
+static bool mem2reg_type_ok(IRInstruction *alloca, Type *t) {
+  usz sz = type_sizeof(t);
+  return !type_is_struct(t) && !type_is_array(t) && sz != 0 && sz <= 8 && sz == ir_alloca_size(alloca);
+}
+
+/// Get the current value of a variable.
+static IRInstruction *mem2reg_current_value(mem2reg_state *s, mem2reg_var *v) {
+  if (v->stack.size) return vector_back(v->stack);
+
+  /// Reading an uninitialised variable yields zero. This must
+  /// dominate every use, so put it at the start of the function.
+  if (!v->undef) {
+    IRBlock *entry = *ir_begin(s->f);
+    IRInstruction *first = NULL;
+    FOREACH_INSTRUCTION (i, entry) {
+      if (ir_kind(i) == IR_PARAMETER) continue;
+      first = i;
+      break;
+    }
+
+    ASSERT(first, "Entry block must have a terminator");
+    v->undef = ir_insert_before(first, ir_create_immediate(ir_context(s->f), v->type, 0));
+  }
+
+  return v->undef;
+}
+
+/// Set the incoming values of the PHIs we’ve inserted into the
+/// successors of a block.
+static void mem2reg_fill_phis(mem2reg_state *s, IRBlock *b) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types");
+  IRInstruction *br = ir_terminator(b);
+  IRBlock *succs[2] = {0};
+  if (ir_kind(br) == IR_BRANCH) succs[0] = ir_dest(br);
+  else if (ir_kind(br) == IR_BRANCH_CONDITIONAL) {
+    succs[0] = ir_then(br);
+    succs[1] = ir_else(br);
+  }
+
+  for (usz n = 0; n < 2; n++) {
+    if (!succs[n]) continue;
+    FOREACH_INSTRUCTION (i, succs[n]) {
+      if (ir_kind(i) != IR_PHI) break;
+      mem2reg_var *v = mem2reg_phi_var(s, i);
+      if (v) ir_phi_add_arg(i, b, mem2reg_current_value(s, v));
+    }
+  }
+}
+
+/// Replace the loads and stores in a block with the values they
+/// read and write.
+static void mem2reg_rename_block(mem2reg_state *s, IRBlock *b, bool reachable) {
+  FOREACH_INSTRUCTION (i, b) {
+    switch (ir_kind(i)) {
+      default: break;
+
+      case IR_PHI: {
+        mem2reg_var *v = mem2reg_phi_var(s, i);
+        if (v) mem2reg_push(s, v, i);
+      } break;
+
+      case IR_LOAD: {
+        mem2reg_var *v = mem2reg_find_var(s, ir_operand(i));
+        if (!v) break;
+
+        /// Nothing reaches this load.
+        if (reachable && !v->stack.size && !v->warned) {
+          v->warned = true;
+          CodegenContext *ctx = ir_context(s->f);
+          issue_diagnostic(
+            DIAG_WARN,
+            ctx->ast->filename.data,
+            as_span(ctx->ast->source),
+            ir_location(s->f), /// FIXME: Should be location of the load.
+            "Load of uninitialised variable in function %S",
+            ir_name(s->f)
+          );
+        }
+
+        ir_replace_uses(i, mem2reg_current_value(s, v));
+        vector_push(s->to_remove, i);
+      } break;
+
+      case IR_STORE: {
+        mem2reg_var *v = mem2reg_find_var(s, ir_store_addr(i));
+        if (!v) break;
+        mem2reg_push(s, v, ir_store_value(i));
+        vector_push(s->to_remove, i);
+      } break;
+    }
+  }
+
+  mem2reg_fill_phis(s, b);
+}
+
+/// Rename the variables in a block and, if it is reachable, all blocks
+/// it dominates. Definitions in the block are only visible to those.
+static void mem2reg_rename(mem2reg_state *s, IRBlock *b, bool reachable) {
+  usz mark = s->pushed.size;
+  mem2reg_rename_block(s, b, reachable);
+  if (reachable) foreach_val (c, *dom_children(&s->dom, b)) mem2reg_rename(s, c, true);
+  while (s->pushed.size > mark) s->vars.data[vector_pop(s->pushed)].stack.size--;
+}
+
+/// Promote stack variables whose address is never taken to SSA values.
+///
+/// This is the classic algorithm from (Cytron, R. et al. (1991).
+/// ‘Efficiently Computing Static Single Assignment Form and the Control
+/// Dependence Graph’): a variable needs a PHI at the iterated dominance
+/// frontier of the blocks that store to it; the loads and stores are
+/// then replaced by walking the dominator tree and keeping track of the
+/// definition of each variable that reaches the current block.
+static bool opt_mem2reg(IRFunction *f) {
+  mem2reg_state s = {.f = f};
+
+  /// Number the instructions; slot 0 is for the ones we create below.
+  u32 id = 1;
+  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) ir_id(i, id++);
+  vector_resize(s.var_of, id);
+
+  /// Collect all stack variables that are only ever loaded from and
+  /// stored to, always with the same type. Since we don’t have
+  /// `addressof` instructions or anything like that, any other use of
+  /// an alloca means its address is taken.
+  FOREACH_INSTRUCTION_IN_FUNCTION (a, b, f) {
+    if (ir_kind(a) != IR_ALLOCA) continue;
+    mem2reg_var v = {.alloca = a};
+    bool ok = true;
+    FOREACH_USER (u, a) {
+      Type *t = NULL;
+      if (ir_kind(u) == IR_LOAD) {
+        t = ir_typeof(u);
+        v.loaded = true;
+      } else if (ir_kind(u) == IR_STORE && ir_store_addr(u) == a && ir_store_value(u) != a) {
+        t = ir_typeof(ir_store_value(u));
+        IRBlock *d = ir_parent(u);
+        if (!vector_contains(v.def_blocks, d)) vector_push(v.def_blocks, d);
+      }
+
+      if (!t || !mem2reg_type_ok(a, t) || (v.type && !type_equals(v.type, t))) {
+        ok = false;
+        break;
+      }
+
+      v.type = t;
+    }
+
+    if (ok) {
+      vector_push(s.vars, v);
+      s.var_of.data[ir_id(a)] = s.vars.size;
+    } else {
+      vector_delete(v.def_blocks);
+    }
+  }
+
+  if (!s.vars.size) {
+    vector_delete(s.var_of);
+    return false;
+  }
+
+  s.dom = dom_tree_build(f);
+
+  /// Insert PHIs at the iterated dominance frontier of the blocks that
+  /// define each variable. Variables that are never loaded need none.
+  /// Blocks are marked with the index + 1 of the variable for which
+  /// they have a PHI or have been queued, so we never have to clear
+  /// the marks.
+  IRBlockVector worklist = {0};
+  Vector(usz) has_phi = {0}, seen = {0};
+  vector_resize(has_phi, s.dom.idoms.size);
+  vector_resize(seen, s.dom.idoms.size);
+  foreach_index (n, s.vars) {
+    mem2reg_var *v = s.vars.data + n;
+    if (!v->loaded) continue;
+    foreach_val (d, v->def_blocks) {
+      if (!dom_reachable(&s.dom, d) || seen.data[ir_id(d)] == n + 1) continue;
+      seen.data[ir_id(d)] = n + 1;
+      vector_push(worklist, d);
+    }
+
+    while (worklist.size) {
+      IRBlock *d = vector_pop(worklist);
+      foreach_val (df, *dom_frontier(&s.dom, d)) {
+        if (has_phi.data[ir_id(df)] == n + 1) continue;
+        has_phi.data[ir_id(df)] = n + 1;
+        IRInstruction *phi = ir_create_phi(ir_context(f), v->type);
+        ir_insert_before(*ir_begin(df), phi);
+        ir_id(phi, id++);
+        vector_push(s.var_of, n + 1);
+        vector_push(s.phis, ((mem2reg_phi){phi, n}));
+        if (seen.data[ir_id(df)] != n + 1) {
+          seen.data[ir_id(df)] = n + 1;
+          vector_push(worklist, df);
+        }
+      }
+    }
+  }
+
+  vector_delete(worklist);
+  vector_delete(has_phi);
+  vector_delete(seen);
+
+  /// Rename the variables. Loads in unreachable blocks read whatever
+  /// value is convenient, i.e. zero.
+  mem2reg_rename(&s, *ir_begin(f), true);
+  FOREACH_BLOCK (b, f)
+    if (!dom_reachable(&s.dom, b))
+      mem2reg_rename(&s, b, false);
+
+  foreach_val (i, s.to_remove) ir_remove(i);
+  foreach (v, s.vars) ir_remove(v->alloca);
+
+  /// PHIs that are only used by other PHIs that we’ve inserted are dead;
+  /// propagate liveness from all other uses, then delete the rest.
+  IRInstructionVector live = {0};
+  Vector(bool) is_live = {0};
+  vector_resize(is_live, id);
+  foreach (p, s.phis) {
+    FOREACH_USER (u, p->phi) {
+      if (mem2reg_phi_var(&s, u)) continue;
+      is_live.data[ir_id(p->phi)] = true;
+      vector_push(live, p->phi);
+      break;
+    }
+  }
+
+  for (usz n = 0; n < live.size; n++) {
+    IRInstruction *phi = live.data[n];
+    for (usz j = 0; j < ir_phi_args_count(phi); j++) {
+      IRInstruction *value = ir_phi_arg(phi, j)->value;
+      if (!mem2reg_phi_var(&s, value) || is_live.data[ir_id(value)]) continue;
+      is_live.data[ir_id(value)] = true;
+      vector_push(live, value);
+    }
+  }
+
+  IRBlockVector args = {0};
+  foreach (p, s.phis) {
+    if (is_live.data[ir_id(p->phi)]) continue;
+    vector_clear(args);
+    for (usz j = 0; j < ir_phi_args_count(p->phi); j++) vector_push(args, ir_phi_arg(p->phi, j)->block);
+    foreach_val (from, args) ir_phi_remove_arg(p->phi, from);
+  }
+
+  foreach (p, s.phis)
+    if (!is_live.data[ir_id(p->phi)])
+      ir_remove(p->phi);
+
+  /// A PHI whose arguments are all the same value, or the PHI itself,
+  /// is just that value. Removing one may make others trivial, so
+  /// keep sweeping over the remaining ones until nothing changes.
+  for (bool changed = true; changed;) {
+    changed = false;
+    usz kept = 0;
+    foreach_val (phi, live) {
+      IRInstruction *same = NULL;
+      bool trivial = true;
+      for (usz j = 0; j < ir_phi_args_count(phi); j++) {
+        IRInstruction *value = ir_phi_arg(phi, j)->value;
+        if (value == phi || value == same) continue;
+        if (same) {
+          trivial = false;
+          break;
+        }
+        same = value;
+      }
+
+      if (!trivial || !same) {
+        live.data[kept++] = phi;
+        continue;
+      }
+
+      vector_clear(args);
+      for (usz j = 0; j < ir_phi_args_count(phi); j++)
+        if (ir_phi_arg(phi, j)->value == phi)
+          vector_push(args, ir_phi_arg(phi, j)->block);
+      foreach_val (from, args) ir_phi_remove_arg(phi, from);
+      ir_replace_uses(phi, same);
+      ir_remove(phi);
+      changed = true;
+    }
+    live.size = kept;
+  }
+
+  vector_delete(args);
+  vector_delete(live);
+  vector_delete(is_live);
+  foreach (v, s.vars) {
+    vector_delete(v->def_blocks);
+    vector_delete(v->stack);
+  }
+
+  vector_delete(s.vars);
+  vector_delete(s.phis);
+  vector_delete(s.to_remove);
+  vector_delete(s.var_of);
+  vector_delete(s.pushed);
+  dom_tree_free(&s.dom);
+  return true;
+}
+
+/// ===========================================================================
+///  Global value numbering
+/// ===========================================================================
+/// Marks a slot whose entry went out of scope.
+#define GVN_TOMBSTONE ((IRInstruction *) 1)
+
+/// Open-addressing hash table that maps each expression to the first
+/// instruction that computes it, i.e. to its value number.
+typedef struct {
+  IRInstruction **slots;
+  usz capacity; /// Always a power of two.
+  usz used; /// Including tombstones.
+} gvn_table;
+
+typedef struct {
+  IRFunction *f;
+  DominatorTree dom;
+  gvn_table table;
+  IRInstructionVector to_remove;
+} gvn_state;
+
+/// Check if an instruction always computes the same value from the
+/// same operands, without side effects.
+static bool gvn_is_candidate(IRInstruction *i) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
+  switch (ir_kind(i)) {
+    case IR_IMMEDIATE:
+    case IR_STATIC_REF:
+    case IR_FUNC_REF:
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE:
+    case IR_SELECT:
+      ALL_BINARY_INSTRUCTION_CASES()
+      return true;
+
+    /// The address of a stack variable is as cheap to recompute as it
+    /// is to copy, and keeping it around across a call would tie up a
+    /// callee-saved register.
+    case IR_BITCAST:
+    case IR_COPY:
+      return ir_kind(ir_operand(i)) != IR_ALLOCA;
+
+    case IR_CALL:
+      return ir_call_is_direct(i) &&
+             !ir_call_tail(i) &&
+             ir_attribute(ir_callee(i).func, FUNC_ATTR_CONST);
+
+    default: return false;
+  }
+}
+
+static bool gvn_is_commutative(IRType kind) {
+  switch (kind) {
+    case IR_ADD:
+    case IR_MUL:
+    case IR_AND:
+    case IR_OR:
+    case IR_EQ:
+    case IR_NE:
+      return true;
+    default: return false;
+  }
+}
+
+static u64 gvn_mix(u64 h, u64 value) {
+  return (h ^ value) * 0x9E3779B97F4A7C15ull;
+}
+
+/// Hash an expression. Types are not hashed, only compared.
+static u64 gvn_hash(IRInstruction *i) {
+  u64 h = gvn_mix(0, (u64) ir_kind(i));
+  switch (ir_kind(i)) {
+    default: UNREACHABLE();
+    case IR_IMMEDIATE: return gvn_mix(h, ir_imm(i));
+    case IR_STATIC_REF: return gvn_mix(h, (u64) (uintptr_t) ir_static_ref_var(i));
+    case IR_FUNC_REF: return gvn_mix(h, (u64) (uintptr_t) ir_func_ref_func(i));
+
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE:
+    case IR_BITCAST:
+    case IR_COPY:
+      return gvn_mix(h, (u64) (uintptr_t) ir_operand(i));
+
+    case IR_SELECT:
+      h = gvn_mix(h, (u64) (uintptr_t) ir_select_cond(i));
+      h = gvn_mix(h, (u64) (uintptr_t) ir_select_then(i));
+      return gvn_mix(h, (u64) (uintptr_t) ir_select_else(i));
+
+    case IR_CALL:
+      h = gvn_mix(h, (u64) (uintptr_t) ir_callee(i).func);
+      for (usz n = 0; n < ir_call_args_count(i); n++)
+        h = gvn_mix(h, (u64) (uintptr_t) ir_call_arg(i, n));
+      return h;
+
+    ALL_BINARY_INSTRUCTION_CASES() {
+      u64 l = (u64) (uintptr_t) ir_lhs(i), r = (u64) (uintptr_t) ir_rhs(i);
+      if (gvn_is_commutative(ir_kind(i))) return gvn_mix(gvn_mix(h, l + r), l ^ r);
+      return gvn_mix(gvn_mix(h, l), r);
+    }
+  }
+}
+
+/// Check if two instructions compute the same value.
+static bool gvn_equal(IRInstruction *a, IRInstruction *b) {
+  if (ir_kind(a) != ir_kind(b) || !type_equals(ir_typeof(a), ir_typeof(b))) return false;
+  switch (ir_kind(a)) {
+    default: UNREACHABLE();
+    case IR_IMMEDIATE: return ir_imm(a) == ir_imm(b);
+    case IR_STATIC_REF: return ir_static_ref_var(a) == ir_static_ref_var(b);
+    case IR_FUNC_REF: return ir_func_ref_func(a) == ir_func_ref_func(b);
+
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE:
+    case IR_BITCAST:
+    case IR_COPY:
+      return ir_operand(a) == ir_operand(b);
+
+    case IR_SELECT:
+      return ir_select_cond(a) == ir_select_cond(b) &&
+             ir_select_then(a) == ir_select_then(b) &&
+             ir_select_else(a) == ir_select_else(b);
+
+    case IR_CALL:
+      if (ir_callee(a).func != ir_callee(b).func) return false;
+      if (ir_call_args_count(a) != ir_call_args_count(b)) return false;
+      for (usz n = 0; n < ir_call_args_count(a); n++)
+        if (ir_call_arg(a, n) != ir_call_arg(b, n))
+          return false;
+      return true;
+
+    ALL_BINARY_INSTRUCTION_CASES()
+      if (ir_lhs(a) == ir_lhs(b) && ir_rhs(a) == ir_rhs(b)) return true;
+      return gvn_is_commutative(ir_kind(a)) && ir_lhs(a) == ir_rhs(b) && ir_rhs(a) == ir_lhs(b);
+  }
+}
+
+/// Find the slot that contains an instruction computing the same value
+/// as \p i, or the empty slot where it should be inserted.
+static IRInstruction **gvn_find(gvn_table *t, IRInstruction *i) {
+  usz slot = (usz) (gvn_hash(i) >> 32) & (t->capacity - 1);
+  while (t->slots[slot] && (t->slots[slot] == GVN_TOMBSTONE || !gvn_equal(t->slots[slot], i)))
+    slot = (slot + 1) & (t->capacity - 1);
+  return t->slots + slot;
+}
+
+/// Rehash the table, dropping tombstones and growing it if need be.
+static void gvn_rehash(gvn_table *t) {
+  IRInstruction **old = t->slots;
+  usz old_capacity = t->capacity;
+  usz live = 0;
+  for (usz n = 0; n < old_capacity; n++)
+    if (old[n] && old[n] != GVN_TOMBSTONE)
+      live++;
+
+  t->capacity = old_capacity;
+  while (live * 4 >= t->capacity) t->capacity *= 2;
+  t->slots = calloc(t->capacity, sizeof *t->slots);
+  t->used = live;
+  for (usz n = 0; n < old_capacity; n++)
+    if (old[n] && old[n] != GVN_TOMBSTONE)
+      *gvn_find(t, old[n]) = old[n];
+  free(old);
+}
+
+/// Number the values in a block and all blocks it dominates. Values
+/// are only visible in the blocks dominated by their definition.
+static bool gvn_block(gvn_state *s, IRBlock *b) {
+  bool changed = false;
+  IRInstructionVector scope = {0};
+  FOREACH_INSTRUCTION (i, b) {
+    if (!gvn_is_candidate(i)) continue;
+
+    IRInstruction **slot = gvn_find(&s->table, i);
+    if (*slot) {
+      ir_replace_uses(i, *slot);
+      vector_push(s->to_remove, i);
+      changed = true;
+      continue;
+    }
+
+    *slot = i;
+    vector_push(scope, i);
+    if (++s->table.used * 2 >= s->table.capacity) gvn_rehash(&s->table);
+  }
+
+  foreach_val (c, *dom_children(&s->dom, b)) changed |= gvn_block(s, c);
+
+  /// Leave the scope.
+  foreach_val (i, scope) *gvn_find(&s->table, i) = GVN_TOMBSTONE;
+  vector_delete(scope);
+  return changed;
+}
+
+/// Replace computations of values that have already been computed
+/// in a dominating instruction with that instruction.
+static bool opt_gvn(IRFunction *f) {
+  gvn_state s = {.f = f, .dom = dom_tree_build(f)};
+  s.table.capacity = 64;
+  s.table.slots = calloc(s.table.capacity, sizeof *s.table.slots);
+
+  bool changed = gvn_block(&s, *ir_begin(f));
+  foreach_val (i, s.to_remove) ir_remove(i);
+
+  vector_delete(s.to_remove);
+  free(s.table.slots);
+  dom_tree_free(&s.dom);
+  return changed;
+}
+
+/// ===========================================================================
+///  Sparse conditional constant propagation
+/// ===========================================================================
+/// Lattice value of an instruction. Values only ever move down
+/// the lattice, from undefined to constant to overdefined.
+typedef enum {
+  SCCP_UNDEF,
+  SCCP_CONST,
+  SCCP_OVERDEFINED,
+} sccp_kind;
+
+typedef struct {
+  sccp_kind kind;
+  u64 value;
+} sccp_value;
+
+/// Bits in `sccp_state::edges` that mark the edge to the destination
+/// (or the then block) and to the else block of a block as executable.
+#define SCCP_EDGE_THEN (1 << 0)
+#define SCCP_EDGE_ELSE (1 << 1)
+
+typedef struct {
+  IRFunction *f;
+
+  /// Indexed by instruction id.
+  Vector(sccp_value) values;
+
+  /// Indexed by block id.
+  Vector(bool) executable;
+  Vector(u8) edges;
+
+  /// Blocks that have just become executable.
+  IRBlockVector block_worklist;
+
+  /// Instructions whose lattice value has changed.
+  IRInstructionVector inst_worklist;
+} sccp_state;
+
+/// Whether we can represent the value of an instruction of this type.
+static bool sccp_type_ok(Type *t) {
+  if (!type_is_integer(t) || type_is_reference(t)) return false;
+  usz size = type_sizeof(t);
+  return size > 0 && size <= 8;
+}
+
+static sccp_value sccp_get(sccp_state *s, IRInstruction *i) {
+  return s->values.data[ir_id(i)];
+}
+
+/// Whether the edge from `from` to `to` is executable.
+static bool sccp_edge_executable(sccp_state *s, IRBlock *from, IRBlock *to) {
+  IRInstruction *br = ir_terminator(from);
+  u8 edges = s->edges.data[ir_id(from)];
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types");
+  switch (ir_kind(br)) {
+    default: return false;
+    case IR_BRANCH: return edges & SCCP_EDGE_THEN;
+    case IR_BRANCH_CONDITIONAL:
+      return ((edges & SCCP_EDGE_THEN) && ir_then(br) == to) ||
+             ((edges & SCCP_EDGE_ELSE) && ir_else(br) == to);
+  }
+}
+
+static void sccp_visit(sccp_state *s, IRInstruction *i);
+
+/// Mark an edge as executable. The PHIs in its destination
+/// have to be reevaluated if they’ve already been visited.
+static void sccp_mark_edge(sccp_state *s, IRBlock *from, u8 edge, IRBlock *to) {
+  u8 *edges = s->edges.data + ir_id(from);
+  if (*edges & edge) return;
+  *edges |= edge;
+
+  if (!s->executable.data[ir_id(to)]) {
+    s->executable.data[ir_id(to)] = true;
+    vector_push(s->block_worklist, to);
+    return;
+  }
+
+  FOREACH_INSTRUCTION (i, to) {
+    if (ir_kind(i) != IR_PHI) break;
+    sccp_visit(s, i);
+  }
+}
+
+/// Fold a binary operation on two constants. Operands are truncated
+/// to their size and, where that matters, sign-extended, the same way
+/// the backend would treat them.
+static sccp_value sccp_fold_binary(IRInstruction *i, u64 lhs, u64 rhs) {
+  static const sccp_value overdefined = {SCCP_OVERDEFINED, 0};
+  usz size = type_sizeof(ir_typeof(ir_lhs(i)));
+  i64 slhs = sign_extend_from_size(lhs, size);
+  i64 srhs = sign_extend_from_size(rhs, size);
+  lhs = truncate_to_size(lhs, size);
+  rhs = truncate_to_size(rhs, size);
+
+  u64 value;
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all binary instructions");
+  switch (ir_kind(i)) {
+    default: UNREACHABLE();
+    case IR_ADD: value = lhs + rhs; break;
+    case IR_SUB: value = lhs - rhs; break;
+    case IR_MUL: value = lhs * rhs; break;
+    case IR_AND: value = lhs & rhs; break;
+    case IR_OR: value = lhs | rhs; break;
+
+    /// Leave division by zero and overflow to happen at runtime.
+    case IR_DIV:
+    case IR_MOD: {
+      if (rhs == 0) return overdefined;
+      if (type_is_signed(ir_typeof(i))) {
+        if (srhs == -1 && slhs == sign_extend_from_size(1ull << (size * 8 - 1), size)) return overdefined;
+        value = (u64) (ir_kind(i) == IR_DIV ? slhs / srhs : slhs % srhs);
+      } else {
+        value = ir_kind(i) == IR_DIV ? lhs / rhs : lhs % rhs;
+      }
+    } break;
+
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR: {
+      if (rhs >= size * 8) return overdefined;
+      if (ir_kind(i) == IR_SHL) value = lhs << rhs;
+      else if (ir_kind(i) == IR_SHR) value = lhs >> rhs;
+      else value = (u64) (slhs >> rhs);
+    } break;
+
+    /// Comparisons are always signed.
+    case IR_LT: value = slhs < srhs; break;
+    case IR_LE: value = slhs <= srhs; break;
+    case IR_GT: value = slhs > srhs; break;
+    case IR_GE: value = slhs >= srhs; break;
+    case IR_EQ: value = lhs == rhs; break;
+    case IR_NE: value = lhs != rhs; break;
+  }
+
+  return (sccp_value){SCCP_CONST, truncate_to_size(value, type_sizeof(ir_typeof(i)))};
+}
+
+/// Compute the lattice value of an instruction from its operands.
+static sccp_value sccp_evaluate(sccp_state *s, IRInstruction *i) {
+  static const sccp_value undef = {SCCP_UNDEF, 0};
+  static const sccp_value overdefined = {SCCP_OVERDEFINED, 0};
+  if (!sccp_type_ok(ir_typeof(i))) return overdefined;
+  usz size = type_sizeof(ir_typeof(i));
+
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
+  switch (ir_kind(i)) {
+    default: return overdefined;
+    case IR_IMMEDIATE: return (sccp_value){SCCP_CONST, truncate_to_size(ir_imm(i), size)};
+
+    case IR_COPY: {
+      if (!sccp_type_ok(ir_typeof(ir_operand(i)))) return overdefined;
+      sccp_value op = sccp_get(s, ir_operand(i));
+      if (op.kind == SCCP_CONST) op.value = truncate_to_size(op.value, size);
+      return op;
+    }
+
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE: {
+      IRInstruction *operand = ir_operand(i);
+      if (!sccp_type_ok(ir_typeof(operand))) return overdefined;
+      sccp_value op = sccp_get(s, operand);
+      if (op.kind != SCCP_CONST) return op;
+      usz op_size = type_sizeof(ir_typeof(operand));
+      u64 value = truncate_to_size(op.value, op_size);
+      if (ir_kind(i) == IR_NOT) value = ~value;
+      else if (ir_kind(i) == IR_SIGN_EXTEND) value = (u64) sign_extend_from_size(value, op_size);
+      return (sccp_value){SCCP_CONST, truncate_to_size(value, size)};
+    }
+
+    case IR_SELECT: {
+      sccp_value cond = sccp_get(s, ir_select_cond(i));
+      if (cond.kind == SCCP_UNDEF) return undef;
+      sccp_value then = sccp_get(s, ir_select_then(i));
+      sccp_value else_ = sccp_get(s, ir_select_else(i));
+      if (cond.kind == SCCP_CONST) return cond.value ? then : else_;
+      if (then.kind == SCCP_UNDEF) return else_;
+      if (else_.kind == SCCP_UNDEF) return then;
+      if (then.kind == SCCP_CONST && else_.kind == SCCP_CONST && then.value == else_.value) return then;
+      return overdefined;
+    }
+
+    /// Merge the values coming in along executable edges.
+    case IR_PHI: {
+      sccp_value result = undef;
+      for (usz n = 0; n < ir_phi_args_count(i); n++) {
+        const IRPhiArgument *arg = ir_phi_arg(i, n);
+        if (!sccp_edge_executable(s, arg->block, ir_parent(i))) continue;
+        sccp_value v = sccp_get(s, arg->value);
+        if (v.kind == SCCP_UNDEF) continue;
+        if (v.kind == SCCP_OVERDEFINED) return overdefined;
+        if (result.kind == SCCP_CONST && result.value != v.value) return overdefined;
+        result = v;
+      }
+      return result;
+    }
+
+    ALL_BINARY_INSTRUCTION_CASES() {
+      if (!sccp_type_ok(ir_typeof(ir_lhs(i))) || !sccp_type_ok(ir_typeof(ir_rhs(i)))) return overdefined;
+      sccp_value lhs = sccp_get(s, ir_lhs(i));
+      sccp_value rhs = sccp_get(s, ir_rhs(i));
+      if (lhs.kind == SCCP_OVERDEFINED || rhs.kind == SCCP_OVERDEFINED) return overdefined;
+      if (lhs.kind == SCCP_UNDEF || rhs.kind == SCCP_UNDEF) return undef;
+      return sccp_fold_binary(i, lhs.value, rhs.value);
+    }
+  }
+}
+
+/// Reevaluate an instruction in an executable block.
+static void sccp_visit(sccp_state *s, IRInstruction *i) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types");
+  switch (ir_kind(i)) {
+    default: break;
+    case IR_BRANCH:
+      sccp_mark_edge(s, ir_parent(i), SCCP_EDGE_THEN, ir_dest(i));
+      return;
+
+    case IR_BRANCH_CONDITIONAL: {
+      sccp_value cond = sccp_get(s, ir_cond(i));
+      if (cond.kind == SCCP_UNDEF) return;
+      if (cond.kind == SCCP_OVERDEFINED || cond.value)
+        sccp_mark_edge(s, ir_parent(i), SCCP_EDGE_THEN, ir_then(i));
+      if (cond.kind == SCCP_OVERDEFINED || !cond.value)
+        sccp_mark_edge(s, ir_parent(i), SCCP_EDGE_ELSE, ir_else(i));
+      return;
+    }
+  }
+
+  sccp_value *old = s->values.data + ir_id(i);
+  sccp_value new = sccp_evaluate(s, i);
+  if (new.kind == SCCP_CONST && old->kind == SCCP_CONST && new.value != old->value)
+    new.kind = SCCP_OVERDEFINED;
+  if (new.kind <= old->kind) return;
+  *old = new;
+  vector_push(s->inst_worklist, i);
+}
+
+/// Propagate constants through the function, only ever considering
+/// blocks that we can prove are reachable, then replace instructions
+/// with constant values by immediates and fold branches that always
+/// go the same way.
+static bool opt_sccp(CodegenContext *ctx, IRFunction *f) {
+  sccp_state s = {.f = f};
+
+  /// Number the blocks and instructions; slot 0 of every vector is unused.
+  u32 block_id = 1, inst_id = 1;
+  FOREACH_BLOCK (b, f) {
+    ir_id(b, block_id++);
+    FOREACH_INSTRUCTION (i, b) ir_id(i, inst_id++);
+  }
+
+  vector_resize(s.values, inst_id);
+  vector_resize(s.executable, block_id);
+  vector_resize(s.edges, block_id);
+
+  IRBlock *entry = *ir_begin(f);
+  s.executable.data[ir_id(entry)] = true;
+  vector_push(s.block_worklist, entry);
+
+  /// Visit each block once it becomes executable, and each user
+  /// of an instruction in an executable block whenever the value
+  /// of that instruction changes.
+  while (s.block_worklist.size || s.inst_worklist.size) {
+    if (s.block_worklist.size) {
+      IRBlock *b = vector_pop(s.block_worklist);
+      FOREACH_INSTRUCTION (i, b) sccp_visit(&s, i);
+      continue;
+    }
+
+    IRInstruction *i = vector_pop(s.inst_worklist);
+    FOREACH_USER (user, i)
+      if (s.executable.data[ir_id(ir_parent(user))])
+        sccp_visit(&s, user);
+  }
+
+  /// Collect everything that we can simplify.
+  IRInstructionVector constants = {0};
+  IRInstructionVector branches = {0};
+  IRBlockVector unreachable = {0};
+  FOREACH_BLOCK (b, f) {
+    if (!s.executable.data[ir_id(b)]) {
+      if (ir_kind(ir_terminator(b)) != IR_UNREACHABLE) vector_push(unreachable, b);
+      continue;
+    }
+
+    FOREACH_INSTRUCTION (i, b) {
+      if (ir_kind(i) == IR_BRANCH_CONDITIONAL) {
+        u8 edges = s.edges.data[ir_id(b)];
+        if (edges == SCCP_EDGE_THEN || edges == SCCP_EDGE_ELSE) vector_push(branches, i);
+        continue;
+      }
+
+      if (ir_kind(i) == IR_IMMEDIATE || ir_use_count(i) == 0) continue;
+      if (sccp_get(&s, i).kind == SCCP_CONST) vector_push(constants, i);
+    }
+  }
+
+  /// Replace constants with immediates. PHIs have to stay at the
+  /// start of their block, so insert the immediate after them.
+  foreach_val (i, constants) {
+    IRInstruction *imm = ir_create_immediate(ctx, ir_typeof(i), sccp_get(&s, i).value);
+    if (ir_kind(i) != IR_PHI) {
+      ir_replace(i, imm);
+      continue;
+    }
+
+    IRInstruction *first = NULL;
+    FOREACH_INSTRUCTION (inst, ir_parent(i)) {
+      if (ir_kind(inst) == IR_PHI) continue;
+      first = inst;
+      break;
+    }
+
+    ir_insert_before(first, imm);
+    while (ir_phi_args_count(i)) ir_phi_remove_arg(i, ir_phi_arg(i, 0)->block);
+    ir_replace_uses(i, imm);
+    ir_remove(i);
+  }
+
+  /// Fold branches that only ever go one way.
+  foreach_val (br, branches) {
+    IRBlock *b = ir_parent(br);
+    bool then = s.edges.data[ir_id(b)] == SCCP_EDGE_THEN;
+    IRBlock *taken = then ? ir_then(br) : ir_else(br);
+    IRBlock *not_taken = then ? ir_else(br) : ir_then(br);
+    if (taken != not_taken) {
+      FOREACH_INSTRUCTION (phi, not_taken) {
+        if (ir_kind(phi) != IR_PHI) break;
+        ir_phi_remove_arg(phi, b);
+      }
+    }
+
+    ir_replace(br, ir_create_br(ctx, taken));
+  }
+
+  /// Blocks that are never executed are unreachable.
+  foreach_val (b, unreachable) ir_make_unreachable(b);
+
+  bool changed = constants.size || branches.size || unreachable.size;
+  vector_delete(constants);
+  vector_delete(branches);
+  vector_delete(unreachable);
+  vector_delete(s.values);
+  vector_delete(s.executable);
+  vector_delete(s.edges);
+  vector_delete(s.block_worklist);
+  vector_delete(s.inst_worklist);
+  return changed;
+}
+
+/// ===========================================================================
+///  Loop-invariant code motion
+/// ===========================================================================
+typedef struct {
+  LoopInfo *info;
+  Loop *loop;
+
+  /// Indexed by instruction id.
+  Vector(bool) invariant;
+
+  /// Invariant instructions, in an order in which they can be hoisted.
+  IRInstructionVector hoist;
+} licm_state;
+
+/// Get the operands of an instruction that we may hoist.
+///
+/// \return The number of operands written to \p ops.
+static usz licm_operands(IRInstruction *i, IRInstruction *ops[3]) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
+  switch (ir_kind(i)) {
+    default: return 0;
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE:
+    case IR_BITCAST:
+    case IR_COPY:
+    case IR_LOAD:
+      ops[0] = ir_operand(i);
+      return 1;
+
+    case IR_SELECT:
+      ops[0] = ir_select_cond(i);
+      ops[1] = ir_select_then(i);
+      ops[2] = ir_select_else(i);
+      return 3;
+
+    ALL_BINARY_INSTRUCTION_CASES()
+      ops[0] = ir_lhs(i);
+      ops[1] = ir_rhs(i);
+      return 2;
+  }
+}
+
+/// Check if an instruction only materialises a constant or frame
+/// address. These are cheaper to recompute in the loop than to keep
+/// in a register across it, so we only hoist them along with users.
+static bool licm_is_rematerialisable(IRInstruction *i) {
+  switch (ir_kind(i)) {
+    default: return false;
+    case IR_IMMEDIATE:
+    case IR_STATIC_REF:
+    case IR_FUNC_REF:
+      return true;
+    case IR_BITCAST:
+    case IR_COPY:
+      return ir_kind(ir_operand(i)) == IR_ALLOCA;
+  }
+}
+
+/// Check if the address of a frame object is only used to load from
+/// and store to it, and collect the stores.
+static bool licm_collect_stores(IRInstruction *addr, IRInstructionVector *stores) {
+  FOREACH_USER (user, addr) {
+    switch (ir_kind(user)) {
+      default: return false;
+      case IR_LOAD: break;
+      case IR_STORE:
+        if (ir_store_value(user) == addr) return false;
+        vector_push(*stores, user);
+        break;
+
+      case IR_COPY:
+      case IR_BITCAST:
+      case IR_ADD:
+        if (!licm_collect_stores(user, stores)) return false;
+        break;
+    }
+  }
+
+  return true;
+}
+
+/// Check if a load reads a frame object that nothing in the loop can
+/// write to. The address must be the object plus a constant offset
+/// so that we know that hoisting the load can’t make it go out of
+/// bounds.
+static bool licm_is_invariant_load(licm_state *s, IRInstruction *load) {
+  IRInstruction *addr = ir_operand(load);
+  usz offset = 0;
+  for (;;) {
+    IRType kind = ir_kind(addr);
+    if (kind == IR_ALLOCA) break;
+    if (kind == IR_COPY || kind == IR_BITCAST) {
+      addr = ir_operand(addr);
+    } else if (kind == IR_ADD && ir_kind(ir_rhs(addr)) == IR_IMMEDIATE) {
+      offset += ir_imm(ir_rhs(addr));
+      addr = ir_lhs(addr);
+    } else {
+      return false;
+    }
+  }
+
+  if (offset + type_sizeof(ir_typeof(load)) > ir_alloca_size(addr)) return false;
+
+  IRInstructionVector stores = {0};
+  bool invariant = licm_collect_stores(addr, &stores);
+  foreach_val (store, stores) {
+    if (loop_contains(s->info, s->loop, ir_parent(store))) {
+      invariant = false;
+      break;
+    }
+  }
+
+  vector_delete(stores);
+  return invariant;
+}
+
+/// Check if an instruction computes the same value on every iteration
+/// and can be executed speculatively, i.e. doesn’t trap and has no
+/// side effects.
+static bool licm_is_invariant(licm_state *s, IRInstruction *i) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions");
+  switch (ir_kind(i)) {
+    default: return false;
+    case IR_IMMEDIATE:
+    case IR_STATIC_REF:
+    case IR_FUNC_REF:
+    case IR_NOT:
+    case IR_ZERO_EXTEND:
+    case IR_SIGN_EXTEND:
+    case IR_TRUNCATE:
+    case IR_BITCAST:
+    case IR_COPY:
+    case IR_SELECT:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_SHL:
+    case IR_SHR:
+    case IR_SAR:
+    case IR_AND:
+    case IR_OR:
+    ALL_BINARY_COMPARISON_TYPES(BINARY_INSTRUCTION_CASE_HELPER)
+      break;
+
+    /// Only divide by constants that can’t trap.
+    case IR_DIV:
+    case IR_MOD: {
+      IRInstruction *rhs = ir_rhs(i);
+      if (ir_kind(rhs) != IR_IMMEDIATE) return false;
+      usz size = type_sizeof(ir_typeof(rhs));
+      u64 mask = size < 8 ? (1ull << (size * 8)) - 1 : ~0ull;
+      u64 value = ir_imm(rhs) & mask;
+      if (value == 0 || (type_is_signed(ir_typeof(i)) && value == mask)) return false;
+    } break;
+
+    case IR_LOAD:
+      if (!licm_is_invariant_load(s, i)) return false;
+      break;
+  }
+
+  IRInstruction *ops[3];
+  usz count = licm_operands(i, ops);
+  for (usz n = 0; n < count; n++)
+    if (loop_contains(s->info, s->loop, ir_parent(ops[n])) && !s->invariant.data[ir_id(ops[n])])
+      return false;
+  return true;
+}
+
+/// Collect the instructions that we can hoist out of a loop.
+static void licm_collect(licm_state *s) {
+  /// The blocks of a loop aren’t in any particular order, so keep
+  /// going until we don’t find any more invariant instructions.
+  for (bool changed = true; changed;) {
+    changed = false;
+    foreach_val (b, s->loop->blocks) {
+      FOREACH_INSTRUCTION (i, b) {
+        if (s->invariant.data[ir_id(i)] || !licm_is_invariant(s, i)) continue;
+        s->invariant.data[ir_id(i)] = true;
+        vector_push(s->hoist, i);
+        changed = true;
+      }
+    }
+  }
+
+  /// Users come after their operands, so walk the list backwards
+  /// to only keep constants that are needed by something we hoist.
+  foreach_index_rev (n, s->hoist) {
+    IRInstruction *i = s->hoist.data[n];
+    bool keep = false;
+    if (licm_is_rematerialisable(i)) {
+      FOREACH_USER (user, i) {
+        if (s->invariant.data[ir_id(user)] && ir_parent(user) && loop_contains(s->info, s->loop, ir_parent(user))) {
+          keep = true;
+          break;
+        }
+      }
+    } else {
+      keep = ir_use_count(i) != 0;
+    }
+
+    if (!keep) {
+      s->invariant.data[ir_id(i)] = false;
+      vector_remove_index(s->hoist, n);
+    }
+  }
+}
+
+/// Create a block that all edges entering a loop from outside go
+/// through, and that branches to the loop header.
+static IRBlock *licm_insert_preheader(CodegenContext *ctx, IRFunction *f, licm_state *s) {
+  IRBlock *header = s->loop->header;
+  IRBlockVector entering = {0};
+  FOREACH_BLOCK (b, f) {
+    if (loop_contains(s->info, s->loop, b)) continue;
+    IRInstruction *br = ir_terminator(b);
+    if (
+      (ir_kind(br) == IR_BRANCH && ir_dest(br) == header) ||
+      (ir_kind(br) == IR_BRANCH_CONDITIONAL && (ir_then(br) == header || ir_else(br) == header))
+    ) vector_push(entering, b);
+  }
+
+  IRBlock *preheader = ir_block_attach_before(header, ir_block(ctx));
+
+  /// Move the PHI arguments for the entering edges into the preheader.
+  FOREACH_INSTRUCTION (phi, header) {
+    if (ir_kind(phi) != IR_PHI) break;
+    IRInstruction *value = NULL;
+    bool same = true;
+    for (usz n = 0; n < ir_phi_args_count(phi); n++) {
+      const IRPhiArgument *arg = ir_phi_arg(phi, n);
+      if (!vector_contains(entering, arg->block)) continue;
+      if (value && value != arg->value) same = false;
+      value = arg->value;
+    }
+
+    if (!same) {
+      IRInstruction *merged = ir_insert_at_end(preheader, ir_create_phi(ctx, ir_typeof(phi)));
+      for (usz n = 0; n < ir_phi_args_count(phi); n++) {
+        const IRPhiArgument *arg = ir_phi_arg(phi, n);
+        if (vector_contains(entering, arg->block)) ir_phi_add_arg(merged, arg->block, arg->value);
+      }
+      value = merged;
+    }
+
+    foreach_val (b, entering) ir_phi_remove_arg(phi, b);
+    if (value) ir_phi_add_arg(phi, preheader, value);
+  }
+
+  /// Redirect the entering edges.
+  foreach_val (b, entering) {
+    IRInstruction *br = ir_terminator(b);
+    if (ir_kind(br) == IR_BRANCH) {
+      ir_dest(br, preheader);
+    } else {
+      if (ir_then(br) == header) ir_then(br, preheader);
+      if (ir_else(br) == header) ir_else(br, preheader);
+    }
+  }
+
+  ir_insert_at_end(preheader, ir_create_br(ctx, header));
+  vector_delete(entering);
+  return preheader;
+}
+
+/// Hoist computations that don’t change between iterations out of
+/// loops and into their preheaders, creating those if need be. Loops
+/// are processed innermost first so that what we hoist out of an
+/// inner loop can then be hoisted out of the loops around it.
+static bool opt_licm(CodegenContext *ctx, IRFunction *f) {
+  bool changed = false;
+  for (;;) {
+    licm_state s = {.info = loop_info_get(f)};
+
+    u32 id = 1;
+    FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) ir_id(i, id++);
+    vector_resize(s.invariant, id);
+
+    foreach_ptr_rev (loop, s.info->loops) {
+      if (loop->header == *ir_begin(f)) continue;
+      s.loop = loop;
+      licm_collect(&s);
+      if (s.hoist.size) break;
+    }
+
+    if (!s.hoist.size) {
+      vector_delete(s.invariant);
+      break;
+    }
+
+    IRBlock *preheader = s.loop->preheader ? s.loop->preheader : licm_insert_preheader(ctx, f, &s);
+    IRInstruction *br = ir_terminator(preheader);
+    foreach_val (i, s.hoist) ir_move_before(br, i);
+    changed = true;
+
+    vector_delete(s.invariant);
+    vector_delete(s.hoist);
+  }
+
+  return changed;
+}
+
+/// ===========================================================================
+///  Analyse functions.
+/// ===========================================================================
+/// This function returns whether the pure attribute of the function has changed,
+/// *not* whether it’s pure or not.
+bool opt_check_pure(IRFunction *f) {
+  /// Iterate over all instructions and check if they have nonlocal side effects.
+  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
+    if (!has_side_effects(i)) continue;
+    if (ir_is_branch(i)) continue;
+
+    /// Even if an instruction generally has side effects, the function
+    /// may still be pure, e.g. if the instruction is a call to a pure
+    /// function or a store to a local variable.
+    switch (ir_kind(i)) {
+      case IR_STORE:
+        if (ir_kind(ir_store_addr(i)) == IR_ALLOCA) continue;
+        break;
+      case IR_CALL:
+        if (ir_call_is_direct(i) && ir_attribute(ir_callee(i).func, FUNC_ATTR_PURE)) continue;
+        break;
+      default: break;
+    }
+
+    /// Function is not pure.
+    if (!ir_attribute(f, FUNC_ATTR_PURE)) return false;
+    ir_attribute(f, FUNC_ATTR_PURE, false);
+    return true;
+  }
+
+  /// Function is pure.
+  if (ir_attribute(f, FUNC_ATTR_PURE)) return false;
+  ir_attribute(f, FUNC_ATTR_PURE, true);
+  return true;
+}
+
+/// Check if a function is a leaf function. This function returns whether
+/// the leaf attribute of the function has changed, *not* whether it’s a
+/// leaf or not.
+bool opt_check_leaf(IRFunction *f) {
+  /// A leaf function may not contain any calls except for recursive tail calls
+  /// or tail calls to other leaf functions.
+  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
+    if (ir_kind(i) != IR_CALL) continue;
+    if (ir_call_is_direct(i) && ir_call_tail(i)) {
+      IRFunction *callee = ir_callee(i).func;
+      if (callee == f || ir_attribute(callee, FUNC_ATTR_LEAF)) continue;
+    }
+
+    /// Function is not a leaf.
+    if (!ir_attribute(f, FUNC_ATTR_LEAF)) return false;
+    ir_attribute(f, FUNC_ATTR_LEAF, false);
+    return true;
+  }
+
+  /// Function is a leaf.
+  if (ir_attribute(f, FUNC_ATTR_LEAF)) return false;
+  ir_attribute(f, FUNC_ATTR_LEAF, true);
+  return true;
+}
+
+/// Check whether a function does not return. This function returns whether
+/// the noreturn attribute of the function has changed, *not* whether it actually
+/// returns or not.
+///
+/// If a function is marked as noreturn, then that means that it NEVER returns.
+/// A function that only sometimes doesn’t return is *not* noreturn.
+bool opt_check_noreturn(IRFunction *f) {
+  FOREACH_INSTRUCTION_IN_FUNCTION (i, b, f) {
+    /// A function that contains a tail call returns, unless the callee does not return.
+    ///
+    /// Checking regular calls doesn’t help, since we’re checking whether a function may
+    /// return, not whether it might not return; tail calls, however, are different, since
+    /// they are basically like return statements. We don’t care whether or not regular calls
+    /// return, but if a tail call returns, then we must also return.
+    IRType kind = ir_kind(i);
+    if (kind == IR_CALL && ir_call_tail(i)) {
+      /// If the call is a direct call, we can check the noreturn attribute of the callee.
+      /// We can’t know whether an indirect call returns, so we must assume that we return.
+      if (!ir_call_is_direct(i) || !ir_attribute(ir_callee(i).func, FUNC_ATTR_NORETURN)) goto may_return;
+    }
+
+    /// If a return instruction is encountered, then this function obviously returns.
+    else if (kind == IR_RETURN) {
+    may_return:
+      if (!ir_attribute(f, FUNC_ATTR_NORETURN)) return false;
+      ir_attribute(f, FUNC_ATTR_NORETURN, false);
+      return true;
+    }
+  }
+
+  /// Function does not return.
+  if (ir_attribute(f, FUNC_ATTR_NORETURN)) return false;
+  ir_attribute(f, FUNC_ATTR_NORETURN, true);
+  return true;
+}
+
+/// Check if a function is referenced by this instruction.
+typedef Map(IRFunction*, bool) FuncBoolMap;
+static void check_function_references(IRInstruction *inst, FuncBoolMap *referenced) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions that can reference a function");
+  switch (ir_kind(inst)) {
+    default: break;
+    case IR_FUNC_REF: map_set(*referenced, ir_func_ref_func(inst), true); break;
+    case IR_CALL: {
+      /// Only non-recursive direct calls count as references.
+      IRFunction *callee = ir_callee(inst).func;
+      if (ir_call_is_direct(inst) && ir_parent(ir_parent(inst)) != callee)
+        map_set(*referenced, callee, true);
+    } break;
+  }
+}
+
+/// Analyse functions to determine whether they’re pure, leaf functions, etc.
+bool opt_analyse_functions(CodegenContext *ctx) {
+  bool ever_changed = false, changed;
+  FuncBoolMap referenced_functions = {0};
+  do {
+    map_clear(referenced_functions);
+    changed = false;
+
+    /// Check function attributes.
+    foreach_val (f, ctx->functions) {
+      switch (ir_linkage(f)) {
+        case LINKAGE_IMPORTED:
+        case LINKAGE_REEXPORTED:
+          continue;
+
+        case LINKAGE_LOCALVAR:
+        case LINKAGE_INTERNAL:
+          map_set(referenced_functions, f, false);
+          break;
+
+        case LINKAGE_EXPORTED:
+        case LINKAGE_USED:
+          map_set(referenced_functions, f, true);
+          break;
+      }
+
+      changed |= opt_check_pure(f);
+      changed |= opt_check_leaf(f);
+      changed |= opt_check_noreturn(f);
+    }
+
+    /// The entry point is always referenced.
+    map_set(referenced_functions, ctx->entry, true);
+
+    /// Check if the functions are ever referenced.
+    FOREACH_INSTRUCTION_IN_CONTEXT (i, b, f, ctx)
+      check_function_references(i, &referenced_functions);
+
+    /// Also check in global variables.
+    foreach_val (var, ctx->static_vars)
+      if (var->init)
+        check_function_references(var->init, &referenced_functions);
+
+    /// Delete functions that are never referenced.
+    foreach (entry, referenced_functions) {
+      if (!entry->value) {
+        ir_delete_function(entry->key);
+        changed = true;
+      }
+    }
+
+    if (changed) ever_changed = true;
+  } while (changed);
+
+  map_delete(referenced_functions);
+  return ever_changed;
+}
+
+/// Remove stores and references to global variables that are
+/// not exported and never loaded from or passed to an instruction
+/// that clobbers memory.
+static bool opt_remove_globals(CodegenContext *ctx) {
+  /// If a variable is only ever used by stores and variable references,
+  /// then we can remove it.
+  foreach_val (var, ctx->static_vars) {
+    var->referenced = false;
+    foreach_val (ref, var->references) {
+      FOREACH_USER(user, ref) {
+        /// If the user is not a store or if the variable is the value
+        /// being stored, and not the address being stored, to, we can’t
+        /// remove it.
+        if (ir_kind(user) != IR_STORE || ir_store_value(user) == ref) {
+          var->referenced = true;
+          goto next;
+        }
+      }
+    }
+
+    next:;
+  }
+
+  /// Remove all stores to such variables.
+  bool changed = false;
+  foreach_val (var, ctx->static_vars) {
+    if (var->referenced) continue;
+    foreach_val (ref, var->references) {
+      for (usz i = 0, count = ir_use_count(ref); i < count; i++) {
+        IRInstruction *user = ir_user_get(ref, 0 /** (!) **/);
+        ASSERT(ir_kind(user) == IR_STORE);
+        ir_remove(user);
+        changed = true;
+      }
+    }
+  }
+
+  return changed;
+}
+
+/// ===========================================================================
+///  Block reordering etc.
+/// ===========================================================================
+/// Map containing the predecessors of each block.
+typedef MultiMap(IRBlock*, IRBlock*) Predecessors;
+
+/// Collect the predecessors of each block and
+/// remove unreachable blocks.
 static bool collect_preds_and_prune(IRFunction *f, Predecessors *preds) {
   bool changed = false;
 
   mmap_clear(*preds);
   FOREACH_BLOCK (block, f) {
-    STATIC_ASSERT(IR_COUNT == 40, "Handle all branch instructions");
+    STATIC_ASSERT(IR_COUNT == 41, "Handle all branch instructions");
     IRInstruction *br = ir_terminator(block);
     switch (ir_kind(br)) {
       default: break;
@@ -864,7 +2280,7 @@ static bool opt_jump_threading(CodegenContext *ctx, IRFunction *f, Predecessors
       IRBlock *successor = ir_dest(last);
       if (map_get(*preds, successor)->size != 1) {
         IRInstruction *first = *ir_begin(successor);
-        STATIC_ASSERT(IR_COUNT == 40, "Handle all branch instructions");
+        STATIC_ASSERT(IR_COUNT == 41, "Handle all branch instructions");
         switch (ir_kind(first)) {
           default: continue;
           case IR_BRANCH: ir_dest(last, ir_dest(first)); break;
@@ -923,6 +2339,150 @@ static bool opt_simplify_cfg(CodegenContext *ctx, IRFunction *f) {
   return ever_changed;
 }
 
+/// ===========================================================================
+///  If-conversion
+/// ===========================================================================
+/// Maximum number of instructions, excluding the branch, in an arm of
+/// a conditional that we’re willing to execute unconditionally.
+#define OPT_SELECT_MAX_ARM_SIZE 3
+
+/// Check if an instruction can be executed even if control flow
+/// would never have reached it.
+static bool is_speculatable(IRInstruction *i) {
+  switch (ir_kind(i)) {
+    /// Division by zero traps, and loads may fault.
+    case IR_DIV:
+    case IR_MOD:
+    case IR_LOAD:
+      return false;
+
+    /// Don’t bother with calls, even if they’re pure.
+    case IR_CALL:
+    case IR_INTRINSIC:
+    case IR_ALLOCA:
+      return false;
+
+    default: return !has_side_effects(i);
+  }
+}
+
+/// Check if an arm of a conditional branch in `pred` consists only of
+/// a few instructions that can be hoisted into `pred` and a branch to
+/// `join`.
+static bool is_hoistable_arm(Predecessors *preds, IRBlock *arm, IRBlock *pred, IRBlock *join) {
+  IRInstruction *br = ir_terminator(arm);
+  if (ir_kind(br) != IR_BRANCH || ir_dest(br) != join) return false;
+
+  /// The arm must not be reachable from anywhere else.
+  if (map_get(*preds, arm)->size != 1 || map_get(*preds, arm)->data[0] != pred) return false;
+
+  if (ir_count(arm) - 1 > OPT_SELECT_MAX_ARM_SIZE) return false;
+  FOREACH_INSTRUCTION (i, arm)
+    if (i != br && !is_speculatable(i))
+      return false;
+
+  return true;
+}
+
+/// Get the value a PHI receives from a block.
+static IRInstruction *phi_value_from(IRInstruction *phi, IRBlock *block) {
+  for (usz n = 0; n < ir_phi_args_count(phi); n++) {
+    const IRPhiArgument *arg = ir_phi_arg(phi, n);
+    if (arg->block == block) return arg->value;
+  }
+
+  UNREACHABLE();
+}
+
+/// Convert the first conditional branch in a function that forms a
+/// diamond or a triangle with small, side-effect-free arms into straight
+/// line code, replacing the PHIs at the join point with selects.
+///
+///        A              A
+///       / \            / |
+///      T   E          T  |
+///       \ /            \ |
+///        J              J
+///
+/// The arms become unreachable and are pruned by CFG simplification.
+static bool opt_if_convert(CodegenContext *ctx, IRFunction *f, Predecessors *preds) {
+  FOREACH_BLOCK (b, f) {
+    IRInstruction *br = ir_terminator(b);
+    if (ir_kind(br) != IR_BRANCH_CONDITIONAL) continue;
+    IRBlock *then = ir_then(br);
+    IRBlock *else_ = ir_else(br);
+    if (then == else_ || then == b || else_ == b) continue;
+
+    /// Find the join point. One arm may be empty, in which
+    /// case we branch directly to the join point.
+    IRInstruction *then_br = ir_terminator(then);
+    IRInstruction *else_br = ir_terminator(else_);
+    IRBlock *then_dest = ir_kind(then_br) == IR_BRANCH ? ir_dest(then_br) : NULL;
+    IRBlock *else_dest = ir_kind(else_br) == IR_BRANCH ? ir_dest(else_br) : NULL;
+    IRBlock *join = NULL;
+    if (then_dest == else_) join = else_;
+    else if (else_dest == then) join = then;
+    else if (then_dest && then_dest == else_dest) join = then_dest;
+    if (!join || join == b) continue;
+
+    /// Check that the arms can be executed unconditionally and that
+    /// nothing else branches to the join point.
+    if (then != join && !is_hoistable_arm(preds, then, b, join)) continue;
+    if (else_ != join && !is_hoistable_arm(preds, else_, b, join)) continue;
+    if (map_get(*preds, join)->size != 2) continue;
+
+    /// Only values that fit in a register can be selected.
+    bool ok = true;
+    FOREACH_INSTRUCTION (i, join) {
+      if (ir_kind(i) != IR_PHI) break;
+      Type *t = ir_typeof(i);
+      usz sz = type_sizeof(t);
+      if (type_is_struct(t) || type_is_array(t) || sz == 0 || sz > 8) {
+        ok = false;
+        break;
+      }
+    }
+    if (!ok) continue;
+
+    /// Hoist the arms.
+    if (then != join) while (ir_count(then) > 1) ir_move_before(br, *ir_begin(then));
+    if (else_ != join) while (ir_count(else_) > 1) ir_move_before(br, *ir_begin(else_));
+
+    /// Replace the PHIs with selects.
+    IRBlock *then_pred = then == join ? b : then;
+    IRBlock *else_pred = else_ == join ? b : else_;
+    FOREACH_INSTRUCTION (i, join) {
+      if (ir_kind(i) != IR_PHI) break;
+      ir_replace(i, ir_create_select(
+        ctx,
+        ir_typeof(i),
+        ir_cond(br),
+        phi_value_from(i, then_pred),
+        phi_value_from(i, else_pred)
+      ));
+    }
+
+    /// Branch to the join point directly.
+    ir_replace(br, ir_create_br(ctx, join));
+    return true;
+  }
+
+  return false;
+}
+
+/// Replace small conditionals with selects.
+static bool opt_select(CodegenContext *ctx, IRFunction *f) {
+  Predecessors preds = {0};
+  bool changed = false;
+  for (;;) {
+    changed |= collect_preds_and_prune(f, &preds);
+    if (!opt_if_convert(ctx, f, &preds)) break;
+    changed = true;
+  }
+  mmap_delete(preds);
+  return changed;
+}
+
 /// Check if two instructions refer to the same in-memory object.
 static bool same_memory_object(IRInstruction *a, IRInstruction *b) {
   if (a == b) return true;
@@ -1097,9 +2657,14 @@ void codegen_optimise(CodegenContext *ctx) {
         /// ir_print_function(stdout, f);
       } while (
         opt_simplify_cfg(ctx, f) |
+        opt_select(ctx, f) |
         opt_instcombine(ctx, f) |
         opt_dce(f) |
+        opt_sroa(ctx, f) |
         opt_mem2reg(f) |
+        opt_sccp(ctx, f) |
+        opt_gvn(f) |
+        opt_licm(ctx, f) |
         opt_store_forwarding(f) |
         opt_tail_call_elim(f)
       );
@@ -0,0 +1,44 @@
+#include <codegen/peephole.h>
+#include <utils.h>
+#include <vector.h>
+
+void mir_peephole(MIRFunction *function, MIRPeepholeRule *rules, usz rule_count) {
+  foreach_val (block, function->blocks) {
+    // A rule may change or remove instructions anywhere from the one it
+    // is applied to onwards, and make earlier ones match again (e.g. a
+    // chain of adds), so keep going until nothing changes.
+    bool changed;
+    do {
+      changed = false;
+      for (usz i = 0; i < block->instructions.size; ++i) {
+        for (usz r = 0; r < rule_count; ++r) {
+          if (rules[r].apply(block, i)) {
+            rules[r].hits++;
+            changed = true;
+            break;
+          }
+        }
+      }
+    } while (changed);
+  }
+}
+
+void mir_peephole_print_stats(MIRPeepholeRule *rules, usz rule_count) {
+  Vector(MIRPeepholeRule *) applied = {0};
+  for (usz r = 0; r < rule_count; ++r)
+    if (rules[r].hits) vector_push(applied, rules + r);
+
+  // Sort by number of hits, most first; keep table order otherwise.
+  for (usz i = 1; i < applied.size; ++i) {
+    MIRPeepholeRule *rule = applied.data[i];
+    usz j = i;
+    for (; j > 0 && applied.data[j - 1]->hits < rule->hits; --j)
+      applied.data[j] = applied.data[j - 1];
+    applied.data[j] = rule;
+  }
+
+  print("================ Peephole Stats ================\n");
+  print("%Z of %Z rules applied\n", applied.size, rule_count);
+  foreach_val (rule, applied) print("%Z hits: %s\n", rule->hits, rule->name);
+  vector_delete(applied);
+}
@@ -0,0 +1,34 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <codegen/codegen_forward.h>
+#include <codegen/machine_ir.h>
+
+/// Try to rewrite the instruction at the given index within the given
+/// block, possibly together with the instructions that follow it.
+/// Return true iff anything was changed.
+FUNCTION_POINTER(bool, MIRPeepholeFunction, MIRBlock *block, usz index);
+
+/// A single peephole rule. Rules are applied after register allocation,
+/// so they operate on hardware registers and must not introduce any new
+/// virtual registers.
+typedef struct MIRPeepholeRule {
+  const char *name;
+  MIRPeepholeFunction apply;
+
+  /// Number of times this rule was applied; see `--peephole-stats`.
+  usz hits;
+} MIRPeepholeRule;
+
+/// Apply the given rules to every instruction of the given function
+/// until none of them applies anymore. At each instruction, rules are
+/// tried in order; the first one that applies wins.
+void mir_peephole(MIRFunction *function, MIRPeepholeRule *rules, usz rule_count);
+
+/// Whether to print how often each peephole rule was applied.
+extern bool print_peephole_stats;
+
+/// Print the rules that were applied, most frequently applied first.
+void mir_peephole_print_stats(MIRPeepholeRule *rules, usz rule_count);
+
+#endif /* PEEPHOLE_H */
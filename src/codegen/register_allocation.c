@@ -34,31 +34,83 @@ CodegenContext *debug_context = NULL;
 
 typedef Vector(VReg) VRegVector;
 
-static bool vreg_vector_contains(VRegVector *vregs, usz vreg_value) {
-  foreach (v, *vregs) {
-    if (v->value == vreg_value)
-      return true;
-  }
-  return false;
+/// Dense numbering of the registers that take part in allocation:
+/// hardware registers come first, followed by virtual registers in
+/// order of appearance. The adjacency graph, live sets, and colouring
+/// are all indexed by this number.
+typedef struct RegisterNumbering {
+  /// Index -> register.
+  VRegVector regs;
+
+  /// Register value -> index, or -1 if the register is not allocated.
+  usz *index;
+  usz index_size;
+} RegisterNumbering;
+
+/// Return the index of the given register, or -1 if it is not
+/// allocated.
+static usz vreg_index(RegisterNumbering *numbering, usz value) {
+  return value < numbering->index_size ? numbering->index[value] : (usz) -1;
+}
+
+static void number_register(RegisterNumbering *numbering, usz value, u32 size) {
+  if (numbering->index[value] != (usz) -1) return;
+  numbering->index[value] = numbering->regs.size;
+  VReg r = {0};
+  r.value = value;
+  r.size = size;
+  vector_push(numbering->regs, r);
 }
 
-static void vreg_vector_remove_element(VRegVector *vregs, usz vreg_value) {
-  size_t i = 0;
-  for (; i < vregs->size; ++i) {
-    if (vregs->data[i].value == vreg_value)
-      break;
+static RegisterNumbering number_registers(MIRFunction *f, const MachineDescription *desc) {
+  RegisterNumbering numbering = {0};
+
+  /// Find the largest register so we know how big the index needs to be.
+  usz max_value = MIR_ARCH_START;
+  for (usz i = 0; i < desc->register_count; ++i)
+    if (desc->registers[i] > max_value) max_value = desc->registers[i];
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      if (inst->reg > max_value) max_value = inst->reg;
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value > max_value)
+          max_value = op->value.reg.value;
+      }
+    }
   }
-  if (i < vregs->size) vector_remove_unordered(*vregs, i);
+
+  numbering.index_size = max_value + 1;
+  numbering.index = malloc(numbering.index_size * sizeof(usz));
+  memset(numbering.index, 0xff, numbering.index_size * sizeof(usz));
+
+  for (usz i = 0; i < desc->register_count; ++i)
+    number_register(&numbering, desc->registers[i], 0);
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START)
+          number_register(&numbering, op->value.reg.value, op->value.reg.size);
+      }
+    }
+  }
+
+  return numbering;
+}
+
+static void free_register_numbering(RegisterNumbering *numbering) {
+  vector_delete(numbering->regs);
+  free(numbering->index);
 }
 
 /// Return non-zero iff given instruction needs a register.
 static bool needs_register(IRInstruction *instruction) {
-  STATIC_ASSERT(IR_COUNT == 40, "Exhaustively handle all instruction types");
+  STATIC_ASSERT(IR_COUNT == 41, "Exhaustively handle all instruction types");
   ASSERT(instruction);
   switch (ir_kind(instruction)) {
     case IR_LOAD:
     case IR_PHI:
     case IR_COPY:
+    case IR_SELECT:
     case IR_IMMEDIATE:
     case IR_CALL:
     case IR_INTRINSIC:
@@ -90,37 +142,114 @@ static bool needs_register(IRInstruction *instruction) {
 
 //==== BEG ADJACENCY MATRIX ====
 
+/// Graphs with more registers than this store their edges in a hash
+/// set instead of a bit matrix; at this size, the matrix takes 1 MiB.
+#define ADJM_DENSE_MAX_SIZE 4096
+
+#define ADJM_BITS (sizeof(usz) * 8)
+
+/// Interference is symmetric, and no register interferes with itself,
+/// so only the lower triangle (x > y) of the matrix is stored.
+///
+/// Small graphs store that triangle as a bitset. Large graphs are
+/// almost always sparse, so they store the set of edges in an
+/// open-addressing hash table instead.
 typedef struct AdjacencyMatrix {
   usz size;
-  bool *data;
+
+  /// Triangular bitset. NULL if the matrix is sparse.
+  usz *bits;
+
+  /// Hash set of edges, encoded as `(x << 32 | y) + 1`, so that
+  /// empty slots are zero. Capacity is always a power of two.
+  u64 *edges;
+  usz edge_count;
+  usz edge_capacity;
 } AdjacencyMatrix;
 
-bool *adjm_entry(AdjacencyMatrix m, usz x, usz y) {
-  if (x > m.size) {
-    ICE("Can not access adjacency matrix because X is out of bounds.");
-  }
-  if (y > m.size) {
-    ICE("Can not access adjacency matrix because Y is out of bounds.");
-  }
-  // Coordinate translation for lower left triangle matrix
-  if (y > x) {
-    usz old_x = x;
-    x = y;
-    y = old_x;
+static usz adjm_bit_index(usz x, usz y) {
+  return x * (x - 1) / 2 + y;
+}
+
+static u64 adjm_edge_key(usz x, usz y) {
+  return ((u64) x << 32 | (u64) y) + 1;
+}
+
+static usz adjm_edge_slot(u64 key, usz capacity) {
+  return (usz) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+static void adjm_init(AdjacencyMatrix *m, usz size) {
+  m->size = size;
+  if (size <= ADJM_DENSE_MAX_SIZE) {
+    usz bit_count = size ? adjm_bit_index(size, 0) : 0;
+    m->bits = calloc((bit_count + ADJM_BITS - 1) / ADJM_BITS + 1, sizeof(usz));
+  } else {
+    ASSERT(size <= UINT32_MAX, "Too many registers in interference graph");
+    m->edge_capacity = 1024;
+    m->edges = calloc(m->edge_capacity, sizeof(u64));
   }
-  return &m.data[y * m.size + x];
 }
 
-void adjm_set(AdjacencyMatrix m, usz x, usz y) {
-  *adjm_entry(m, x, y) = 1;
+static void adjm_free(AdjacencyMatrix *m) {
+  free(m->bits);
+  free(m->edges);
+  *m = (AdjacencyMatrix){0};
+}
+
+/// Return a pointer to the hash set slot for the given key, which is
+/// either the slot containing it or the empty slot it belongs in.
+static u64 *adjm_edge_find(AdjacencyMatrix *m, u64 key) {
+  usz slot = adjm_edge_slot(key, m->edge_capacity);
+  while (m->edges[slot] && m->edges[slot] != key)
+    slot = (slot + 1) & (m->edge_capacity - 1);
+  return m->edges + slot;
+}
+
+static void adjm_edges_grow(AdjacencyMatrix *m) {
+  u64 *old = m->edges;
+  usz old_capacity = m->edge_capacity;
+  m->edge_capacity *= 2;
+  m->edges = calloc(m->edge_capacity, sizeof(u64));
+  for (usz i = 0; i < old_capacity; ++i)
+    if (old[i]) *adjm_edge_find(m, old[i]) = old[i];
+  free(old);
+}
+
+/// Order coordinates so that they refer to the lower triangle.
+static void adjm_check(AdjacencyMatrix *m, usz *x, usz *y) {
+  if (*x >= m->size) ICE("Can not access adjacency matrix because X is out of bounds.");
+  if (*y >= m->size) ICE("Can not access adjacency matrix because Y is out of bounds.");
+  if (*y > *x) {
+    usz old_x = *x;
+    *x = *y;
+    *y = old_x;
+  }
 }
 
-void adjm_clear(AdjacencyMatrix m, usz x, usz y) {
-  *adjm_entry(m, x, y) = 0;
+void adjm_set(AdjacencyMatrix *m, usz x, usz y) {
+  adjm_check(m, &x, &y);
+  if (x == y) return;
+  if (m->bits) {
+    usz i = adjm_bit_index(x, y);
+    m->bits[i / ADJM_BITS] |= (usz) 1 << (i % ADJM_BITS);
+    return;
+  }
+
+  u64 *slot = adjm_edge_find(m, adjm_edge_key(x, y));
+  if (*slot) return;
+  *slot = adjm_edge_key(x, y);
+  if (++m->edge_count * 2 > m->edge_capacity) adjm_edges_grow(m);
 }
 
-bool adjm(AdjacencyMatrix m, usz x, usz y) {
-  return *adjm_entry(m, x, y);
+bool adjm(AdjacencyMatrix *m, usz x, usz y) {
+  adjm_check(m, &x, &y);
+  if (x == y) return false;
+  if (m->bits) {
+    usz i = adjm_bit_index(x, y);
+    return (m->bits[i / ADJM_BITS] >> (i % ADJM_BITS)) & 1;
+  }
+  return *adjm_edge_find(m, adjm_edge_key(x, y)) != 0;
 }
 
 typedef struct AdjacencyList AdjacencyList;
@@ -131,254 +260,340 @@ typedef struct AdjacencyGraph {
   AdjacencyMatrix matrix;
   usz *regmasks;
   AdjacencyLists lists;
+
+  /// Number of instructions across which each register is live.
+  usz *live_lengths;
+
+  /// Registers clobbered by the calls that each register is live across.
+  usz *call_clobbers;
 } AdjacencyGraph;
 
 void allocate_adjacency_graph(AdjacencyGraph *G, usz size) {
-  if (G->matrix.data) { free(G->matrix.data); }
+  adjm_free(&G->matrix);
   if (G->regmasks) { free(G->regmasks); }
-  G->matrix.size = size;
-  G->matrix.data = calloc(1, size * size + 1);
+  if (G->live_lengths) { free(G->live_lengths); }
+  if (G->call_clobbers) { free(G->call_clobbers); }
+  adjm_init(&G->matrix, size);
   G->regmasks = calloc(1, size * sizeof(usz));
+  G->live_lengths = calloc(1, size * sizeof(usz));
+  G->call_clobbers = calloc(1, size * sizeof(usz));
+}
+
+//==== BEG LIVENESS ====
+
+/// Sets of registers are stored as bitsets, indexed by the position
+/// of the register within the list of registers being allocated.
+#define LIVE_SET_BITS (sizeof(usz) * 8)
+
+static usz live_set_words(usz bits) {
+  return (bits + LIVE_SET_BITS - 1) / LIVE_SET_BITS;
+}
+
+static bool live_set_test(const usz *set, usz i) {
+  return (set[i / LIVE_SET_BITS] >> (i % LIVE_SET_BITS)) & 1;
+}
+
+static void live_set_add(usz *set, usz i) {
+  set[i / LIVE_SET_BITS] |= (usz)1 << (i % LIVE_SET_BITS);
+}
+
+static void live_set_remove(usz *set, usz i) {
+  set[i / LIVE_SET_BITS] &= ~((usz)1 << (i % LIVE_SET_BITS));
+}
+
+/// Iterate over the index of every register in the set.
+#define foreach_live(index, set, words)                                        \
+  for (usz index##_word = 0; index##_word < (words); ++index##_word)           \
+    for (usz index##_bits = (set)[index##_word], index = 0;                    \
+         index##_bits && (index = index##_word * LIVE_SET_BITS + (usz)__builtin_ctzll(index##_bits), 1); \
+         index##_bits &= index##_bits - 1)
+
+/// Live-in and live-out sets of every block in a function, indexed by
+/// block id. Each set is `words` words long.
+typedef struct Liveness {
+  usz words;
+  usz *live_in;
+  usz *live_out;
+} Liveness;
+
+static usz *live_in(Liveness *l, MIRBlock *b) { return l->live_in + b->id * l->words; }
+static usz *live_out(Liveness *l, MIRBlock *b) { return l->live_out + b->id * l->words; }
+
+/// Return true iff the given register operand is written by its
+/// instruction. Virtual registers are written by their defining use;
+/// hardware registers by operands that the backend marks as defining
+/// uses and by copies into them, e.g. of arguments or return values.
+static bool is_def(const MachineDescription *desc, MIRInstruction *inst, MIROperand *op) {
+  if (op->kind != MIR_OP_REGISTER) return false;
+  if (op->value.reg.defining_use) return true;
+  if (op->value.reg.value >= MIR_ARCH_START) return false;
+  return (inst->opcode == desc->register_copy_opcode || inst->opcode == MPSEUDO_R2R)
+    && inst->operand_count == 2
+    && op == mir_get_op(inst, 1);
+}
+
+/// Return the index of the register that the operand defines, or -1
+/// if it does not define a register that takes part in allocation.
+static usz def_index(const MachineDescription *desc, RegisterNumbering *vregs, MIRInstruction *inst, MIROperand *op) {
+  return is_def(desc, inst, op) ? vreg_index(vregs, op->value.reg.value) : (usz) -1;
+}
+
+/// Return the index of the register that the operand uses, or -1 if
+/// it does not use a register that takes part in allocation.
+static usz use_index(const MachineDescription *desc, RegisterNumbering *vregs, MIRInstruction *inst, MIROperand *op) {
+  if (op->kind != MIR_OP_REGISTER || is_def(desc, inst, op)) return (usz) -1;
+  return vreg_index(vregs, op->value.reg.value);
 }
 
-/// Walk over all possible paths in the control flow graph upwards from
-/// given block, computing instruction interferences based on the values
-/// that are currently live.
+/// Return the hardware registers, indexed by register, that an
+/// instruction writes without them being operands: its clobbers and,
+/// for calls, the result register.
+static usz implicit_defs(const MachineDescription *desc, MIRInstruction *inst) {
+  usz defs = 0;
+  foreach (clobbered, inst->clobbers) defs |= (usz)1 << clobbered->value;
+  if (inst->opcode == MIR_CALL) defs |= (usz)1 << desc->result_register;
+  return defs;
+}
+
+/// Iterate over the index of every hardware register in a bitmask
+/// indexed by register.
+#define foreach_hardware_index(index, vregs, mask)                             \
+  for (usz index##_bits = (mask), index = 0;                                   \
+       index##_bits && (index = vreg_index(vregs, (usz)__builtin_ctzll(index##_bits)), 1); \
+       index##_bits &= index##_bits - 1)
+
+/// Some instructions, e.g. calls, define their result register without
+/// it appearing as an operand. Return the index of that register, or -1
+/// if there is no such register.
+static usz result_vreg_index(RegisterNumbering *vregs, MIRInstruction *inst) {
+  if (inst->reg < MIR_ARCH_START) return (usz) -1;
+  FOREACH_MIR_OPERAND(inst, op) {
+    if (op->kind == MIR_OP_REGISTER && op->value.reg.value == inst->reg)
+      return (usz) -1;
+  }
+  return vreg_index(vregs, inst->reg);
+}
+
+/// Compute the live-in and live-out sets of every block of a function
+/// by iterating the backward dataflow equations
+///
+///   live_out(B) = ∪ live_in(S) for all successors S of B
+///   live_in(B)  = gen(B) ∪ (live_out(B) - kill(B))
+///
+/// to a fixed point, where gen(B) is the set of registers that are used
+/// in B before being defined and kill(B) is the set of registers that B
+/// defines.
+///
+/// Hardware registers are tracked as well, so that values are never
+/// assigned a hardware register while it holds e.g. a parameter. Values
+/// that hardware registers receive implicitly, such as the parameters on
+/// entry, are live from the start of the function.
+static Liveness compute_liveness(const MachineDescription *desc, MIRFunction *f, RegisterNumbering *vregs) {
+  Liveness l = {0};
+  l.words = live_set_words(vregs->regs.size);
+  usz set_size = f->blocks.size * l.words;
+  l.live_in = calloc(set_size ? set_size : 1, sizeof(usz));
+  l.live_out = calloc(set_size ? set_size : 1, sizeof(usz));
+  usz *gen = calloc(set_size ? set_size : 1, sizeof(usz));
+  usz *kill = calloc(set_size ? set_size : 1, sizeof(usz));
+
+  /// Blocks may have been added or removed since they were created.
+  foreach_index (i, f->blocks) f->blocks.data[i]->id = i;
+
+  /// Compute gen and kill sets by walking each block backwards once.
+  foreach_val (b, f->blocks) {
+    usz *b_gen = gen + b->id * l.words;
+    usz *b_kill = kill + b->id * l.words;
+    foreach_ptr_rev (inst, b->instructions) {
+      FOREACH_MIR_OPERAND(inst, op) {
+        usz idx = def_index(desc, vregs, inst, op);
+        if (idx == (usz) -1) continue;
+        live_set_remove(b_gen, idx);
+        live_set_add(b_kill, idx);
+      }
+      usz result = result_vreg_index(vregs, inst);
+      if (result != (usz) -1) {
+        live_set_remove(b_gen, result);
+        live_set_add(b_kill, result);
+      }
+      foreach_hardware_index (idx, vregs, implicit_defs(desc, inst)) {
+        live_set_remove(b_gen, idx);
+        live_set_add(b_kill, idx);
+      }
+      FOREACH_MIR_OPERAND(inst, use) {
+        usz idx = use_index(desc, vregs, inst, use);
+        if (idx != (usz) -1) live_set_add(b_gen, idx);
+      }
+    }
+  }
+
+  /// Iterate until nothing changes. Visiting the blocks in reverse
+  /// order propagates liveness quickly, since most edges point forward.
+  bool changed;
+  do {
+    changed = false;
+    foreach_ptr_rev (b, f->blocks) {
+      usz *in = live_in(&l, b);
+      usz *out = live_out(&l, b);
+      usz *b_gen = gen + b->id * l.words;
+      usz *b_kill = kill + b->id * l.words;
+
+      foreach_val (succ, b->successors) {
+        usz *succ_in = live_in(&l, succ);
+        for (usz w = 0; w < l.words; ++w) out[w] |= succ_in[w];
+      }
+
+      for (usz w = 0; w < l.words; ++w) {
+        usz new_in = b_gen[w] | (out[w] & ~b_kill[w]);
+        if (new_in != in[w]) {
+          in[w] = new_in;
+          changed = true;
+        }
+      }
+    }
+  } while (changed);
+
+  free(gen);
+  free(kill);
+  return l;
+}
+
+static void free_liveness(Liveness *l) {
+  free(l->live_in);
+  free(l->live_out);
+}
+
+//==== END LIVENESS ====
+
+/// Return the hardware registers that a call may clobber: those of the
+/// callee if it is a function whose clobbers are already known, and
+/// all caller-saved registers otherwise.
+static usz call_clobbers(const MachineDescription *desc, MIRInstruction *call) {
+  MIROperand *callee = mir_get_op(call, 0);
+  if (callee->kind == MIR_OP_FUNCTION && callee->value.function->clobbers_known)
+    return callee->value.function->clobbers;
+
+  usz all = 0;
+  for (usz i = 0; i < desc->register_count; ++i) all |= (usz)1 << desc->registers[i];
+  return all & ~desc->callee_saved_registers;
+}
+
+/// Collect interferences within a block in a single backwards sweep,
+/// starting from the values that are live on exit from the block.
 static void collect_interferences_from_block
 (const MachineDescription *desc,
  MIRBlock *b,
- VRegVector *live_vals,
- VRegVector *vregs,
- MIRBlockVector *visited,
- MIRBlockVector *doubly_visited,
+ Liveness *liveness,
+ usz *live,
+ RegisterNumbering *vregs,
  AdjacencyGraph *G
  )
 {
-  /// Don't visit the same block thrice.
-  if (vector_contains(*visited, b)) {
-    if (vector_contains(*doubly_visited, b))
-      return;
-    else vector_push(*doubly_visited, b);
-  } else vector_push(*visited, b);
+  memcpy(live, live_out(liveness, b), liveness->words * sizeof(usz));
 
+  /// Register operands of the current instruction, as indices into the
+  /// list of registers.
+  Vector(usz) reg_operands = {0};
 
-  DEBUG("  from block...\n");
-
-  // Collect interferences for virtual registers in this block.
-  // Basically, walk over the instructions of the block backwards, keeping
-  // track of all virtual registers that have been encountered but not
-  // their defining use, as these are our "live values".
-
-  /// Collect interferences for instructions in this block.
   foreach_ptr_rev (inst, b->instructions) {
-
-    /// If the defining use of a virtual register is an operand of this
-    /// instruction, remove it from vector of live vals.
+    /// Registers defined by this instruction are not live before it.
     FOREACH_MIR_OPERAND(inst, op) {
-#ifdef DEBUG_RA
-      print("operand:\n");
-      foreach_index (idx, *live_vals) {
-        VReg live_val = live_vals->data[idx];
-        print("  %V (%Z) is live\n", live_val.value, idx);
+      usz idx = def_index(desc, vregs, inst, op);
+      if (idx != (usz) -1) {
+        DEBUG("  Defining use, removing live value %V\n", op->value.reg.value);
+        live_set_remove(live, idx);
       }
-#endif
+    }
+    usz result = result_vreg_index(vregs, inst);
+    if (result != (usz) -1) live_set_remove(live, result);
+    foreach_hardware_index (idx, vregs, implicit_defs(desc, inst)) live_set_remove(live, idx);
 
-      if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START && op->value.reg.defining_use) {
-        vreg_vector_remove_element(live_vals, op->value.reg.value);
-#ifdef DEBUG_RA
-        print("  Defining use, removing live value %V\n", op->value.reg.value);
-        foreach_index (idx, *live_vals) {
-          VReg live_val = live_vals->data[idx];
-          print("++%V (%Z) is live\n", live_val.value, idx);
-        }
-#endif
-      }
+    if (inst->opcode == MIR_CALL) {
+      usz clobbers = call_clobbers(desc, inst);
+      foreach_live (live_idx, live, liveness->words) G->call_clobbers[live_idx] |= clobbers;
     }
 
     /// Collect all register operands from this instruction that are
-    /// used as operands somewhere in the function (i.e. within the list of
-    /// registers).
-    typedef struct MIROperandPlusLiveValIndex {
-      MIROperand *op;
-      usz live_idx;
-    } MIROperandPlusLiveValIndex;
-    Vector(MIROperandPlusLiveValIndex) reg_operands = {0};
+    /// in the list of registers to allocate.
+    vector_clear(reg_operands);
     FOREACH_MIR_OPERAND(inst, oper) {
-      if (oper->kind == MIR_OP_REGISTER) {
-        // Get index within adjacency matrix of reg operand.
-        usz live_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == oper->value.reg.value) {
-            live_idx = i;
-            break;
-          }
-        }
-        if (oper->value.reg.value >= MIR_ARCH_START)
-          ASSERT(live_idx != (usz)-1,
-                 "Could not find vreg from live values vector in list of vregs: %V\n",
-                 oper->value.reg.value);
-        if (live_idx != (usz)-1) {
-          MIROperandPlusLiveValIndex val = {0};
-          val.op = oper;
-          val.live_idx = live_idx;
-          vector_push(reg_operands, val);
-        }
-      }
+      if (oper->kind != MIR_OP_REGISTER) continue;
+      usz idx = vreg_index(vregs, oper->value.reg.value);
+      if (oper->value.reg.value >= MIR_ARCH_START)
+        ASSERT(idx != (usz)-1, "Could not find vreg in list of vregs: %V\n", oper->value.reg.value);
+      if (idx != (usz)-1) vector_push(reg_operands, idx);
     }
-    /// Make all reg operands interfere with each other.
-    if (reg_operands.size > 1) {
-      foreach (A, reg_operands) {
-        if (A->op->value.reg.defining_use || A->op->value.reg.value < MIR_ARCH_START) continue;
-        // Set interference with all other reg operands
-        foreach (B, reg_operands) {
-          if (B->op->value.reg.defining_use || B->op->value.reg.value < MIR_ARCH_START) continue;
-          if (B->live_idx == A->live_idx) continue;
-#ifdef DEBUG_RA
-          print("Setting r%Z interfere with r%Z (used in same instruction)\n", A->op->value.reg.value, B->op->value.reg.value);
-#endif
-          adjm_set(G->matrix, A->live_idx, B->live_idx);
-          adjm_set(G->matrix, B->live_idx, A->live_idx);
-        }
+    if (result != (usz) -1) vector_push(reg_operands, result);
+
+    /// Make all used register operands interfere with each other.
+    FOREACH_MIR_OPERAND(inst, A) {
+      usz a = use_index(desc, vregs, inst, A);
+      if (a == (usz) -1) continue;
+      FOREACH_MIR_OPERAND(inst, B) {
+        usz b_idx = use_index(desc, vregs, inst, B);
+        if (b_idx == (usz) -1 || a == b_idx) continue;
+        DEBUG("Setting %V interfere with %V (used in same instruction)\n", A->value.reg.value, B->value.reg.value);
+        adjm_set(&G->matrix, a, b_idx);
       }
     }
-    /// Make all reg operands interfere with all clobbers of this instruction
-    foreach (A, reg_operands) {
-      foreach (clobbered, inst->clobbers) {
-        // Get index of clobbered register.
-        usz clobbered_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == clobbered->value) {
-            clobbered_idx = i;
-            break;
-          }
-        }
-        ASSERT(clobbered_idx != (usz)-1, "Could not find register from clobbers list in list of registers: %V\n", clobbered->value);
 
-        adjm_set(G->matrix, A->live_idx, clobbered_idx);
-        adjm_set(G->matrix, clobbered_idx, A->live_idx);
-      }
+    /// Make all clobbers of this instruction interfere with its register
+    /// operands and with all values that are live across it.
+    foreach (clobbered, inst->clobbers) {
+      usz clobbered_idx = vreg_index(vregs, clobbered->value);
+      ASSERT(clobbered_idx != (usz)-1, "Could not find register from clobbers list in list of registers: %V\n", clobbered->value);
+      foreach (a, reg_operands) adjm_set(&G->matrix, *a, clobbered_idx);
+      foreach_live (live_idx, live, liveness->words) adjm_set(&G->matrix, live_idx, clobbered_idx);
     }
-    // Make all reg operands interfere with all currently live values
-    foreach (A, reg_operands) {
-      foreach (live_val, *live_vals) {
-        DEBUG("--%V (%Z) is live\n", (usz)inst->reg, A->live_idx);
-
-        if (inst->reg == live_val->value) {
-          DEBUG("  Automatically skipping \"interference with self\": %V (%Z)\n", (usz)inst->reg, A->live_idx);
-          continue;
-        }
-
-        usz live_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == live_val->value) {
-            live_idx = i;
-            break;
-          }
-        }
-        ASSERT(live_idx != (usz)-1, "Could not find vreg from live values vector in list of vregs: %V\n", live_val->value);
-
-        DEBUG("--Setting live value %V (%Z) within %V (%Z)\n", live_val->value, live_idx, inst->reg, A->live_idx);
-
-        if (live_idx >= G->matrix.size) ICE("Index out of bounds (live value vreg index)", live_idx);
-        if (A->live_idx >= G->matrix.size) ICE("Index out of bounds (instruction vreg index)", live_idx);
 
-        adjm_set(G->matrix, A->live_idx, live_idx);
-        adjm_set(G->matrix, live_idx, A->live_idx);
-      }
+    /// Make all reg operands interfere with all currently live values.
+    usz self = inst->reg >= MIR_ARCH_START ? vreg_index(vregs, inst->reg) : (usz)-1;
+    foreach_live (live_idx, live, liveness->words) {
+      G->live_lengths[live_idx]++;
+      if (live_idx == self) continue;
+      foreach (a, reg_operands) adjm_set(&G->matrix, *a, live_idx);
     }
-    vector_delete(reg_operands);
 
-    /// If a virtual register is not live and is seen as an operand, it
-    /// is added to the vector of live values.
+    /// Registers used by this instruction are live before it.
     FOREACH_MIR_OPERAND(inst, operand) {
-      if (operand->kind == MIR_OP_REGISTER && operand->value.reg.value >= MIR_ARCH_START) {
-        if (!operand->value.reg.defining_use && !vreg_vector_contains(live_vals, operand->value.reg.value)) {
-          VReg v = {0};
-          v.value = operand->value.reg.value;
-          v.size = operand->value.reg.size;
-          DEBUG("  Adding live value %V\n", v.value);
-          vector_push(*live_vals, v);
-        }
+      usz idx = use_index(desc, vregs, inst, operand);
+      if (idx != (usz) -1) {
+        DEBUG("  Adding live value %V\n", operand->value.reg.value);
+        live_set_add(live, idx);
       }
     }
   }
 
-  // The entry block has no predecessors.
-  if (b->is_entry) return;
-
-#ifdef DEBUG_RA
-  foreach_ptr (MIRBlock*, parent, b->predecessors) {
-    print("  Parent block:\n");
-    print_mir_block(parent);
-  }
-#endif
-
-  foreach_val (parent, b->predecessors) {
-    // Copy live vals
-    VRegVector live_vals_copy = {0};
-    foreach (lv, *live_vals)
-      vector_push(live_vals_copy, *lv);
-
-    collect_interferences_from_block(desc, parent, &live_vals_copy, vregs, visited, doubly_visited, G);
-
-    vector_delete(live_vals_copy);
-  }
+  vector_delete(reg_operands);
 }
 
-/// For each exit block `b` in given function, collect interferences
-/// from exit to entrance. While doing so, the AdjacencyGraph G (the
-/// matrix and regmasks, specifically) is updated to reflect interferences.
-///
-/// "exit block": a block that ends with an instruction that exits the
-/// function (i.e. return or unreachable).
+/// Compute liveness for the given function and collect the
+/// interferences of each block. While doing so, the AdjacencyGraph G
+/// (the matrix, specifically) is updated to reflect interferences.
 static void collect_interferences_for_function
 (const MachineDescription *desc,
  MIRFunction *function,
- VRegVector *vregs,
+ RegisterNumbering *vregs,
  AdjacencyGraph *G
  )
 {
-  // Collect all blocks that exit from the function.
-  MIRBlockVector exits = {0};
-  foreach_val (b, function->blocks) {
-    if (b->is_exit) vector_push(exits, b);
-  }
-
-  DBGASSERT(exits.size, "Function \"%S\" has no exit blocks...", function->name);
-
-#ifdef DEBUG_RA
-  foreach_ptr (MIRBlock*, b, exits) {
-    print("Exit block:\n");
-    print_mir_block(b);
-  }
-#endif
-
-  VRegVector live_vals = {0};
-  MIRBlockVector visited = {0};
-  MIRBlockVector doubly_visited = {0};
+  Liveness liveness = compute_liveness(desc, function, vregs);
+  usz *live = calloc(liveness.words ? liveness.words : 1, sizeof(usz));
 
-  // From each exit block (collected above), follow control flow to the
-  // root of the function (entry block), or to a block already visited.
-  foreach_val (b, exits) {
-    vector_clear(live_vals);
-    vector_clear(visited);
-    vector_clear(doubly_visited);
-    collect_interferences_from_block(desc, b, &live_vals, vregs, &visited, &doubly_visited, G);
-  }
+  foreach_val (b, function->blocks)
+    collect_interferences_from_block(desc, b, &liveness, live, vregs, G);
 
-  vector_delete(doubly_visited);
-  vector_delete(visited);
-  vector_delete(live_vals);
-  vector_delete(exits);
+  free(live);
+  free_liveness(&liveness);
 }
 
 /// Build the adjacency graph for the given function.
-static void build_adjacency_graph(MIRFunction *f, const MachineDescription *desc, VRegVector *registers, AdjacencyGraph *G) {
+static void build_adjacency_graph(MIRFunction *f, const MachineDescription *desc, RegisterNumbering *registers, AdjacencyGraph *G) {
   ASSERT(f, "Can not build adjacency matrix of NULL MIR function.");
   ASSERT(registers, "Can not build adjacency matrix of NULL register list.");
-  ASSERT(registers, "Can not build adjacency matrix of NULL adjacency graph.");
+  ASSERT(G, "Can not build adjacency matrix of NULL adjacency graph.");
 
-  allocate_adjacency_graph(G, registers->size);
+  allocate_adjacency_graph(G, registers->regs.size);
 
   /*
   /// Build the dominator tree.
@@ -435,8 +650,8 @@ static void build_adjacency_graph(MIRFunction *f, const MachineDescription *desc
   */
 }
 
-void print_adjacency_matrix(AdjacencyMatrix m) {
-  for (usz y = 0; y < m.size; ++y) {
+void print_adjacency_matrix(AdjacencyMatrix *m) {
+  for (usz y = 0; y < m->size; ++y) {
     printf("%6zu|", y);
     for (usz x = 0; x < y; ++x) {
       bool adj = adjm(m, x, y);
@@ -445,7 +660,7 @@ void print_adjacency_matrix(AdjacencyMatrix m) {
     printf("\n");
   }
   printf("      |");
-  for (usz x = 0; x < m.size; ++x) {
+  for (usz x = 0; x < m->size; ++x) {
     printf("%4zu", x);
   }
   printf("\n\n");
@@ -467,6 +682,10 @@ typedef struct AdjacencyList {
 
   Vector(usz) adjacencies;
 
+  /// Registers that this register is copied to or from; colouring
+  /// prefers their colours so that the copies become no-ops.
+  Vector(usz) copy_hints;
+
   IRInstruction *instruction;
 
   VReg vreg; // vreg this adjacency list is for
@@ -486,12 +705,37 @@ typedef struct AdjacencyList {
   usz spill_cost;
 } AdjacencyList;
 
+static void free_adjacency_graph(AdjacencyGraph *G) {
+  foreach_val (list, G->lists) {
+    vector_delete(list->adjacencies);
+    vector_delete(list->copy_hints);
+    free(list);
+  }
+  vector_delete(G->lists);
+  adjm_free(&G->matrix);
+  free(G->regmasks);
+  free(G->live_lengths);
+  free(G->call_clobbers);
+}
+
+static void add_adjacency(AdjacencyGraph *G, usz A, usz B) {
+  AdjacencyList *a_list = G->lists.data[A];
+  AdjacencyList *b_list = G->lists.data[B];
+  vector_push(a_list->adjacencies, B);
+  vector_push(b_list->adjacencies, A);
+  a_list->degree++;
+  b_list->degree++;
+}
+
 void build_adjacency_lists(VRegVector *vregs, AdjacencyGraph *G) {
   /// Free old lists. This could be more efficient, but we’ve
   /// had bugs where we were trying to use out-of-date lists,
   /// so we’re keeping this for now.
   foreach_val (list, G->lists) {
-    if (list) vector_delete(list->adjacencies);
+    if (list) {
+      vector_delete(list->adjacencies);
+      vector_delete(list->copy_hints);
+    }
     free(list);
   }
   vector_delete(G->lists);
@@ -511,16 +755,25 @@ void build_adjacency_lists(VRegVector *vregs, AdjacencyGraph *G) {
     list->regmask = G->regmasks[i];
   }
 
-  foreach_index (A, *vregs) {
-    foreach_index (B, *vregs) {
-      if (A == B) { break; } /// (!)
-      if (adjm(G->matrix, A, B)) {
-        AdjacencyList *a_list = G->lists.data[A];
-        AdjacencyList *b_list = G->lists.data[B];
-        vector_push(a_list->adjacencies, B);
-        vector_push(b_list->adjacencies, A);
+  /// Walk the edges stored in the matrix; this is linear in the size
+  /// of the matrix rather than quadratic in the number of registers.
+  AdjacencyMatrix *m = &G->matrix;
+  if (m->bits) {
+    usz bit_count = adjm_bit_index(m->size, 0);
+    usz row = 1, row_start = 0;
+    for (usz w = 0; w * ADJM_BITS < bit_count; ++w) {
+      for (usz bits = m->bits[w]; bits; bits &= bits - 1) {
+        usz i = w * ADJM_BITS + (usz) __builtin_ctzll(bits);
+        while (i >= row_start + row) row_start += row++;
+        add_adjacency(G, row, i - row_start);
       }
     }
+  } else {
+    for (usz i = 0; i < m->edge_capacity; ++i) {
+      if (!m->edges[i]) continue;
+      u64 key = m->edges[i] - 1;
+      add_adjacency(G, (usz) (key >> 32), (usz) (key & 0xffffffff));
+    }
   }
 }
 
@@ -552,140 +805,198 @@ void print_adjacency_lists(AdjacencyLists *array) {
 
 //==== END ADJACENCY LISTS ====
 
-/// Determine whether an instruction interferes with a register.
-bool check_register_interference(usz regmask, IRInstruction *instruction) {
-  return (regmask & ((usz)1 << (ir_register(instruction) - 1))) != 0;
+//==== BEG COALESCING ====
+
+/// If the instruction copies a register into another register of the
+/// same size, return true and store its source and destination.
+static bool is_register_copy(const MachineDescription *desc, MIRInstruction *inst, MIROperandRegister **src, MIROperandRegister **dst) {
+  if (inst->opcode != desc->register_copy_opcode && inst->opcode != MPSEUDO_R2R) return false;
+  if (!mir_operand_kinds_match(inst, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) return false;
+  *src = &mir_get_op(inst, 0)->value.reg;
+  *dst = &mir_get_op(inst, 1)->value.reg;
+  return (*src)->size == (*dst)->size;
+}
+
+/// Return the register that the register at the given index has been
+/// merged into.
+static usz coalesced_index(usz *alias, usz idx) {
+  while (alias[idx] != idx) idx = alias[idx] = alias[alias[idx]];
+  return idx;
+}
+
+/// George test: a virtual register can be merged into a hardware
+/// register that it does not interfere with if each of its neighbours
+/// already interferes with the hardware register, is a hardware
+/// register itself, or has insignificant degree, since merging them can
+/// then never make the graph harder to colour.
+///
+/// Unlike the Briggs test, this does not need to look at the neighbours
+/// of the hardware register, which interferes with far too many values
+/// for that to ever succeed.
+static bool george_test(AdjacencyGraph *G, usz *alias, usz v, usz h, usz k) {
+  foreach (adj, G->lists.data[v]->adjacencies) {
+    usz t = coalesced_index(alias, *adj);
+    if (t == h || adjm(&G->matrix, t, h)) continue;
+    AdjacencyList *t_list = G->lists.data[t];
+    if (t_list->vreg.value >= MIR_ARCH_START && t_list->degree >= k) return false;
+  }
+  return true;
 }
 
-/*
 /// The aim of register coalescing is to eliminate register-to-register
 /// copies by merging the source and destination into a single value.
 ///
-/// Whether copy elimination is possible depends whether the values in
-/// question interfere, both with each other and with hardware registers.
-void coalesce(IRFunction *f, const MachineDescription *desc, IRInstructions *instructions, AdjacencyGraph *G) {
-  Vector(IRInstruction *) removed_instructions = {0};
-  Vector(IRInstruction *) phis = {0};
+/// Two virtual registers are merged only if they do not interfere and
+/// the merged register has fewer than k neighbours of significant
+/// degree (the Briggs test), since merging them can then never make
+/// the graph harder to colour. A virtual register is merged into a
+/// hardware register it is copied to or from if it passes the George
+/// test, does not need to avoid that register, and is not live across
+/// calls that clobber it. Copies that are not merged are recorded as
+/// colouring hints, so `color()` can give both registers the same
+/// colour if that colour is still free.
+///
+/// Merges update the adjacency matrix, so several merges can be made
+/// on one graph. Return true if any copies were eliminated, in which
+/// case the function has been rewritten and the graph is out of date.
+static bool coalesce(
+  MIRFunction *f,
+  const MachineDescription *desc,
+  RegisterNumbering *vregs,
+  AdjacencyGraph *G,
+  usz first_uncoalescable
+) {
+  usz k = desc->register_count;
+  usz *alias = malloc(G->lists.size * sizeof(usz));
+  usz *seen = calloc(G->lists.size, sizeof(usz));
+  foreach_index (i, G->lists) alias[i] = i;
+  usz stamp = 0;
+  bool coalesced = false;
 
-  for (;;) {
-    vector_clear(removed_instructions);
-    foreach_ptr (IRInstruction *, to, *instructions) {
-      if (to->kind != IR_COPY) { continue; }
-      IRInstruction *from = to->operand;
-
-      /// From and to are precoloured: eliminate the copy if they
-      /// are the same, replacing all uses of to w/ from.
-      if (from->result && from->result == to->result) {
-        DEBUG("From AND to are coloured the same.\n");
-        goto eliminate;
-      }
-
-      /// To is precoloured, from is not, and from does not interfere
-      /// with the precoloured register: assign the precoloured register to
-      /// from, replace all uses of to with from, and eliminate the copy.
-      if (to->result && !from->result && !adjm(G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[from->index], to)) {
-        from->result = to->result;
-        DEBUG("To is coloured, from is not, and from doesn't interfere.\n");
-        goto eliminate;
-      }
-
-      /// From is precoloured, to is not, and to nor any of it's uses
-      /// interfere with the precoloured register: assign the
-      /// precoloured register to any PHI nodes that use to if those
-      /// PHI nodes are uncoloured or precoloured with the same
-      /// register; if there are any PHI nodes that are precoloured with
-      /// a different register, then the copy cannot be eliminated.
-      /// Otherwise, replace all uses of to with from and eliminate the
-      /// copy.
-      // TODO: Lens_r added this without full confidence of whether or
-      // not it is actually correct. :)
-      bool to_use_from_interference = false;
-      foreach_ptr (IRInstruction *, user, to->users) {
-        if (user->result == to->result) {
-          to_use_from_interference = true;
-          break;
-        }
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      MIROperandRegister *src = NULL, *dst = NULL;
+      if (!is_register_copy(desc, inst, &src, &dst)) continue;
+      if (src->value < MIR_ARCH_START && dst->value < MIR_ARCH_START) continue;
+
+      usz a = coalesced_index(alias, vreg_index(vregs, src->value));
+      usz b = coalesced_index(alias, vreg_index(vregs, dst->value));
+      if (a == b) continue;
+      AdjacencyList *a_list = G->lists.data[a];
+      AdjacencyList *b_list = G->lists.data[b];
+
+      /// Registers introduced by spilling must stay short-lived.
+      bool mergeable = src->value < first_uncoalescable && dst->value < first_uncoalescable;
+
+      if (!mergeable) {
+        if (a_list->vreg.value >= MIR_ARCH_START) vector_push(a_list->copy_hints, b);
+        if (b_list->vreg.value >= MIR_ARCH_START) vector_push(b_list->copy_hints, a);
+        continue;
       }
 
-      if (!to_use_from_interference && !to->result && from->result && !adjm(G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[to->index], from)) {
-        /// Collect all PHI nodes that use to.
-        vector_clear(phis);
-        foreach_ptr (IRInstruction *, phi, *instructions) {
-          if (phi->kind != IR_PHI) { continue; }
-          foreach_ptr (IRPhiArgument *, arg, phi->phi_args) {
-            if (arg->value == to) {
-              /// If a PHI node that uses to is already precoloured with
-              /// a different register, then we need to keep the copy.
-              if (phi->result && phi->result != from->result) { goto keep_copy; }
-              vector_push(phis, phi);
-              break;
-            }
-          }
+      /// Merge a virtual register into a hardware register if that
+      /// passes the George test.
+      if (a_list->vreg.value < MIR_ARCH_START || b_list->vreg.value < MIR_ARCH_START) {
+        usz h = a_list->vreg.value < MIR_ARCH_START ? a : b;
+        usz v = h == a ? b : a;
+        AdjacencyList *v_list = G->lists.data[v];
+        AdjacencyList *h_list = G->lists.data[h];
+        Register r = (Register) h_list->vreg.value;
+        if (adjm(&G->matrix, v, h)
+            || v_list->regmask & (usz)1 << (r - 1)
+            || G->call_clobbers[v] & (usz)1 << r
+            || !george_test(G, alias, v, h, k)) {
+          vector_push(v_list->copy_hints, h);
+          continue;
         }
 
-        /// If we get here, then we know that all PHI node that use to
-        /// can be precoloured with the same register as from.
-        foreach_ptr (IRInstruction *, phi, phis) phi->result = from->result;
-        DEBUG("All PHI nodes that use `to` can be precouloured with the same register as from\n");
-        goto eliminate;
+        DEBUG("Coalescing %V into %V\n", (usz)v_list->vreg.value, (usz)h_list->vreg.value);
+        foreach (adj, v_list->adjacencies) {
+          usz t = coalesced_index(alias, *adj);
+          if (t == h || adjm(&G->matrix, h, t)) continue;
+          adjm_set(&G->matrix, h, t);
+          vector_push(h_list->adjacencies, t);
+        }
+        alias[v] = h;
+        coalesced = true;
+        continue;
       }
 
-      /// Neither from nor to are precoloured, and they do not interfere.
-      /// Replace all uses of to with from, and eliminate the copy.
-      //if (!to->result && !from->result && !adjm(G->matrix, to->index, from->index)) {
-      //  DEBUG("Neither from nor to are coloured, and no interference\n");
-      //  goto eliminate;
-      //}
-
-    /// Otherwise, keep the copy.
-    keep_copy:
-      continue;
-
-    /// Eliminate the copy.
-    eliminate:
-
-      DEBUG("Eliminating copy\n");
-      IR_FEMIT_INST(stdout, to);
-
-      /// First, replace all uses of to with from.
-      ir_replace_uses(to, from);
+      if (adjm(&G->matrix, a, b) || a_list->vreg.size != b_list->vreg.size) continue;
+
+      /// Briggs test: count the distinct neighbours of the merged
+      /// register that have significant degree.
+      usz significant = 0;
+      ++stamp;
+      AdjacencyList *pair[2] = {a_list, b_list};
+      for (usz p = 0; p < 2; ++p) {
+        foreach (adj, pair[p]->adjacencies) {
+          usz t = coalesced_index(alias, *adj);
+          if (t == a || t == b || seen[t] == stamp) continue;
+          seen[t] = stamp;
+          AdjacencyList *t_list = G->lists.data[t];
+          if (t_list->vreg.value < MIR_ARCH_START || t_list->degree >= k) significant++;
+        }
+      }
+      if (significant >= k) {
+        vector_push(a_list->copy_hints, b);
+        vector_push(b_list->copy_hints, a);
+        continue;
+      }
 
-      /// Yeet to.
-      vector_push(removed_instructions, to);
+      /// Merge the destination into the source.
+      DEBUG("Coalescing %V into %V\n", (usz)dst->value, (usz)src->value);
+      foreach (adj, b_list->adjacencies) {
+        usz t = coalesced_index(alias, *adj);
+        if (t == a || adjm(&G->matrix, a, t)) continue;
+        adjm_set(&G->matrix, a, t);
+        vector_push(a_list->adjacencies, t);
+        a_list->degree++;
+      }
+      a_list->regmask |= b_list->regmask;
+      G->regmasks[a] |= G->regmasks[b];
+      G->call_clobbers[a] |= G->call_clobbers[b];
+      alias[b] = a;
+      coalesced = true;
     }
+  }
 
-    /// Remove all instructions that were marked for removal.
-    foreach_ptr (IRInstruction *, instruction, removed_instructions) {
-      ir_remove(instruction);
-    }
+  /// Rename merged registers and delete the copies that are now copies
+  /// of a register to itself.
+  if (coalesced) {
+    foreach_val (bb, f->blocks) {
+      usz kept = 0;
+      foreach_val (inst, bb->instructions) {
+        if (inst->reg >= MIR_ARCH_START) {
+          usz idx = vreg_index(vregs, inst->reg);
+          if (idx != (usz) -1) inst->reg = (MIRRegister) vregs->regs.data[coalesced_index(alias, idx)].value;
+        }
 
-    /// Collect the remaining instructions.
-    if (removed_instructions.size) {
-      collect_instructions_into(f, instructions, 0);
+        FOREACH_MIR_OPERAND(inst, op) {
+          if (op->kind != MIR_OP_REGISTER || op->value.reg.value < MIR_ARCH_START) continue;
+          usz idx = coalesced_index(alias, vreg_index(vregs, op->value.reg.value));
+          op->value.reg.value = vregs->regs.data[idx].value;
+        }
 
-      /// TODO: Ideally, we don’t want to rebuild the entire matrix on every iteration.
-      build_adjacency_graph(f, desc, instructions, G);
-    } else {
-      break;
-    }
-  }
+        MIROperandRegister *src = NULL, *dst = NULL;
+        if (is_register_copy(desc, inst, &src, &dst) && src->value == dst->value) {
+          inst->block = NULL;
+          f->inst_count--;
+          continue;
+        }
 
-  // Find precoloured phis and attempt to apply the color to each of it's arguments.
-  foreach_ptr (IRInstruction *, precoloured_phi, *instructions) {
-    // Skip non-PHI instructions, PHIs with no arguments (no-op), or PHIs that have yet-to-be coloured.
-    if (precoloured_phi->kind != IR_PHI || !precoloured_phi->phi_args.size || !precoloured_phi->result) continue;
-    foreach_ptr (IRPhiArgument*, phi_arg, precoloured_phi->phi_args) {
-      if (phi_arg->value->result)
-        ICE("[RA]: It seems that a phi has had a copy removed that was necessary. TODO: warn but add it back.");
-      phi_arg->value->result = precoloured_phi->result;
+        bb->instructions.data[kept++] = inst;
+      }
+      bb->instructions.size = kept;
     }
   }
 
-  /// Cleanup.
-  vector_delete(removed_instructions);
-  vector_delete(phis);
+  free(alias);
+  free(seen);
+  return coalesced;
 }
-*/
+
+//==== END COALESCING ====
 
 typedef Vector(usz) NumberStack;
 
@@ -710,6 +1021,14 @@ void print_number_stack(NumberStack *stack) {
 #  define PRINT_NUMBER_STACK(stack)
 #endif
 
+/// Remove a node from the graph by pushing it onto the colouring
+/// stack; this lowers the degree of all of its neighbours.
+static void push_coloring_stack(NumberStack *stack, AdjacencyGraph *G, AdjacencyList *list) {
+  list->allocated = 1;
+  vector_push(*stack, list->index);
+  foreach (adj, list->adjacencies) G->lists.data[*adj]->degree--;
+}
+
 NumberStack build_coloring_stack(const MachineDescription *desc, AdjacencyGraph *G) {
   NumberStack stack = {0};
 
@@ -724,16 +1043,12 @@ NumberStack build_coloring_stack(const MachineDescription *desc, AdjacencyGraph
     bool done = true;
     do {
       done = true;
-      foreach_index(i, G->lists) {
-        AdjacencyList *list = G->lists.data[i];
+      foreach_val (list, G->lists) {
         if (list->vreg.value < MIR_ARCH_START || list->color || list->allocated) continue;
         if (list->degree < k) {
-          list->allocated = 1;
+          push_coloring_stack(&stack, G, list);
           done = false;
           count--;
-
-          /// Push onto color allocation stack.
-          vector_push(stack, i);
         }
       }
     } while (!done && count);
@@ -741,22 +1056,22 @@ NumberStack build_coloring_stack(const MachineDescription *desc, AdjacencyGraph
     if (count) {
       /// Determine node with minimal spill cost.
       usz min_cost = (usz) -1; /// (!)
-      usz node_to_spill = 0;
+      AdjacencyList *node_to_spill = NULL;
 
       foreach_val (list, G->lists) {
         if (list->vreg.value < MIR_ARCH_START || list->color || list->allocated) continue;
 
-        list->spill_cost = list->degree ? (list->spill_cost / list->degree) : 0;
-        if (list->degree && list->spill_cost <= min_cost) {
-          min_cost = list->spill_cost;
-          node_to_spill = list->index;
+        usz cost = list->degree ? (list->spill_cost / list->degree) : 0;
+        if (!node_to_spill || cost <= min_cost) {
+          min_cost = cost;
+          node_to_spill = list;
           if (!min_cost) break;
         }
       }
 
-      /// Push onto color allocation stack.
-      vector_push(stack, node_to_spill);
-      G->lists.data[node_to_spill]->allocated = 1;
+      /// Push onto color allocation stack. This node may still get
+      /// a colour if its neighbours end up sharing colours.
+      push_coloring_stack(&stack, G, node_to_spill);
       count--;
     }
   }
@@ -764,12 +1079,32 @@ NumberStack build_coloring_stack(const MachineDescription *desc, AdjacencyGraph
   return stack;
 }
 
+/// Pick the first register that is not in `used`, or 0 if there is
+/// none. Values that are live across calls prefer registers that those
+/// calls do not clobber (`call_clobbers`, indexed by register), since
+/// such registers need not be saved around the calls.
+static Register pick_register(const MachineDescription *desc, usz used, usz call_clobbers) {
+  if (call_clobbers) {
+    for (usz x = 0; x < desc->register_count; ++x) {
+      if (!(used & (usz)1 << x) && !(call_clobbers & (usz)1 << (x + 1)))
+        return (Register) (x + 1);
+    }
+  }
+
+  for (usz x = 0; x < desc->register_count; ++x) {
+    if (!(used & (usz)1 << x)) return (Register) (x + 1);
+  }
+
+  return 0;
+}
+
 static void color(
   const MachineDescription *desc,
   NumberStack *stack,
   AdjacencyGraph *g
 ) {
-  foreach (i, *stack) {
+  /// Nodes are coloured in the reverse order of their removal from the graph.
+  foreach_rev (i, *stack) {
     AdjacencyList *list = g->lists.data[*i];
     if (list->vreg.value < MIR_ARCH_START || list->color) continue;
 
@@ -782,15 +1117,24 @@ static void color(
       if (adjacent->color) register_interferences |= (usz)1 << (adjacent->color - 1);
     }
 
+    /// Prefer the colour of a register that this one is copied to or from.
     Register r = 0;
-    for (usz x = 0; x < desc->register_count; ++x) {
-      if (!(register_interferences & (usz)1 << x)) {
-        r = (Register) (x + 1);
+    foreach (hint, list->copy_hints) {
+      Register c = g->lists.data[*hint]->color;
+      if (c && c <= desc->register_count && !(register_interferences & (usz)1 << (c - 1))) {
+        r = c;
         break;
       }
     }
 
-    if (!r) TODO("Can not color graph with %zu colors until stack spilling is implemented!", desc->register_count);
+    if (!r) r = pick_register(desc, register_interferences, g->call_clobbers[list->index]);
+
+    /// If there is no register left, this node has to be spilled.
+    if (!r) {
+      DEBUG("Could not color %V; marking it for spilling\n", (usz)list->vreg.value);
+      list->spill_flag = 1;
+      continue;
+    }
     list->color = r;
   }
 
@@ -817,6 +1161,281 @@ static void color(
    */
 }
 
+//==== BEG SPILLING ====
+
+usz register_allocation_spill_count = 0;
+usz register_allocation_reload_count = 0;
+
+/// Spill cost of registers that must not be spilled.
+#define SPILL_COST_INFINITE ((usz) -1)
+
+/// Maximum loop depth that is taken into account when computing
+/// spill costs; this keeps the cost from overflowing.
+#define SPILL_COST_MAX_LOOP_DEPTH 5
+
+/// Compute how deeply each block of the function is nested in loops.
+///
+/// A loop is identified by a back edge, i.e. an edge to a block that
+/// does not come after its source in reverse postorder. The body
+/// of the loop is every block from which the source of a back edge can
+/// be reached without passing through the loop header.
+static usz *compute_loop_depths(MIRFunction *f) {
+  usz count = f->blocks.size;
+  usz *depths = calloc(count ? count : 1, sizeof(usz));
+  bool *is_header = calloc(count ? count : 1, sizeof(bool));
+  Vector(MIRBlock *) latches = {0};
+  Vector(MIRBlock *) headers = {0};
+
+  /// Find the back edges; unreachable blocks are not part of any loop.
+  MIRBlockVector rpo = mir_blocks_reverse_postorder(f);
+  usz *rpo_index = malloc((count ? count : 1) * sizeof(usz));
+  for (usz i = 0; i < count; ++i) rpo_index[i] = (usz) -1;
+  foreach_index (i, rpo) rpo_index[rpo.data[i]->id] = i;
+  foreach_val (b, rpo) {
+    foreach_val (succ, b->successors) {
+      if (rpo_index[succ->id] > rpo_index[b->id]) continue;
+      vector_push(latches, b);
+      vector_push(headers, succ);
+      is_header[succ->id] = true;
+    }
+  }
+
+  /// Collect the body of each loop, merging loops that share a header.
+  u8 *in_body = calloc(count ? count : 1, 1);
+  Vector(MIRBlock *) worklist = {0};
+  foreach_val (header, f->blocks) {
+    if (!is_header[header->id]) continue;
+    memset(in_body, 0, count);
+    vector_clear(worklist);
+    in_body[header->id] = 1;
+    depths[header->id]++;
+    foreach_index (i, headers) {
+      if (headers.data[i] != header || in_body[latches.data[i]->id]) continue;
+      in_body[latches.data[i]->id] = 1;
+      vector_push(worklist, latches.data[i]);
+    }
+
+    while (worklist.size) {
+      MIRBlock *b = vector_pop(worklist);
+      depths[b->id]++;
+      foreach_val (pred, b->predecessors) {
+        if (in_body[pred->id]) continue;
+        in_body[pred->id] = 1;
+        vector_push(worklist, pred);
+      }
+    }
+  }
+
+  vector_delete(worklist);
+  vector_delete(rpo);
+  vector_delete(latches);
+  vector_delete(headers);
+  free(in_body);
+  free(is_header);
+  free(rpo_index);
+  return depths;
+}
+
+/// Compute the spill cost of every virtual register.
+///
+/// The cost is the number of times the register is referenced, with
+/// each reference weighted by 8^(loop depth), divided by the number of
+/// instructions across which the register is live. Registers that are
+/// referenced often within a short range are thus expensive to spill,
+/// while those that are live across many instructions without being
+/// referenced much are cheap.
+static void compute_spill_costs(
+  MIRFunction *f,
+  RegisterNumbering *vregs,
+  AdjacencyGraph *G,
+  usz *loop_depths,
+  usz first_unspillable
+) {
+  foreach_val (bb, f->blocks) {
+    usz depth = loop_depths[bb->id];
+    if (depth > SPILL_COST_MAX_LOOP_DEPTH) depth = SPILL_COST_MAX_LOOP_DEPTH;
+    usz weight = (usz) 1 << (3 * depth);
+    foreach_val (inst, bb->instructions) {
+      usz result = result_vreg_index(vregs, inst);
+      if (result != (usz) -1) G->lists.data[result]->spill_cost += weight;
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind != MIR_OP_REGISTER || op->value.reg.value < MIR_ARCH_START) continue;
+        G->lists.data[vreg_index(vregs, op->value.reg.value)]->spill_cost += weight;
+      }
+    }
+  }
+
+  foreach_val (list, G->lists) {
+    if (list->vreg.value < MIR_ARCH_START) continue;
+
+    /// Registers introduced by spilling are only live across a single
+    /// instruction; spilling them again would not help.
+    if (list->vreg.value >= first_unspillable) {
+      list->spill_cost = SPILL_COST_INFINITE;
+      continue;
+    }
+
+    list->spill_cost = list->spill_cost * 16 / (G->live_lengths[list->index] + 1);
+  }
+}
+
+/// Determine which registers to spill after a colouring attempt. This
+/// is every register that could not be coloured, unless it is not
+/// spillable, in which case its cheapest spillable neighbour is spilled
+/// instead to make room for it.
+static VRegVector select_spills(AdjacencyGraph *G, const MachineDescription *desc) {
+  VRegVector spills = {0};
+  foreach_val (list, G->lists) {
+    if (!list->spill_flag) continue;
+
+    AdjacencyList *to_spill = list;
+    if (list->spill_cost == SPILL_COST_INFINITE) {
+      to_spill = NULL;
+      foreach (adj, list->adjacencies) {
+        AdjacencyList *adjacent = G->lists.data[*adj];
+        if (adjacent->vreg.value < MIR_ARCH_START || adjacent->spill_cost == SPILL_COST_INFINITE) continue;
+        if (!to_spill || adjacent->spill_cost < to_spill->spill_cost) to_spill = adjacent;
+      }
+
+      if (!to_spill) ICE("Can not color graph with %zu colors: no register left to spill", desc->register_count);
+    }
+
+    if (to_spill->spill_flag == 2) continue;
+    to_spill->spill_flag = 2;
+    vector_push(spills, to_spill->vreg);
+  }
+  return spills;
+}
+
+/// Spill a virtual register to a new stack slot.
+///
+/// Every instruction that references the register is rewritten to use
+/// a fresh virtual register instead, which is reloaded from the slot
+/// before the instruction if the instruction reads it, and stored back
+/// to the slot after the instruction, since it may write it.
+static void spill_register(MIRFunction *f, VReg vreg, usz *next_vreg) {
+  u16 size = vreg.size ? (u16) vreg.size : 8;
+  MIROperand slot = mir_op_local_ref(f, 8);
+  f->locals_total_size += 8;
+
+  foreach_val (bb, f->blocks) {
+    for (usz i = 0; i < bb->instructions.size; ++i) {
+      MIRInstruction *inst = bb->instructions.data[i];
+
+      bool referenced = inst->reg == vreg.value;
+      bool read = false;
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind != MIR_OP_REGISTER || op->value.reg.value != vreg.value) continue;
+        referenced = true;
+        if (!op->value.reg.defining_use) read = true;
+      }
+      if (!referenced) continue;
+
+      MIRRegister temp = (MIRRegister) (*next_vreg)++;
+      if (inst->reg == vreg.value) inst->reg = temp;
+      FOREACH_MIR_OPERAND(inst, operand) {
+        if (operand->kind != MIR_OP_REGISTER || operand->value.reg.value != vreg.value) continue;
+        operand->value.reg.value = temp;
+      }
+
+      if (read) {
+        MIRInstruction *unspill = mir_makenew(MPSEUDO_UNSPILL_REG);
+        mir_add_op(unspill, slot);
+        mir_add_op(unspill, mir_op_register(temp, size, true));
+        mir_insert_instruction_with_reg(bb, unspill, i++, temp);
+        register_allocation_reload_count++;
+      }
+
+      /// Nothing can follow the terminator of a block; terminators
+      /// do not write registers anyway.
+      if (i + 1 == bb->instructions.size) continue;
+
+      MIRInstruction *spill = mir_makenew(MPSEUDO_SPILL_REG);
+      mir_add_op(spill, mir_op_register(temp, size, false));
+      mir_add_op(spill, slot);
+      mir_insert_instruction_with_reg(bb, spill, ++i, temp);
+      register_allocation_spill_count++;
+    }
+  }
+}
+
+//==== END SPILLING ====
+
+/// Replace every virtual register in the function with its colour, in
+/// a single pass over all instructions. `colors` is indexed by register
+/// number.
+static void rewrite_registers(MIRFunction *f, RegisterNumbering *vregs, Register *colors) {
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      if (inst->reg >= MIR_ARCH_START) {
+        usz idx = vreg_index(vregs, inst->reg);
+        if (idx != (usz) -1) inst->reg = colors[idx];
+      }
+
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind != MIR_OP_REGISTER || op->value.reg.value < MIR_ARCH_START) continue;
+        usz idx = vreg_index(vregs, op->value.reg.value);
+        op->value.reg.value = colors[idx];
+        op->value.reg.size = (uint16_t) vregs->regs.data[idx].size;
+      }
+    }
+  }
+
+#ifdef DEBUG_RA
+  foreach_index (i, vregs->regs) {
+    if (vregs->regs.data[i].value < MIR_ARCH_START) continue;
+    DEBUG("Vreg %V mapped to HWreg %V\n", (usz)vregs->regs.data[i].value, (usz)colors[i]);
+  }
+#endif
+}
+
+/// Compute the registers live across each call once all registers are
+/// allocated, and store those that the call may clobber in the call's
+/// `save_across` mask, so that the backend only saves those around it.
+///
+/// This is a backward dataflow over bitmasks of hardware registers.
+/// Operands marked as defining uses and the destinations of copies
+/// are definitions; all other register operands are treated as uses,
+/// which errs on the side of saving too much.
+static void record_registers_saved_across_calls(MIRFunction *f, const MachineDescription *desc) {
+  usz *live_ins = calloc(f->blocks.size ? f->blocks.size : 1, sizeof(usz));
+  foreach_index (i, f->blocks) f->blocks.data[i]->id = i;
+
+  bool changed;
+  do {
+    changed = false;
+    foreach_ptr_rev (b, f->blocks) {
+      usz live = 0;
+      foreach_val (succ, b->successors) live |= live_ins[succ->id];
+
+      foreach_ptr_rev (inst, b->instructions) {
+        MIROperandRegister *src = NULL, *dst = NULL;
+        bool copy = is_register_copy(desc, inst, &src, &dst);
+
+        usz defs = 0, uses = 0;
+        if (inst->opcode == MIR_CALL && inst->reg < MIR_ARCH_START) defs |= (usz)1 << inst->reg;
+        FOREACH_MIR_OPERAND(inst, op) {
+          if (op->kind != MIR_OP_REGISTER || op->value.reg.value >= MIR_ARCH_START) continue;
+          usz bit = (usz)1 << op->value.reg.value;
+          if (op->value.reg.defining_use || (copy && &op->value.reg == dst)) defs |= bit;
+          else uses |= bit;
+        }
+
+        live &= ~defs;
+        if (inst->opcode == MIR_CALL) inst->save_across = live & call_clobbers(desc, inst);
+        live |= uses;
+      }
+
+      if (live != live_ins[b->id]) {
+        live_ins[b->id] = live;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  free(live_ins);
+}
+
 // Keep track of what registers are used in each function.
 void track_registers(MIRFunction *f) {
   ASSERT(f->origin, "MIRFunction origin required to be set in order for shoddy register tracking");
@@ -834,127 +1453,340 @@ void track_registers(MIRFunction *f) {
   ir_func_regs_in_use(f->origin, regs_in_use);
 }
 
-void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
-  ASSERT(f, "Invalid argument");
-  ASSERT(desc, "Invalid argument");
+//==== BEG LINEAR SCAN ====
 
-  if (f->blocks.size == 0 || f->inst_count == 0 || (f->origin && !ir_func_is_definition(f->origin))) return;
-
-#ifdef DEBUG_RA
-  fprintf(stdout, "======================= MIR RA =======================\n");
-  //debug_context = f->origin->context;
-  print_mir_function(f);
-#endif
+/// The positions at which a virtual register is live, in terms of a
+/// numbering of all instructions in block order. Instruction n reads
+/// its operands at position 2n and writes its results at 2n+1.
+///
+/// An interval spans from the first to the last position at which the
+/// register is live and ignores any holes in between, so intervals
+/// overlap whenever the registers interfere, and sometimes when they
+/// do not.
+typedef struct LiveInterval {
+  /// Index of the register in the register numbering.
+  usz index;
+  usz start;
+  usz end;
+} LiveInterval;
+typedef Vector(LiveInterval) LiveIntervals;
+
+static int compare_live_intervals(const void *a, const void *b) {
+  const LiveInterval *x = a, *y = b;
+  if (x->start != y->start) return x->start < y->start ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
 
-  // TODO: Virtual register renaming step: start renumbering virtual registers at the number of available hardware registers.
+static void extend_live_range(usz *starts, usz *ends, usz idx, usz pos) {
+  if (pos < starts[idx]) starts[idx] = pos;
+  if (pos > ends[idx]) ends[idx] = pos;
+}
 
-  DEBUG("MTX\n");
-  MIR_PRINT(f);
+/// Build the live intervals of all virtual registers, sorted by start.
+///
+/// Hardware registers are not given intervals. Instead, `forbidden`
+/// receives, for each register, the mask of hardware registers it must
+/// not be assigned; the rules for this are the same as the ones for
+/// interferences with hardware registers in the interference graph.
+/// `call_clobbered` receives the registers clobbered by the calls that each
+/// register is live across.
+static LiveIntervals build_live_intervals(
+  const MachineDescription *desc,
+  MIRFunction *f,
+  RegisterNumbering *vregs,
+  usz *forbidden,
+  usz *call_clobbered
+) {
+  Liveness liveness = compute_liveness(desc, f, vregs);
+  usz *live = calloc(liveness.words ? liveness.words : 1, sizeof(usz));
+  usz *starts = malloc(vregs->regs.size * sizeof(usz));
+  usz *ends = calloc(vregs->regs.size, sizeof(usz));
+  memset(starts, 0xff, vregs->regs.size * sizeof(usz));
+
+  usz first = 0;
+  foreach_val (b, f->blocks) {
+    if (!b->instructions.size) continue;
+    usz last = first + b->instructions.size - 1;
+    foreach_live (idx, live_in(&liveness, b), liveness.words) extend_live_range(starts, ends, idx, 2 * first);
+    foreach_live (idx, live_out(&liveness, b), liveness.words) extend_live_range(starts, ends, idx, 2 * last + 1);
+
+    memcpy(live, live_out(&liveness, b), liveness.words * sizeof(usz));
+    usz n = last;
+    foreach_ptr_rev (inst, b->instructions) {
+      FOREACH_MIR_OPERAND(inst, def) {
+        usz idx = def_index(desc, vregs, inst, def);
+        if (idx == (usz) -1) continue;
+        extend_live_range(starts, ends, idx, 2 * n + 1);
+        live_set_remove(live, idx);
+      }
+      usz result = result_vreg_index(vregs, inst);
+      if (result != (usz) -1) {
+        extend_live_range(starts, ends, result, 2 * n + 1);
+        live_set_remove(live, result);
+      }
+      foreach_hardware_index (idx, vregs, implicit_defs(desc, inst)) live_set_remove(live, idx);
 
-  // List of all virtual registers that need coloured.
-  // TODO: List of all *registers* that need coloured.
-  VRegVector vregs = {0};
+      if (inst->opcode == MIR_CALL) {
+        usz clobbers = call_clobbers(desc, inst);
+        foreach_live (idx, live, liveness.words) call_clobbered[idx] |= clobbers;
+      }
 
-  // Populate list of registers, first using hardware registers, then using virtual registers.
-  for (usz i = 0; i < desc->register_count; ++i) {
-    VReg r = {0};
-    r.value = desc->registers[i];
-    vector_push(vregs, r);
-  }
-  foreach_val (bb, f->blocks) {
-    foreach_val (inst, bb->instructions) {
+      /// Hardware register operands interfere with all values that are
+      /// live across this instruction. Clobbers and hardware registers
+      /// that are live across it interfere with those values as well as
+      /// with all register operands.
+      usz hardware = 0;
+      usz clobbered = 0;
       FOREACH_MIR_OPERAND(inst, op) {
-        if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START) {
-          // Only push if vector does not already contain the value.
-          if (!vreg_vector_contains(&vregs, op->value.reg.value)) {
-            VReg v  = {0};
-            v.value = op->value.reg.value;
-            v.size = op->value.reg.size;
-            vector_push(vregs, v);
-          }
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value < MIR_ARCH_START && vreg_index(vregs, op->value.reg.value) != (usz) -1)
+          hardware |= (usz) 1 << (op->value.reg.value - 1);
+      }
+      foreach (clobber, inst->clobbers) clobbered |= (usz) 1 << (clobber->value - 1);
+      foreach_live (idx, live, liveness.words) {
+        usz live_value = vregs->regs.data[idx].value;
+        if (live_value < MIR_ARCH_START) clobbered |= (usz) 1 << (live_value - 1);
+      }
+
+      usz self = inst->reg >= MIR_ARCH_START ? vreg_index(vregs, inst->reg) : (usz) -1;
+      if (hardware | clobbered) {
+        foreach_live (idx, live, liveness.words) {
+          forbidden[idx] |= clobbered;
+          if (idx != self) forbidden[idx] |= hardware;
+        }
+      }
+      if (clobbered) {
+        FOREACH_MIR_OPERAND(inst, operand) {
+          if (operand->kind == MIR_OP_REGISTER && operand->value.reg.value >= MIR_ARCH_START)
+            forbidden[vreg_index(vregs, operand->value.reg.value)] |= clobbered;
         }
+        if (result != (usz) -1) forbidden[result] |= clobbered;
       }
+
+      FOREACH_MIR_OPERAND(inst, use) {
+        usz idx = use_index(desc, vregs, inst, use);
+        if (idx == (usz) -1) continue;
+        extend_live_range(starts, ends, idx, 2 * n);
+        live_set_add(live, idx);
+      }
+      n--;
     }
+
+    first = last + 1;
   }
 
-  AdjacencyGraph G = {0};
-  G.order = desc->register_count;
-  build_adjacency_graph(f, desc, &vregs, &G);
-  PRINT_ADJACENCY_MATRIX(G.matrix);
+  LiveIntervals intervals = {0};
+  foreach_index (i, vregs->regs) {
+    if (vregs->regs.data[i].value < MIR_ARCH_START || starts[i] == (usz) -1) continue;
+    LiveInterval interval = {i, starts[i], ends[i]};
+    vector_push(intervals, interval);
+  }
+  if (intervals.size) qsort(intervals.data, intervals.size, sizeof(LiveInterval), compare_live_intervals);
 
-  build_adjacency_lists(&vregs, &G);
-  PRINT_ADJACENCY_LISTS(&G.lists);
+  free(starts);
+  free(ends);
+  free(live);
+  free_liveness(&liveness);
+  return intervals;
+}
 
-  /*
-  DEBUG("Before Coalescing\n");
-  MIR_PRINT(f);
+/// Assign registers to live intervals in order of their start. When no
+/// register is free, the interval that ends last is spilled, which is
+/// either the current interval or one that holds a register it could
+/// use. Return the registers to spill; if there are none, `colors`
+/// holds the register of every interval.
+static VRegVector linear_scan(
+  const MachineDescription *desc,
+  RegisterNumbering *vregs,
+  LiveIntervals *intervals,
+  usz *forbidden,
+  usz *call_clobbered,
+  Register *colors,
+  usz first_unspillable
+) {
+  VRegVector spills = {0};
+  Vector(LiveInterval*) active = {0};
 
-  //coalesce(f, desc, &instructions, &G);
+  foreach (cur, *intervals) {
+    /// Free the registers of intervals that have ended.
+    usz kept = 0;
+    foreach_val (a, active) if (a->end >= cur->start) active.data[kept++] = a;
+    active.size = kept;
 
-  DEBUG("After Coalescing\n");
-  MIR_PRINT(f);
+    usz used = forbidden[cur->index];
+    foreach_val (a, active) used |= (usz) 1 << (colors[a->index] - 1);
 
-  collect_instructions_into(f, &instructions, 1);
-  build_adjacency_graph(f, desc, &instructions, &G);
-  build_adjacency_lists(&instructions, &G);
+    colors[cur->index] = pick_register(desc, used, call_clobbered[cur->index]);
+    if (colors[cur->index]) {
+      vector_push(active, cur);
+      continue;
+    }
 
-  DEBUG("After Rebuild\n");
-  MIR_PRINT(f);
-  PRINT_ADJACENCY_MATRIX(G.matrix);
-  PRINT_ADJACENCY_LISTS(&G.lists);
-  */
+    /// Find the active interval that ends last and whose register the
+    /// current interval could use instead.
+    usz victim_pos = (usz) -1;
+    foreach_index (i, active) {
+      LiveInterval *a = active.data[i];
+      if (forbidden[cur->index] & (usz) 1 << (colors[a->index] - 1)) continue;
+      if (vregs->regs.data[a->index].value >= first_unspillable) continue;
+      if (victim_pos == (usz) -1 || a->end > active.data[victim_pos]->end) victim_pos = i;
+    }
 
-  NumberStack stack = build_coloring_stack(desc, &G);
+    bool spillable = vregs->regs.data[cur->index].value < first_unspillable;
+    if (spillable && (victim_pos == (usz) -1 || cur->end >= active.data[victim_pos]->end)) {
+      vector_push(spills, vregs->regs.data[cur->index]);
+      continue;
+    }
 
-  DEBUG("After build color stack\n");
-  MIR_PRINT(f);
-  PRINT_ADJACENCY_MATRIX(G.matrix);
-  PRINT_ADJACENCY_LISTS(&G.lists);
-  PRINT_NUMBER_STACK(&stack);
+    if (victim_pos == (usz) -1) ICE("Can not allocate registers with %zu registers: no register left to spill", desc->register_count);
 
-  color(desc, &stack, &G);
+    LiveInterval *victim = active.data[victim_pos];
+    colors[cur->index] = colors[victim->index];
+    colors[victim->index] = 0;
+    vector_push(spills, vregs->regs.data[victim->index]);
+    active.data[victim_pos] = cur;
+  }
 
-  foreach_val (list, G.lists) {
-    VReg vreg = list->vreg;
-    if (vreg.value < MIR_ARCH_START) continue;
+  vector_delete(active);
+  return spills;
+}
 
-    Register color = list->color;
+/// Allocate registers by linear scan over live intervals. This is much
+/// faster than graph colouring, as it never builds the interference
+/// graph, but the code it produces is usually worse.
+static void allocate_registers_linear_scan(MIRFunction *f, const MachineDescription *desc) {
+  /// Virtual registers from this one onwards are introduced by spilling.
+  usz first_spill_temp = (usz) -1;
 
-    foreach_val (bb, f->blocks) {
-      foreach_val (inst, bb->instructions) {
-        if (inst->reg == vreg.value) inst->reg = color;
-        FOREACH_MIR_OPERAND(inst, op) {
-          if (op->kind == MIR_OP_REGISTER && op->value.reg.value == vreg.value) {
-            op->value.reg.value = color;
-            op->value.reg.size = (uint16_t)vreg.size;
-          }
-        }
+  for (;;) {
+    RegisterNumbering vregs = number_registers(f, desc);
+    usz *forbidden = calloc(vregs.regs.size, sizeof(usz));
+    usz *call_clobbered = calloc(vregs.regs.size, sizeof(usz));
+    Register *colors = calloc(vregs.regs.size, sizeof(Register));
+
+    LiveIntervals intervals = build_live_intervals(desc, f, &vregs, forbidden, call_clobbered);
+    VRegVector spills = linear_scan(desc, &vregs, &intervals, forbidden, call_clobbered, colors, first_spill_temp);
+
+    if (!spills.size) rewrite_registers(f, &vregs, colors);
+    else {
+      usz next_vreg = vregs.index_size;
+      if (first_spill_temp == (usz) -1) first_spill_temp = next_vreg;
+      foreach (vreg, spills) {
+        DEBUG("Spilling %V\n", (usz)vreg->value);
+        spill_register(f, *vreg, &next_vreg);
       }
     }
 
-    DEBUG("Vreg %V mapped to HWreg %V\n", (usz)vreg.value, (usz)color);
+    vector_delete(intervals);
+    free(forbidden);
+    free(call_clobbered);
+    free(colors);
+    free_register_numbering(&vregs);
+
+    bool done = !spills.size;
+    vector_delete(spills);
+    if (done) break;
   }
+}
 
-  DEBUG("After coloring\n");
+//==== END LINEAR SCAN ====
+
+static void allocate_registers_graph_colouring(MIRFunction *f, const MachineDescription *desc) {
+  DEBUG("MTX\n");
   MIR_PRINT(f);
-  PRINT_ADJACENCY_MATRIX(G.matrix);
-  PRINT_ADJACENCY_LISTS(&G.lists);
-  PRINT_NUMBER_STACK(&stack);
 
+  usz *loop_depths = compute_loop_depths(f);
+
+  /// Virtual registers from this one onwards are introduced by spilling.
+  usz first_spill_temp = (usz) -1;
+
+  /// Coalesce copies until no more copies can be eliminated, then
+  /// colour the graph; if that fails, spill and try again.
+  for (;;) {
+    // Number all registers that need coloured.
+    RegisterNumbering vregs = number_registers(f, desc);
+
+    AdjacencyGraph G = {0};
+    G.order = desc->register_count;
+    build_adjacency_graph(f, desc, &vregs, &G);
+    PRINT_ADJACENCY_MATRIX(&G.matrix);
+
+    build_adjacency_lists(&vregs.regs, &G);
+    PRINT_ADJACENCY_LISTS(&G.lists);
+
+    if (coalesce(f, desc, &vregs, &G, first_spill_temp)) {
+      DEBUG("After coalescing\n");
+      MIR_PRINT(f);
+      free_adjacency_graph(&G);
+      free_register_numbering(&vregs);
+      continue;
+    }
+
+    compute_spill_costs(f, &vregs, &G, loop_depths, first_spill_temp);
+
+    NumberStack stack = build_coloring_stack(desc, &G);
+
+    DEBUG("After build color stack\n");
+    MIR_PRINT(f);
+    PRINT_ADJACENCY_MATRIX(&G.matrix);
+    PRINT_ADJACENCY_LISTS(&G.lists);
+    PRINT_NUMBER_STACK(&stack);
+
+    color(desc, &stack, &G);
+
+    VRegVector spills = select_spills(&G, desc);
+    if (!spills.size) {
+      Register *colors = malloc(G.lists.size * sizeof(Register));
+      foreach_val (list, G.lists) colors[list->index] = list->color;
+      rewrite_registers(f, &vregs, colors);
+      free(colors);
+    } else {
+      usz next_vreg = vregs.index_size;
+      if (first_spill_temp == (usz) -1) first_spill_temp = next_vreg;
+      foreach (vreg, spills) {
+        DEBUG("Spilling %V\n", (usz)vreg->value);
+        spill_register(f, *vreg, &next_vreg);
+      }
+    }
+
+    DEBUG("After coloring\n");
+    MIR_PRINT(f);
+    PRINT_ADJACENCY_MATRIX(&G.matrix);
+    PRINT_ADJACENCY_LISTS(&G.lists);
+    PRINT_NUMBER_STACK(&stack);
+
+    /// Free allocated resources.
+    vector_delete(stack);
+    free_adjacency_graph(&G);
+    free_register_numbering(&vregs);
+
+    bool done = !spills.size;
+    vector_delete(spills);
+    if (done) break;
+  }
+
+  free(loop_depths);
+}
+
+void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
+  ASSERT(f, "Invalid argument");
+  ASSERT(desc, "Invalid argument");
+
+  if (f->blocks.size == 0 || f->inst_count == 0 || (f->origin && !ir_func_is_definition(f->origin))) return;
+
+#ifdef DEBUG_RA
+  fprintf(stdout, "======================= MIR RA =======================\n");
+  //debug_context = f->origin->context;
+  print_mir_function(f);
+#endif
+
+  bool linear_scan = register_allocator == RA_ALLOCATOR_LINEAR_SCAN
+    || (register_allocator == RA_ALLOCATOR_DEFAULT && !optimise);
+  if (linear_scan) allocate_registers_linear_scan(f, desc);
+  else allocate_registers_graph_colouring(f, desc);
+
+  record_registers_saved_across_calls(f, desc);
   track_registers(f);
 
   // TODO: Reenable this
   //if (optimise) codegen_optimise_blocks(f->context);
-
-  /// Free allocated resources.
-  foreach_val (list, G.lists) {
-    vector_delete(list->adjacencies);
-    free(list);
-  }
-  vector_delete(G.lists);
-  vector_delete(vregs);
-  vector_delete(stack);
-  free(G.matrix.data);
-  free(G.regmasks);
-  vector_delete(vregs);
 }
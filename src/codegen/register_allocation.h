@@ -14,9 +14,34 @@ typedef struct MachineDescription {
   // In which register every function result ends up.
   Register result_register;
 
+  // Opcode of the instruction that copies its first operand, a
+  // register, into its second operand, another register. Such copies
+  // are coalesced during register allocation.
+  uint32_t register_copy_opcode;
+
+  // Bitmask of the registers that are preserved across calls, indexed
+  // by register. Values that are live across a call prefer these.
+  size_t callee_saved_registers;
+
   size_t (*instruction_register_interference)(IRInstruction *instruction);
 } MachineDescription;
 
+typedef enum RegisterAllocator {
+  /// Linear scan, or graph colouring when optimising.
+  RA_ALLOCATOR_DEFAULT,
+  RA_ALLOCATOR_GRAPH_COLOURING,
+  RA_ALLOCATOR_LINEAR_SCAN,
+  RA_ALLOCATOR_COUNT
+} RegisterAllocator;
+
+/// Which register allocator to use; set on the command line.
+extern RegisterAllocator register_allocator;
+
+/// Number of spill and reload instructions inserted by the register
+/// allocator so far.
+extern usz register_allocation_spill_count;
+extern usz register_allocation_reload_count;
+
 /// Peform register allocation for a function.
 void allocate_registers(MIRFunction *f, const MachineDescription *desc);
 
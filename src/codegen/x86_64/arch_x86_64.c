@@ -4,6 +4,7 @@
 #include <codegen/instruction_selection.h>
 #include <codegen/machine_ir.h>
 #include <codegen/opt/opt.h>
+#include <codegen/peephole.h>
 #include <codegen/register_allocation.h>
 #include <codegen/x86_64/arch_x86_64.h>
 #include <codegen/x86_64/arch_x86_64_common.h>
@@ -114,7 +115,7 @@ typedef enum Clobbers {
 } Clobbers;
 
 Clobbers does_clobber(IRInstruction *instruction) {
-  STATIC_ASSERT(IR_COUNT == 40, "Exhaustive handling of IR instruction types that correspond to two-address instructions in x86_64.");
+  STATIC_ASSERT(IR_COUNT == 41, "Exhaustive handling of IR instruction types that correspond to two-address instructions in x86_64.");
   switch (ir_kind(instruction)) {
   case IR_ADD:
   case IR_DIV:
@@ -147,6 +148,16 @@ static usz emit_memcpy_impl(
   usz byte_size,
   IRInstruction *before
 ) {
+  /// Cast the pointers to the element type so the loads and stores
+  /// below are sized by the element rather than by whatever the
+  /// pointers point to. This is a copy rather than a bitcast since
+  /// we may already be past the point where bitcasts are lowered.
+  Type *ptr = ast_make_type_pointer(context->ast, (loc){0}, element_type);
+  *from = ir_insert_before(before, ir_create_copy(context, *from));
+  *to = ir_insert_before(before, ir_create_copy(context, *to));
+  ir_set_type(*from, ptr);
+  ir_set_type(*to, ptr);
+
   /// Increment that we’ll be adding to the pointers.
   usz iter_amount = type_sizeof(element_type);
   IRInstruction *increment = ir_create_immediate(context, t_integer, iter_amount);
@@ -956,13 +967,177 @@ static void mir_x86_64_function_exit_at(enum StackFrameKind frame_kind, MIRBlock
   }
 }
 
+/// ===========================================================================
+///  Peephole optimisation
+/// ===========================================================================
+/// These rules clean up after register allocation and its fixups; see
+/// `mir_peephole()`.
+
+/// Whether the flags set by instructions before the one at the given
+/// index may still be read. Flags are never live across blocks, since
+/// a conditional jump always directly follows the compare that sets
+/// the flags it reads.
+static bool x86_64_flags_live_at(MIRBlock *block, usz index) {
+  for (usz i = index; i < block->instructions.size; ++i) {
+    switch (block->instructions.data[i]->opcode) {
+    default: break;
+
+    case MX64_SETCC: FALLTHROUGH;
+    case MX64_CMOVCC: FALLTHROUGH;
+    case MX64_JCC: return true;
+
+    // Shifts are missing here on purpose: a shift by zero leaves the
+    // flags untouched.
+    case MX64_ADD: FALLTHROUGH;
+    case MX64_SUB: FALLTHROUGH;
+    case MX64_IMUL: FALLTHROUGH;
+    case MX64_DIV: FALLTHROUGH;
+    case MX64_IDIV: FALLTHROUGH;
+    case MX64_AND: FALLTHROUGH;
+    case MX64_OR: FALLTHROUGH;
+    case MX64_XOR: FALLTHROUGH;
+    case MX64_CMP: FALLTHROUGH;
+    case MX64_TEST: FALLTHROUGH;
+    case MX64_CALL: FALLTHROUGH;
+    case MX64_JMP: FALLTHROUGH;
+    case MX64_RET: return false;
+    }
+  }
+  return false;
+}
+
+static bool same_register(MIROperand *a, MIROperand *b) {
+  return a->value.reg.value == b->value.reg.value && a->value.reg.size == b->value.reg.size;
+}
+
+/// MOV(REG x, REG x) -> (removed)
+static bool peephole_remove_self_move(MIRBlock *block, usz index) {
+  MIRInstruction *instruction = block->instructions.data[index];
+  if (instruction->opcode != MX64_MOV) return false;
+  if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) return false;
+  if (!same_register(mir_get_op(instruction, 0), mir_get_op(instruction, 1))) return false;
+  mir_remove_instruction(instruction);
+  return true;
+}
+
+/// MOV(IMM 0, REG x) -> XOR(REG x, REG x), if the flags are dead.
+///
+/// Zeroing the 32-bit register zeroes all of it, and the encoding is
+/// shorter, so we always do that.
+static bool peephole_zero_idiom(MIRBlock *block, usz index) {
+  MIRInstruction *instruction = block->instructions.data[index];
+  if (instruction->opcode != MX64_MOV) return false;
+  if (!mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) return false;
+  if (mir_get_op(instruction, 0)->value.imm != 0) return false;
+  if (x86_64_flags_live_at(block, index + 1)) return false;
+
+  RegisterDescriptor reg = (RegisterDescriptor) mir_get_op(instruction, 1)->value.reg.value;
+  mir_op_clear(instruction);
+  instruction->opcode = MX64_XOR;
+  mir_add_op(instruction, mir_op_register(reg, r32, false));
+  mir_add_op(instruction, mir_op_register(reg, r32, false));
+  return true;
+}
+
+/// ADD/SUB(IMM a, REG x)
+/// ADD/SUB(IMM b, REG x)
+/// -> ADD(IMM a + b, REG x), or nothing if that is zero, if the flags
+/// are dead afterwards, because they would differ.
+static bool peephole_fold_add_chain(MIRBlock *block, usz index) {
+  if (index + 1 >= block->instructions.size) return false;
+  MIRInstruction *first = block->instructions.data[index];
+  MIRInstruction *second = block->instructions.data[index + 1];
+  if (first->opcode != MX64_ADD && first->opcode != MX64_SUB) return false;
+  if (second->opcode != MX64_ADD && second->opcode != MX64_SUB) return false;
+  if (!mir_operand_kinds_match(first, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) return false;
+  if (!mir_operand_kinds_match(second, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) return false;
+  if (!same_register(mir_get_op(first, 1), mir_get_op(second, 1))) return false;
+
+  // Immediates are sign-extended 32-bit values, so make sure the sum is
+  // still one of those.
+  int64_t a = mir_get_op(first, 0)->value.imm;
+  int64_t b = mir_get_op(second, 0)->value.imm;
+  if (a < INT32_MIN || a > INT32_MAX || b < INT32_MIN || b > INT32_MAX) return false;
+  if (first->opcode == MX64_SUB) a = -a;
+  if (second->opcode == MX64_SUB) b = -b;
+  int64_t sum = a + b;
+  if (sum < INT32_MIN || sum > INT32_MAX) return false;
+  if (x86_64_flags_live_at(block, index + 2)) return false;
+
+  mir_remove_instruction(second);
+  if (sum == 0) mir_remove_instruction(first);
+  else {
+    first->opcode = MX64_ADD;
+    mir_get_op(first, 0)->value.imm = sum;
+  }
+  return true;
+}
+
+/// MOV(REG x, LOCAL l)      MOV(IMM i, LOCAL l)
+/// MOV(LOCAL l, REG y)      MOV(LOCAL l, REG y)
+/// -> MOV(REG x, LOCAL l)   -> MOV(IMM i, LOCAL l)
+///    MOV(REG x, REG y)        MOV(IMM i, REG y)
+///
+/// The store is kept, as the local may be read again later on.
+static bool peephole_forward_store_to_load(MIRBlock *block, usz index) {
+  if (index + 1 >= block->instructions.size) return false;
+  MIRInstruction *store = block->instructions.data[index];
+  MIRInstruction *load = block->instructions.data[index + 1];
+  if (store->opcode != MX64_MOV || load->opcode != MX64_MOV) return false;
+  if (!mir_operand_kinds_match(load, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) return false;
+
+  MIROperand *local = mir_get_op(load, 0);
+  MIROperand *dst = mir_get_op(load, 1);
+  MIRFrameObject *fo = mir_get_frame_object(block->function, local->value.local_ref);
+  if (fo->size != dst->value.reg.size) return false;
+
+  if (mir_operand_kinds_match(store, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+    MIROperand *src = mir_get_op(store, 0);
+    if (mir_get_op(store, 1)->value.local_ref != local->value.local_ref) return false;
+    if (src->value.reg.size != dst->value.reg.size) return false;
+    *local = *src;
+    return true;
+  }
+
+  if (mir_operand_kinds_match(store, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+    if (mir_get_op(store, 1)->value.local_ref != local->value.local_ref) return false;
+
+    // A load zero-extends the value from memory, whereas an immediate
+    // move to a register may sign-extend it, so only forward immediates
+    // that are the same either way.
+    int64_t imm = mir_get_op(store, 0)->value.imm;
+    int64_t max = dst->value.reg.size >= r32 ? INT32_MAX : ((int64_t) 1 << (dst->value.reg.size * 8)) - 1;
+    if (imm < 0 || imm > max) return false;
+    *local = *mir_get_op(store, 0);
+    return true;
+  }
+
+  return false;
+}
+
+static MIRPeepholeRule x86_64_peephole_rules[] = {
+  { .name = "forward store to load", .apply = peephole_forward_store_to_load },
+  { .name = "remove self move", .apply = peephole_remove_self_move },
+  { .name = "fold add chain", .apply = peephole_fold_add_chain },
+  { .name = "zero idiom", .apply = peephole_zero_idiom },
+};
+
 void codegen_emit_x86_64(CodegenContext *context) {
+  size_t callee_saved = 0;
+  size_t caller_saved = 0;
+  for (usz i = 0; i < GENERAL_REGISTER_COUNT; ++i) {
+    if (is_callee_saved(general[i])) callee_saved |= (size_t)1 << general[i];
+    else caller_saved |= (size_t)1 << general[i];
+  }
+
   const MachineDescription desc = {
     .registers = general,
     .register_count = GENERAL_REGISTER_COUNT,
     .argument_registers = argument_registers,
     .argument_register_count = argument_register_count,
     .result_register = REG_RAX,
+    .register_copy_opcode = MX64_MOV,
+    .callee_saved_registers = callee_saved,
     .instruction_register_interference = interfering_regs
   };
 
@@ -1196,8 +1371,7 @@ void codegen_emit_x86_64(CodegenContext *context) {
 
   MIRFunctionVector machine_instructions_from_ir = mir_from_ir(context);
 
-  // TODO: Either embed x86_64 isel or somehow make this path knowable (i.e. via install).
-  ISelPatterns patterns =  isel_parse_file(ISEL_TABLE_LOCATION_X86_64);
+  ISelPatterns patterns = isel_x86_64_patterns();
 
   //isel_print_patterns(&patterns, mir_x86_64_opcode_mnemonic);
 
@@ -1345,22 +1519,26 @@ void codegen_emit_x86_64(CodegenContext *context) {
       print_mir_function_with_mnemonic(f, mir_x86_64_opcode_mnemonic);
   }
 
+  if (print_isel_stats) isel_print_stats(&patterns, mir_x86_64_opcode_mnemonic);
   isel_patterns_delete(&patterns);
 
   if (debug_ir)
     print("================ RA ================\n");
 
-  // RA -- Register Allocation
-  foreach_val (f, machine_instructions_from_ir) {
-    allocate_registers(f, &desc);
-  }
-
+  /// RA -- Register Allocation
   /// After RA, the last fixups before code emission are applied.
   /// Calculate stack offsets
   /// Lowering of MIR_CALL, among other things (caller-saved registers)
   /// Remove register to register moves when value and size are equal.
   /// Saving/restoration of callee-saved registers used in function.
-  foreach_val (function, machine_instructions_from_ir) {
+  /// Peephole optimisation of the result; see `x86_64_peephole_rules`.
+  ///
+  /// Functions are allocated and lowered callees first, so that the
+  /// registers each callee clobbers are known by the time its callers
+  /// are allocated, and calls only need to save those.
+  MIRFunctionVector bottom_up = mir_functions_bottom_up(machine_instructions_from_ir);
+  foreach_val (function, bottom_up) {
+    allocate_registers(function, &desc);
     if (!function->origin || !ir_func_is_definition(function->origin)) continue;
 
     // Calculate stack offsets of frame objects
@@ -1374,6 +1552,10 @@ void codegen_emit_x86_64(CodegenContext *context) {
 
     size_t func_regs = ir_func_regs_in_use(function->origin);
 
+    // Number of callee-saved registers pushed in the prologue; this
+    // matters for stack alignment at calls.
+    size_t callee_saved_pushed = 0;
+
     { // Save callee-saved registers used in this function
       MIRBlock *first_block = vector_front(function->blocks);
       for (Register r = 1; r < sizeof(func_regs) * 8; ++r) {
@@ -1382,6 +1564,7 @@ void codegen_emit_x86_64(CodegenContext *context) {
           MIRInstruction *push = mir_makenew(MX64_PUSH);
           mir_add_op(push, mir_op_register(r, r64, false));
           mir_insert_instruction(first_block, push, 0);
+          callee_saved_pushed++;
         }
       }
     }
@@ -1440,30 +1623,30 @@ void codegen_emit_x86_64(CodegenContext *context) {
             break;
           }
 
-          size_t regs_pushed_count = 0;
+          size_t regs_pushed_count = callee_saved_pushed;
+
+          // Only caller-saved registers that hold values which are live
+          // across this call need to be saved; see register allocation.
+          usz live_regs = instruction->save_across;
 
           // Save return register if it is not the result of this
           // function call already; if it is, the RA has already asserted
           // that RAX can be clobbered by this instruction.
-          // TODO: Determine a better way to figure out if we actually
-          // need to save the result register over this call boundary.
-          if (instruction->reg < MIR_ARCH_START && instruction->reg != desc.result_register && func_regs & (1 << desc.result_register)) {
+          if (instruction->reg < MIR_ARCH_START && instruction->reg != desc.result_register && live_regs & (1 << desc.result_register)) {
             MIRInstruction *push = mir_makenew(MX64_PUSH);
             mir_add_op(push, mir_op_register(desc.result_register, r64, false));
             mir_insert_instruction(instruction->block, push, i++);
             regs_pushed_count++;
           }
 
-          // Count caller-saved registers used in function, excluding result register (counted above).
-          size_t x = func_regs;
-          for (size_t r = REG_RAX + 1; r < sizeof(x) * 8; ++r)
-            if (x & ((usz)1 << r) && is_caller_saved((MIRRegister)r))
+          // Count caller-saved registers live across the call, excluding result register (counted above).
+          for (size_t r = REG_RAX + 1; r < sizeof(live_regs) * 8; ++r)
+            if (live_regs & ((usz)1 << r) && is_caller_saved((MIRRegister)r))
               regs_pushed_count++;
 
           // Push caller saved registers
-          // TODO: Don't push registers that are used for arguments.
-          for (Register r = REG_RAX + 1; r < sizeof(func_regs) * 8; ++r) {
-            if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
+          for (Register r = REG_RAX + 1; r < sizeof(live_regs) * 8; ++r) {
+            if (live_regs & ((usz)1 << r) && is_caller_saved(r)) {
               MIRInstruction *push = mir_makenew(MX64_PUSH);
               mir_add_op(push, mir_op_register(r, r64, false));
               mir_insert_instruction(instruction->block, push, i++);
@@ -1574,9 +1757,9 @@ void codegen_emit_x86_64(CodegenContext *context) {
             mir_insert_instruction(instruction->block, add, i++);
           }
 
-          // Restore caller saved registers used in called function.
-          for (Register r = sizeof(func_regs) * 8 - 1; r > REG_RAX; --r) {
-            if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
+          // Restore caller saved registers live across the call.
+          for (Register r = sizeof(live_regs) * 8 - 1; r > REG_RAX; --r) {
+            if (live_regs & ((usz)1 << r) && is_caller_saved(r)) {
               MIRInstruction *pop = mir_makenew(MX64_POP);
               mir_add_op(pop, mir_op_register(r, r64, false));
               mir_insert_instruction(instruction->block, pop, i++);
@@ -1593,7 +1776,7 @@ void codegen_emit_x86_64(CodegenContext *context) {
             mir_insert_instruction(instruction->block, move, i++);
 
             // Restore return register.
-            if (func_regs & (1 << desc.result_register)) {
+            if (live_regs & (1 << desc.result_register)) {
               MIRInstruction *pop = mir_makenew(MX64_POP);
               mir_add_op(pop, mir_op_register(desc.result_register, r64, false));
               mir_insert_instruction(instruction->block, pop, i++);
@@ -1617,6 +1800,13 @@ void codegen_emit_x86_64(CodegenContext *context) {
           }
         } break; // case MX64_MOVZX
 
+        // Spill slots are plain frame objects, so spilling and
+        // reloading is just a move to or from the stack.
+        case MPSEUDO_SPILL_REG: FALLTHROUGH;
+        case MPSEUDO_UNSPILL_REG: {
+          instruction->opcode = MX64_MOV;
+        } break;
+
         case MPSEUDO_R2R: {
           if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER))
             ICE("MPSEUDO_R2R instruction does not have two register operands.");
@@ -1679,8 +1869,46 @@ void codegen_emit_x86_64(CodegenContext *context) {
 
     } // foreach (MIRBlock*)
 
+    mir_peephole(function, x86_64_peephole_rules, sizeof x86_64_peephole_rules / sizeof *x86_64_peephole_rules);
+
+    { // Record the registers that calling this function may clobber.
+      usz clobbers = (usz)1 << desc.result_register;
+      foreach_val (block, function->blocks) {
+        foreach_val (instruction, block->instructions) {
+          FOREACH_MIR_OPERAND(instruction, op) {
+            if (op->kind == MIR_OP_REGISTER && op->value.reg.value < MIR_ARCH_START)
+              clobbers |= (usz)1 << op->value.reg.value;
+          }
+          foreach (clobbered, instruction->clobbers)
+            clobbers |= (usz)1 << clobbered->value;
+
+          // Calls and tail calls clobber whatever the callee does; if
+          // we don't know that yet (recursion, external or indirect
+          // calls), assume the worst.
+          if (instruction->opcode != MX64_CALL && instruction->opcode != MX64_JMP) continue;
+          MIROperand *callee = mir_get_op(instruction, 0);
+          if (callee->kind == MIR_OP_FUNCTION) {
+            if (callee->value.function->clobbers_known) clobbers |= callee->value.function->clobbers;
+            else clobbers |= caller_saved;
+          } else if (instruction->opcode == MX64_CALL || callee->kind != MIR_OP_BLOCK) clobbers |= caller_saved;
+        }
+      }
+
+      function->clobbers = clobbers & caller_saved;
+      function->clobbers_known = true;
+    }
+
     if (debug_ir) print_mir_function_with_mnemonic(function, mir_x86_64_opcode_mnemonic);
   } // foreach (MIRFunction*)
+  vector_delete(bottom_up);
+
+  if (print_peephole_stats)
+    mir_peephole_print_stats(x86_64_peephole_rules, sizeof x86_64_peephole_rules / sizeof *x86_64_peephole_rules);
+
+  if (debug_ir) {
+    print("[RA]: %Z spills, %Z reloads\n",
+          register_allocation_spill_count, register_allocation_reload_count);
+  }
 
 
   // CODE EMISSION
@@ -166,9 +166,9 @@ StackFrameKind stack_frame_kind(MIRFunction *f) {
   /// Always emit a frame if we’re not optimising.
   if (!optimise) return FRAME_FULL;
 
-  /// Emit a frame if we have local variables.
-  /// FIXME: I don’t think we’re setting this anywhere?
-  if (f->locals_total_size) return FRAME_FULL;
+  /// Emit a frame if we have local variables; this includes spill
+  /// slots, which are frame objects too.
+  if (f->frame_objects.size) return FRAME_FULL;
 
   /// We need *some* sort of prologue if we don’t use the stack but
   /// still call other functions.
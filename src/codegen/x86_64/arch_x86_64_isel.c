@@ -9,8 +9,13 @@
 #include <ir/ir.h>
 #include <utils.h>
 
+/// Built-in patterns, generated from arch_x86_64.isel at build time.
+#ifdef X86_64_ISEL_TABLE
+#  include <arch_x86_64_isel_table.h>
+#endif
+
 const char *mir_x86_64_opcode_mnemonic(uint32_t opcode) {
-  STATIC_ASSERT(MX64_COUNT == 32, "Exhaustive handling of x86_64 opcodes (string conversion)");
+  STATIC_ASSERT(MX64_COUNT == 33, "Exhaustive handling of x86_64 opcodes (string conversion)");
   //ASSERT(opcode >= MIR_ARCH_START && opcode < MX64_END, "Opcode is not x86_64 opcode");
   switch ((MIROpcodex86_64)opcode) {
   case MX64_START: return "!start";
@@ -26,6 +31,7 @@ const char *mir_x86_64_opcode_mnemonic(uint32_t opcode) {
   case MX64_CDQ: return "cdq";
   case MX64_CQO: return "cqo";
   case MX64_SETCC: return "setcc";
+  case MX64_CMOVCC: return "cmovcc";
   case MX64_SAL: return "sal";
   case MX64_SAR: return "sar";
   case MX64_SHR: return "shr";
@@ -54,7 +60,7 @@ const char *mir_x86_64_opcode_mnemonic(uint32_t opcode) {
 
 static MIROpcodex86_64 gmir_binop_to_x64(MIROpcodeCommon opcode) {
   DBGASSERT(opcode < MIR_COUNT, "Argument is meant to be a general MIR instruction opcode.");
-  STATIC_ASSERT(MIR_COUNT == 39, "Exhaustive handling of binary operator machine instruction opcodes for x86_64 backend");
+  STATIC_ASSERT(MIR_COUNT == 40, "Exhaustive handling of binary operator machine instruction opcodes for x86_64 backend");
   switch (opcode) {
   case MIR_ADD: return MX64_ADD;
   case MIR_SUB: return MX64_SUB;
@@ -111,7 +117,7 @@ static void divmod(CodegenContext *context, IRInstruction *inst) {
 */
 
 static void emit_instruction(CodegenContext *context, IRInstruction *inst) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all IR instructions");
 
   if (annotate_code) {
     // TODO: Base comment syntax on dialect or smth.
@@ -406,3 +412,12 @@ void isel_x86_64_env(ISelEnvironment *env) {
   isel_env_add_integer(env, "JUMP_TYPE_PO", JUMP_TYPE_PO);
   isel_env_add_integer(env, "JUMP_TYPE_S", JUMP_TYPE_S);
 }
+
+ISelPatterns isel_x86_64_patterns(void) {
+  if (isel_patterns_filepath) return isel_parse_file(isel_patterns_filepath);
+#ifdef X86_64_ISEL_TABLE
+  return isel_patterns_from_table(&isel_table);
+#else
+  ICE("This build has no built-in x86_64 ISel patterns; use `--isel` to specify a pattern file");
+#endif
+}
@@ -2,6 +2,7 @@
 #define ARCH_X86_64_ISEL_H
 
 #include <codegen/codegen_forward.h>
+#include <codegen/instruction_selection.h>
 #include <codegen/register_allocation.h>
 #include <codegen/machine_ir.h>
 #include <codegen/x86_64/arch_x86_64_common.h>
@@ -23,6 +24,7 @@
   X(CDQ)                                         \
   X(CQO)                                         \
   X(SETCC)                                       \
+  X(CMOVCC)                                      \
   X(SAL)                                         \
   X(SAR)                                         \
   X(SHR)                                         \
@@ -63,4 +65,8 @@ typedef enum MIROpcodex86_64 {
 
 const char *mir_x86_64_opcode_mnemonic(uint32_t opcode);
 
+/// Return the x86_64 ISel patterns: the built-in ones, or those in
+/// `isel_patterns_filepath`, if set.
+ISelPatterns isel_x86_64_patterns(void);
+
 #endif /* ARCH_X86_64_ISEL_H */
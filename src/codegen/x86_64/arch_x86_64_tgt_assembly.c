@@ -20,7 +20,7 @@ static const char *setcc_suffixes_x86_64[COMPARE_COUNT] = {
 };
 
 static const char *instruction_mnemonic(CodegenContext *context, MIROpcodex86_64 instruction) {
-  STATIC_ASSERT(MX64_COUNT == 32, "ERROR: instruction_mnemonic() must exhaustively handle all instructions.");
+  STATIC_ASSERT(MX64_COUNT == 33, "ERROR: instruction_mnemonic() must exhaustively handle all instructions.");
   // x86_64 instructions that aren't different across syntaxes can go here!
   switch (instruction) {
   default: break;
@@ -52,6 +52,7 @@ static const char *instruction_mnemonic(CodegenContext *context, MIROpcodex86_64
   case MX64_XCHG: return "xchg";
   case MX64_LEA: return "lea";
   case MX64_SETCC: return "set";
+  case MX64_CMOVCC: return "cmov";
   case MX64_TEST: return "test";
   case MX64_JCC: return "j";
   }
@@ -205,6 +206,94 @@ static void femit_mem_to_reg(CodegenContext *context, MIROpcodex86_64 inst, Regi
   }
 }
 
+/// Write the memory operand `disp(base, index, scale)`.
+static void femit_sib_operand(CodegenContext *context, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp) {
+  const char *base_name = register_name(base);
+  const char *index_name = register_name(index);
+  switch (context->target) {
+    case TARGET_GNU_ASM_ATT:
+      if (disp)
+        fprint(context->code, "%D(%%%s,%%%s,%D)", disp, base_name, index_name, scale);
+      else
+        fprint(context->code, "(%%%s,%%%s,%D)", base_name, index_name, scale);
+      break;
+    case TARGET_GNU_ASM_INTEL:
+      if (disp)
+        fprint(context->code, "[%s + %s*%D + %D]", base_name, index_name, scale, disp);
+      else
+        fprint(context->code, "[%s + %s*%D]", base_name, index_name, scale);
+      break;
+    default: ICE("ERROR: femit_sib_operand(): Unsupported dialect %d", context->target);
+  }
+}
+
+static void femit_sib_to_reg(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp, RegisterDescriptor destination_register, RegSize size) {
+  const char *mnemonic = instruction_mnemonic(context, inst);
+  const char *destination = regname(destination_register, size);
+  switch (context->target) {
+    case TARGET_GNU_ASM_ATT:
+      fprint(context->code, "    %s ", mnemonic);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, ", %%%s\n", destination);
+      break;
+    case TARGET_GNU_ASM_INTEL:
+      fprint(context->code, "    %s %s, ", mnemonic, destination);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, "\n");
+      break;
+    default: ICE("ERROR: femit_sib_to_reg(): Unsupported dialect %d", context->target);
+  }
+}
+
+static void femit_reg_to_sib(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor source_register, RegSize size, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp) {
+  const char *mnemonic = instruction_mnemonic(context, inst);
+  const char *source = regname(source_register, size);
+  switch (context->target) {
+    case TARGET_GNU_ASM_ATT:
+      fprint(context->code, "    %s %%%s, ", mnemonic, source);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, "\n");
+      break;
+    case TARGET_GNU_ASM_INTEL:
+      fprint(context->code, "    %s ", mnemonic);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, ", %s\n", source);
+      break;
+    default: ICE("ERROR: femit_reg_to_sib(): Unsupported dialect %d", context->target);
+  }
+}
+
+static void femit_imm_to_sib(CodegenContext *context, MIROpcodex86_64 inst, int64_t immediate, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp, RegSize size) {
+  const char *mnemonic = instruction_mnemonic(context, inst);
+  switch (context->target) {
+    case TARGET_GNU_ASM_ATT: {
+      const char *mnemonic_suffix = "";
+      switch (size) {
+      case r8: mnemonic_suffix = "b"; break;
+      case r16: mnemonic_suffix = "w"; break;
+      case r32: mnemonic_suffix = "l"; break;
+      case r64: mnemonic_suffix = "q"; break;
+      }
+      fprint(context->code, "    %s%s $%D, ", mnemonic, mnemonic_suffix, immediate);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, "\n");
+    } break;
+    case TARGET_GNU_ASM_INTEL: {
+      const char *memory_size = "";
+      switch (size) {
+      case r8: memory_size = "BYTE PTR "; break;
+      case r16: memory_size = "WORD PTR "; break;
+      case r32: memory_size = "DWORD PTR "; break;
+      case r64: memory_size = "QWORD PTR "; break;
+      }
+      fprint(context->code, "    %s %s", mnemonic, memory_size);
+      femit_sib_operand(context, base, index, scale, disp);
+      fprint(context->code, ", %D\n", immediate);
+    } break;
+    default: ICE("ERROR: femit_imm_to_sib(): Unsupported dialect %d", context->target);
+  }
+}
+
 static void femit_name_to_reg(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor address_register, const char *name, RegisterDescriptor destination_register, enum RegSize size) {
   const char *mnemonic = instruction_mnemonic(context, inst);
   const char *address = register_name(address_register);
@@ -454,6 +543,33 @@ static void femit_setcc(CodegenContext *context, enum ComparisonType comparison_
 }
 
 
+/// There is no 8-bit cmov; we use the 32-bit form instead, which
+/// leaves the low byte of the destination as we want it.
+static void femit_cmovcc(
+  CodegenContext *context,
+  enum ComparisonType comparison_type,
+  RegisterDescriptor source_register,
+  RegisterDescriptor destination_register,
+  enum RegSize size
+) {
+  if (size == r8) size = r32;
+  const char *mnemonic = instruction_mnemonic(context, MX64_CMOVCC);
+  const char *source = regname(source_register, size);
+  const char *destination = regname(destination_register, size);
+  switch (context->target) {
+  case TARGET_GNU_ASM_ATT:
+    fprint(context->code, "    %s%s %%%s, %%%s\n",
+           mnemonic,
+           setcc_suffixes_x86_64[comparison_type], source, destination);
+    break;
+  case TARGET_GNU_ASM_INTEL:
+    fprint(context->code, "    %s%s %s, %s\n",
+           mnemonic,
+           setcc_suffixes_x86_64[comparison_type], destination, source);
+    break;
+  default: ICE("ERROR: femit_cmovcc(): Unsupported dialect %d", context->target);
+  }
+}
 
 static void femit_jcc(CodegenContext *context, IndirectJumpType type, const char *label) {
       const char *mnemonic = instruction_mnemonic(context, MX64_JCC);
@@ -622,6 +738,16 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
             if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
               femit_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
             femit_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
+          } else if (mir_operand_kinds_match(instruction, 5, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+            // address (SIB) to reg | base, index, scale, disp, dst
+            MIROperand *base = mir_get_op(instruction, 0);
+            MIROperand *index = mir_get_op(instruction, 1);
+            MIROperand *scale = mir_get_op(instruction, 2);
+            MIROperand *disp = mir_get_op(instruction, 3);
+            MIROperand *reg_dst = mir_get_op(instruction, 4);
+            // Addresses are always computed in 64 bits.
+            femit_sib_to_reg(context, MX64_LEA, base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm,
+                             reg_dst->value.reg.value, r64);
           } else {
             print("\n\nUNHANDLED INSTRUCTION:\n");
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
@@ -783,6 +909,35 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
             MIROperand *reg_dst = mir_get_op(instruction, 2);
             MIROperand *size = mir_get_op(instruction, 3);
             femit_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
+          } else if (mir_operand_kinds_match(instruction, 6, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+            // mem (SIB) to reg | base, index, scale, disp, dst, size
+            MIROperand *base = mir_get_op(instruction, 0);
+            MIROperand *index = mir_get_op(instruction, 1);
+            MIROperand *scale = mir_get_op(instruction, 2);
+            MIROperand *disp = mir_get_op(instruction, 3);
+            MIROperand *reg_dst = mir_get_op(instruction, 4);
+            MIROperand *size = mir_get_op(instruction, 5);
+            femit_sib_to_reg(context, MX64_MOV, base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm,
+                             reg_dst->value.reg.value, (RegSize)size->value.imm);
+          } else if (mir_operand_kinds_match(instruction, 5, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+            // reg to mem (SIB) | src, base, index, scale, disp
+            MIROperand *reg_source = mir_get_op(instruction, 0);
+            MIROperand *base = mir_get_op(instruction, 1);
+            MIROperand *index = mir_get_op(instruction, 2);
+            MIROperand *scale = mir_get_op(instruction, 3);
+            MIROperand *disp = mir_get_op(instruction, 4);
+            femit_reg_to_sib(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size,
+                             base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm);
+          } else if (mir_operand_kinds_match(instruction, 6, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+            // imm to mem (SIB) | imm, base, index, scale, disp, size
+            MIROperand *imm = mir_get_op(instruction, 0);
+            MIROperand *base = mir_get_op(instruction, 1);
+            MIROperand *index = mir_get_op(instruction, 2);
+            MIROperand *scale = mir_get_op(instruction, 3);
+            MIROperand *disp = mir_get_op(instruction, 4);
+            MIROperand *size = mir_get_op(instruction, 5);
+            femit_imm_to_sib(context, MX64_MOV, imm->value.imm, base->value.reg.value, index->value.reg.value,
+                             scale->value.imm, disp->value.imm, (RegSize)size->value.imm);
           } else {
             print("\n\nUNHANDLED INSTRUCTION:\n");
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
@@ -858,6 +1013,19 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
             MIROperand *offset = mir_get_op(instruction, 2);
             MIROperand *size = mir_get_op(instruction, 3);
             femit_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+            // imm to mem (local) | imm, local
+            MIROperand *imm = mir_get_op(instruction, 0);
+            MIROperand *local = mir_get_op(instruction, 1);
+            MIRFrameObject *fo = mir_get_frame_object(function, local->value.local_ref);
+            femit_imm_to_mem(context, instruction->opcode, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
+          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+            // reg to mem (local) | src, local
+            MIROperand *reg = mir_get_op(instruction, 0);
+            MIROperand *local = mir_get_op(instruction, 1);
+            MIRFrameObject *fo = mir_get_frame_object(function, local->value.local_ref);
+            if (!reg->value.reg.size) reg->value.reg.size = regsize_from_bytes(fo->size);
+            femit_reg_to_mem(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size, REG_RBP, fo->offset);
           } else {
             print("\n\nUNHANDLED INSTRUCTION:\n");
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
@@ -983,6 +1151,27 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
           }
         } break;
 
+        case MX64_CMOVCC: {
+          if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+            MIROperand *compare_type = mir_get_op(instruction, 0);
+            MIROperand *source = mir_get_op(instruction, 1);
+            MIROperand *destination = mir_get_op(instruction, 2);
+            ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for cmovcc: %I", compare_type->value.imm);
+            if (!destination->value.reg.size) destination->value.reg.size = source->value.reg.size;
+            femit_cmovcc(
+              context,
+              (enum ComparisonType)compare_type->value.imm,
+              source->value.reg.value,
+              destination->value.reg.value,
+              destination->value.reg.size
+            );
+          } else {
+            print("\n\nUNHANDLED INSTRUCTION:\n");
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+          }
+        } break;
+
         case MX64_SYSCALL:
         case MX64_UD2:
         case MX64_INT3:
@@ -1018,7 +1207,14 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
           }
         } break; // case MX64_MOVZX
 
-        case MX64_XOR: FALLTHROUGH;
+        case MX64_XOR: {
+          if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER))
+            TODO("Implement assembly emission of xor with operands other than two registers");
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          femit_reg_to_reg(context, MX64_XOR, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } break; // case MX64_XOR
+
         case MX64_XCHG:
           TODO("Implement assembly emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
 
@@ -151,6 +151,102 @@ static uint8_t sib_byte(uint8_t scale_factor, uint8_t index, uint8_t base) {
   return (uint8_t)((scale_factor << 6) | ((index & 0b111) << 3) | (base & 0b111));
 }
 
+/// Encode the REX prefix (if any) of an instruction that accesses the
+/// memory operand `disp(base, index, scale)`, with `reg` in ModRM.reg.
+static void mcode_sib_rex(CodegenContext *context, bool w, RegisterDescriptor reg, RegSize reg_size, RegisterDescriptor base, RegisterDescriptor index) {
+  bool r = reg != REG_NONE && REGBITS_TOP(regbits(reg));
+  bool x = REGBITS_TOP(regbits(index));
+  bool b = REGBITS_TOP(regbits(base));
+
+  // SPL, BPL, SIL, and DIL are only accessible with a REX prefix.
+  bool byte_reg = reg != REG_NONE && reg_size == r8 && regbits(reg) >= 0b100 && regbits(reg) <= 0b111;
+  if (w || r || x || b || byte_reg) mcode_1(context->object, rex_byte(w, r, x, b));
+}
+
+/// Encode ModRM, SIB, and displacement of the memory operand
+/// `disp(base, index, scale)`, with `reg_field` in ModRM.reg.
+static void mcode_sib_operand(CodegenContext *context, uint8_t reg_field, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp) {
+  ASSERT(index != REG_RSP, "RSP cannot be used as an index register");
+  uint8_t scale_factor = 0;
+  switch (scale) {
+  case 1: scale_factor = 0b00; break;
+  case 2: scale_factor = 0b01; break;
+  case 4: scale_factor = 0b10; break;
+  case 8: scale_factor = 0b11; break;
+  default: ICE("Invalid SIB scale factor %D", scale);
+  }
+
+  // A base with the low bits 101 (RBP, R13) and mod == 0b00 means
+  // "no base, disp32", so those always need a displacement.
+  uint8_t base_regbits = regbits(base);
+  uint8_t mod = 0b10;
+  if (disp == 0 && (base_regbits & 0b111) != 0b101) mod = 0b00;
+  else if (disp >= -128 && disp <= 127) mod = 0b01;
+
+  // R/M == 0b100  ->  SIB byte follows
+  mcode_2(context->object, modrm_byte(mod, reg_field, 0b100), sib_byte(scale_factor, regbits(index), base_regbits));
+  if (mod == 0b01) {
+    int8_t disp8 = (int8_t)disp;
+    mcode_1(context->object, (uint8_t)disp8);
+  } else if (mod == 0b10) {
+    int32_t disp32 = (int32_t)disp;
+    mcode_n(context->object, &disp32, 4);
+  }
+}
+
+static void mcode_sib_to_reg(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp, RegisterDescriptor destination_register, RegSize size) {
+  uint8_t op = 0;
+  switch (inst) {
+  case MX64_LEA:
+    if (size == r8) ICE("x86_64 machine code backend: LEA does not have an 8-bit encoding.");
+    op = 0x8d;
+    break;
+  case MX64_MOV: op = size == r8 ? 0x8a : 0x8b; break;
+  default: ICE("ERROR: mcode_sib_to_reg(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
+  }
+
+  if (size == r16) mcode_1(context->object, 0x66);
+  mcode_sib_rex(context, size == r64, destination_register, size, base, index);
+  mcode_1(context->object, op);
+  mcode_sib_operand(context, regbits(destination_register), base, index, scale, disp);
+}
+
+static void mcode_reg_to_sib(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor source_register, RegSize size, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp) {
+  if (inst != MX64_MOV) ICE("ERROR: mcode_reg_to_sib(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
+
+  // 0x88 /r (r8), 0x89 /r (r16, r32, r64)
+  if (size == r16) mcode_1(context->object, 0x66);
+  mcode_sib_rex(context, size == r64, source_register, size, base, index);
+  mcode_1(context->object, size == r8 ? 0x88 : 0x89);
+  mcode_sib_operand(context, regbits(source_register), base, index, scale, disp);
+}
+
+static void mcode_imm_to_sib(CodegenContext *context, MIROpcodex86_64 inst, int64_t immediate, RegisterDescriptor base, RegisterDescriptor index, int64_t scale, int64_t disp, RegSize size) {
+  if (inst != MX64_MOV) ICE("ERROR: mcode_imm_to_sib(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
+
+  // 0xc6 /0 ib (r8), 0xc7 /0 iw (r16), 0xc7 /0 id (r32, sign-extended for r64)
+  if (size == r16) mcode_1(context->object, 0x66);
+  mcode_sib_rex(context, size == r64, REG_NONE, size, base, index);
+  mcode_1(context->object, size == r8 ? 0xc6 : 0xc7);
+  mcode_sib_operand(context, 0, base, index, scale, disp);
+  switch (size) {
+  default: ICE("Unhandled register size");
+  case r8: {
+    int8_t imm8 = (int8_t)immediate;
+    mcode_1(context->object, (uint8_t)imm8);
+  } break;
+  case r16: {
+    int16_t imm16 = (int16_t)immediate;
+    mcode_n(context->object, &imm16, 2);
+  } break;
+  case r32:
+  case r64: {
+    int32_t imm32 = (int32_t)immediate;
+    mcode_n(context->object, &imm32, 4);
+  } break;
+  }
+}
+
 // TODO/FIXME: There are lots of issues regarding Chapter 2, Volume 2,
 // Table 2-5 "Special Cases of REX Encodings" of the Intel SDM.
 // - SIB byte also required for R12-based addressing.
@@ -532,43 +628,57 @@ static void mcode_imm_to_mem(CodegenContext *context, MIROpcodex86_64 inst, int6
     } // switch (size)
   } break; // case MX64_MOV
 
+  case MX64_ADD: FALLTHROUGH;
   case MX64_SUB: {
-    // REX.W 0x81 /5 id
-    ASSERT(size == r64, "Unhandled size");
-    if (offset == 0) {
-      uint8_t address_regbits = regbits(address_register);
-      uint8_t rex = rex_byte(true, false, false, REGBITS_TOP(address_regbits));
-      uint8_t modrm = modrm_byte(0b00, 5, address_regbits);
-      int32_t imm32 = (int32_t)immediate;
+    // ADD: 0x80 /0 ib, 0x81 /0 iw/id, REX.W + 0x81 /0 id
+    // SUB: 0x80 /5 ib, 0x81 /5 iw/id, REX.W + 0x81 /5 id
+    uint8_t op = size == r8 ? 0x80 : 0x81;
+    uint8_t extension = inst == MX64_ADD ? 0 : 5;
+    uint8_t address_regbits = regbits(address_register);
 
-      mcode_3(context->object, rex, 0x81, modrm);
-      if (address_register == REG_RSP) {
-        /// Scaling Factor == 0b00  ->  1
-        /// Index == 0b100  ->  None
-        /// Base == RSP bits (0b100)
-        mcode_1(context->object, sib_byte(0b00, 0b100, address_regbits));
-      }
-      mcode_n(context->object, &imm32, 4);
-      break;
+    if (size == r16) mcode_1(context->object, 0x66);
+    if (size == r64 || REGBITS_TOP(address_regbits)) {
+      uint8_t rex = rex_byte(size == r64, false, false, REGBITS_TOP(address_regbits));
+      mcode_1(context->object, rex);
     }
 
-    uint8_t address_regbits = regbits(address_register);
-    uint8_t rex = rex_byte(true, false, false, REGBITS_TOP(address_regbits));
-    uint8_t modrm = modrm_byte(0b10, 5, address_regbits);
-    int32_t imm32 = (int32_t)immediate;
-    int32_t disp32 = (int32_t)offset;
+    // RBP and R13 can only be encoded as base registers with a
+    // displacement, as Mod == 0b00 means something else for them.
+    bool displaced = offset || (address_regbits & 0b111) == 0b101;
 
-    mcode_3(context->object, rex, 0x81, modrm);
-    if (address_register == REG_RSP) {
+    // Mod == 0b00  ->  (R/M), or 0b10  ->  (R/M+disp32)
+    // Reg == Opcode Extension
+    // R/M == Address
+    uint8_t modrm = modrm_byte(displaced ? 0b10 : 0b00, extension, address_regbits);
+    mcode_2(context->object, op, modrm);
+    if ((address_regbits & 0b111) == 0b100) {
       /// Scaling Factor == 0b00  ->  1
       /// Index == 0b100  ->  None
-      /// Base == RSP bits (0b100)
+      /// Base == RSP/R12 bits (0b100)
       mcode_1(context->object, sib_byte(0b00, 0b100, address_regbits));
     }
-    mcode_n(context->object, &disp32, 4);
-    mcode_n(context->object, &imm32, 4);
+    if (displaced) {
+      int32_t disp32 = (int32_t)offset;
+      mcode_n(context->object, &disp32, 4);
+    }
 
-  } break; // case MX64_SUB
+    switch (size) {
+    default: ICE("Unhandled register size");
+    case r8: {
+      int8_t imm8 = (int8_t)immediate;
+      mcode_1(context->object, (uint8_t)imm8);
+    } break;
+    case r16: {
+      int16_t imm16 = (int16_t)immediate;
+      mcode_n(context->object, &imm16, 2);
+    } break;
+    case r32: FALLTHROUGH;
+    case r64: {
+      int32_t imm32 = (int32_t)immediate;
+      mcode_n(context->object, &imm32, 4);
+    } break;
+    }
+  } break; // case MX64_ADD/MX64_SUB
 
   default: ICE("ERROR: mcode_imm_to_mem(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
   }
@@ -1251,6 +1361,36 @@ static void mcode_reg_to_mem(CodegenContext *context, MIROpcodex86_64 inst, Regi
 
   } break;
 
+  case MX64_ADD: FALLTHROUGH;
+  case MX64_SUB: {
+    // ADD: 0x00 /r (r8), 0x01 /r (r16/r32), REX.W + 0x01 /r (r64)
+    // SUB: 0x28 /r (r8), 0x29 /r (r16/r32), REX.W + 0x29 /r (r64)
+    uint8_t op = (uint8_t)((inst == MX64_ADD ? 0x00 : 0x28) | (size != r8));
+    uint8_t source_regbits = regbits(source_register);
+    uint8_t address_regbits = regbits(address_register);
+
+    if (size == r16) mcode_1(context->object, 0x66);
+    if (size == r64 || REGBITS_TOP(source_regbits) || REGBITS_TOP(address_regbits)) {
+      uint8_t rex = rex_byte(size == r64, REGBITS_TOP(source_regbits), false, REGBITS_TOP(address_regbits));
+      mcode_1(context->object, rex);
+    }
+
+    // See the imm to mem form above.
+    bool displaced = offset || (address_regbits & 0b111) == 0b101;
+
+    // Mod == 0b00  ->  (R/M), or 0b10  ->  (R/M+disp32)
+    // Reg == Source
+    // R/M == Address
+    uint8_t modrm = modrm_byte(displaced ? 0b10 : 0b00, source_regbits, address_regbits);
+    mcode_2(context->object, op, modrm);
+    if ((address_regbits & 0b111) == 0b100)
+      mcode_1(context->object, sib_byte(0b00, 0b100, address_regbits));
+    if (displaced) {
+      int32_t disp32 = (int32_t)offset;
+      mcode_n(context->object, &disp32, 4);
+    }
+  } break; // case MX64_ADD/MX64_SUB
+
   default: ICE("ERROR: mcode_reg_to_mem(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
   }
 }
@@ -1272,6 +1412,9 @@ static void mcode_reg_to_reg
   // R/M == Destination
   uint8_t modrm = modrm_byte(0b11, source_regbits, destination_regbits);
 
+  // Zero and sign extension encode the destination in Reg instead.
+  uint8_t extend_modrm = modrm_byte(0b11, destination_regbits, source_regbits);
+
   switch (inst) {
 
   case MX64_IMUL: {
@@ -1320,15 +1463,15 @@ static void mcode_reg_to_reg
       case r32: {
         // 0x0f + 0xb7 /r
         if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
-          uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+          uint8_t rex = rex_byte(false, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
           mcode_1(context->object, rex);
         }
-        mcode_3(context->object, 0x0f, 0xb7, modrm);
+        mcode_3(context->object, 0x0f, 0xb7, extend_modrm);
       } break;
       case r64: {
         // REX.W + 0x0f + 0xb7 /r
-        uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
-        mcode_4(context->object, rex, 0x0f, 0xb7, modrm);
+        uint8_t rex = rex_byte(true, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+        mcode_4(context->object, rex, 0x0f, 0xb7, extend_modrm);
       } break;
       }
 
@@ -1344,15 +1487,15 @@ static void mcode_reg_to_reg
       case r32: {
         // 0x0f + 0xb6 /r
         if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
-          uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+          uint8_t rex = rex_byte(false, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
           mcode_1(context->object, rex);
         }
-        mcode_3(context->object, 0x0f, 0xb6, modrm);
+        mcode_3(context->object, 0x0f, 0xb6, extend_modrm);
       } break;
       case r64: {
         // REX.W + 0x0f + 0xb6 /r
-        uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
-        mcode_4(context->object, rex, 0x0f, 0xb6, modrm);
+        uint8_t rex = rex_byte(true, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+        mcode_4(context->object, rex, 0x0f, 0xb6, extend_modrm);
       } break;
       } // switch (destination_size)
 
@@ -1370,8 +1513,8 @@ static void mcode_reg_to_reg
     case r32: {
       ASSERT(destination_size == r64);
       // REX.W + 0x63 /r
-      uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
-      mcode_3(context->object, rex, 0x63, modrm);
+      uint8_t rex = rex_byte(true, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+      mcode_3(context->object, rex, 0x63, extend_modrm);
     } break; // case r32
     case r16: {
       ASSERT(destination_size >= r32);
@@ -1381,15 +1524,15 @@ static void mcode_reg_to_reg
       case r32: {
         // 0x0f + 0xbf /r
         if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
-          uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+          uint8_t rex = rex_byte(false, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
           mcode_1(context->object, rex);
         }
-        mcode_3(context->object, 0x0f, 0xbf, modrm);
+        mcode_3(context->object, 0x0f, 0xbf, extend_modrm);
       } break;
       case r64: {
         // REX.W + 0x0f + 0xbf /r
-        uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
-        mcode_4(context->object, rex, 0x0f, 0xbf, modrm);
+        uint8_t rex = rex_byte(true, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+        mcode_4(context->object, rex, 0x0f, 0xbf, extend_modrm);
       } break;
       } // switch (destination_size)
 
@@ -1405,15 +1548,15 @@ static void mcode_reg_to_reg
       case r32: {
         // 0x0f + 0xbe /r
         if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
-          uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+          uint8_t rex = rex_byte(false, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
           mcode_1(context->object, rex);
         }
-        mcode_3(context->object, 0x0f, 0xbe, modrm);
+        mcode_3(context->object, 0x0f, 0xbe, extend_modrm);
       } break;
       case r64: {
         // REX.W + 0x0f + 0xbe /r
-        uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
-        mcode_4(context->object, rex, 0x0f, 0xbe, modrm);
+        uint8_t rex = rex_byte(true, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+        mcode_4(context->object, rex, 0x0f, 0xbe, extend_modrm);
       } break;
       } // switch (destination_size)
 
@@ -1540,6 +1683,44 @@ static void mcode_reg_to_reg
 
   } break; // case MX64_OR
 
+  case MX64_XOR: {
+    ASSERT(source_size == destination_size, "x86_64 machine code backend requires reg-to-reg xors to be of equal size.");
+
+    switch (source_size) {
+    default: ICE("Unhandled register size");
+    case r8: {
+      // Bitwise xor r8 with r8
+      // 0x30 /r
+      if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
+        uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+        mcode_1(context->object, rex);
+      }
+      mcode_2(context->object, 0x30, modrm);
+    } break;
+
+    case r16: {
+      // 0x66 + 0x31 /r
+      mcode_1(context->object, 0x66);
+    } FALLTHROUGH;
+    case r32: {
+      // 0x31 /r
+      if (REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
+        uint8_t rex = rex_byte(false, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+        mcode_1(context->object, rex);
+      }
+      mcode_2(context->object, 0x31, modrm);
+    } break;
+
+    case r64: {
+      // REX.W + 0x31 /r
+      uint8_t rex = rex_byte(true, REGBITS_TOP(source_regbits), false, REGBITS_TOP(destination_regbits));
+      mcode_3(context->object, rex, 0x31, modrm);
+    } break;
+
+    } // switch (size)
+
+  } break; // case MX64_XOR
+
   case MX64_ADD: {
 
     ASSERT(source_size == destination_size, "x86_64 machine code backend requires reg-to-reg adds to be of equal size.");
@@ -1739,7 +1920,7 @@ static void mcode_reg_shift(CodegenContext *context, MIROpcodex86_64 inst, Regis
     case r8: {
       // 0xd2 /4
       if (REGBITS_TOP(rbits)) {
-        uint8_t rex = rex_byte(false, REGBITS_TOP(rbits), false, false);
+        uint8_t rex = rex_byte(false, false, false, REGBITS_TOP(rbits));
         mcode_1(context->object, rex);
       }
       mcode_2(context->object, 0xd2, modrm);
@@ -1752,7 +1933,7 @@ static void mcode_reg_shift(CodegenContext *context, MIROpcodex86_64 inst, Regis
     case r32: {
       // 0xd3 /4
       if (REGBITS_TOP(rbits)) {
-        uint8_t rex = rex_byte(false, REGBITS_TOP(rbits), false, false);
+        uint8_t rex = rex_byte(false, false, false, REGBITS_TOP(rbits));
         mcode_1(context->object, rex);
       }
 
@@ -1761,7 +1942,7 @@ static void mcode_reg_shift(CodegenContext *context, MIROpcodex86_64 inst, Regis
 
     case r64: {
       // REX.W + 0xd3 /4
-      uint8_t rex = rex_byte(true, REGBITS_TOP(rbits), false, false);
+      uint8_t rex = rex_byte(true, false, false, REGBITS_TOP(rbits));
       mcode_3(context->object, rex, 0xd3, modrm);
     } break;
     } // switch (size)
@@ -2203,582 +2384,829 @@ static void mcode_setcc(CodegenContext *context, enum ComparisonType comparison_
   mcode_3(context->object, op_escape, op, modrm);
 }
 
-/// IS_FUNCTION should be true iff LABEL is the symbol of a function.
-static void mcode_jcc(CodegenContext *context, IndirectJumpType type, const char *label, bool is_function) {
+/// There is no 8-bit cmov; we use the 32-bit form instead, which
+/// leaves the low byte of the destination as we want it.
+static void mcode_cmovcc(
+  CodegenContext *context,
+  enum ComparisonType comparison_type,
+  RegisterDescriptor source_register,
+  RegisterDescriptor destination_register,
+  enum RegSize size
+) {
   uint8_t op = 0;
+  switch (comparison_type) {
+  case COMPARE_EQ: op = 0x44; break;
+  case COMPARE_NE: op = 0x45; break;
+  case COMPARE_GT: op = 0x4f; break;
+  case COMPARE_LT: op = 0x4c; break;
+  case COMPARE_GE: op = 0x4d; break;
+  case COMPARE_LE: op = 0x4e; break;
+  default: ICE("Invalid comparison type");
+  }
+
+  uint8_t source_regbits = regbits(source_register);
+  uint8_t destination_regbits = regbits(destination_register);
+
+  // 0x66 + 0x0f 0x40+cc /r
+  if (size == r16) mcode_1(context->object, 0x66);
+
+  // REX.W + 0x0f 0x40+cc /r
+  if (size == r64 || REGBITS_TOP(source_regbits) || REGBITS_TOP(destination_regbits)) {
+    uint8_t rex = rex_byte(size == r64, REGBITS_TOP(destination_regbits), false, REGBITS_TOP(source_regbits));
+    mcode_1(context->object, rex);
+  }
+
+  // Mod == 0b11  ->  register
+  // Reg == Destination
+  // R/M == Source
+  uint8_t modrm = modrm_byte(0b11, destination_regbits, source_regbits);
+  mcode_3(context->object, 0x0f, op, modrm);
+}
+
+/// A branch to a block within the same function.
+typedef struct Branch {
+  MIRBlock *target;
+
+  /// Offset of the end of the branch from the start of the function,
+  /// if every branch is emitted in its long form.
+  usz end;
+
+  /// Number of bytes saved by emitting the branch in its short form.
+  usz saving;
+
+  /// Whether the branch is emitted in its short form.
+  bool is_short;
+} Branch;
+
+/// A rel32 displacement to a block within the same function, to be
+/// filled in once the function has been emitted.
+typedef struct BlockFixup {
+  MIRBlock *target;
+
+  /// Offset of the end of the displacement from the start of the function.
+  usz end;
+} BlockFixup;
+
+/// Intra-function branches are emitted in their long form (rel32) when
+/// a function is first emitted, which lays it out. From that, we work
+/// out which of them fit in their short form (rel8) instead, and then
+/// emit the function again using that final layout.
+///
+/// Blocks don't get symbols, and nothing that refers to them needs a
+/// relocation: displacements to blocks are filled in directly from the
+/// layout, at the end of each function.
+typedef struct FunctionLayout {
+  /// Offset of the start of the function within the code section.
+  usz start;
+
+  /// Offset of each block from the start of the function, by block id.
+  /// Initially as laid out, and after branch relaxation, final.
+  Vector(usz) blocks;
+
+  /// Branches to blocks of the function, in order.
+  Vector(Branch) branches;
+
+  /// Displacements to fill in at the end of the function.
+  Vector(BlockFixup) fixups;
+
+  /// Set once the layout is final; `next_branch` is the index of the
+  /// branch to be emitted next.
+  bool final;
+  usz next_branch;
+} FunctionLayout;
+
+/// Opcode of the short form of a conditional jump of the given type.
+/// That of the long form is 0x0f followed by this plus 0x10.
+static uint8_t jcc_short_opcode(IndirectJumpType type) {
   switch (type) {
-  case JUMP_TYPE_E:  op = 0x84; break;
-  case JUMP_TYPE_NE: op = 0x85; break;
-  case JUMP_TYPE_G:  op = 0x8f; break;
-  case JUMP_TYPE_L:  op = 0x8c; break;
-  case JUMP_TYPE_GE: op = 0x8d; break;
-  case JUMP_TYPE_LE: op = 0x8e; break;
+  case JUMP_TYPE_E:  return 0x74;
+  case JUMP_TYPE_NE: return 0x75;
+  case JUMP_TYPE_G:  return 0x7f;
+  case JUMP_TYPE_L:  return 0x7c;
+  case JUMP_TYPE_GE: return 0x7d;
+  case JUMP_TYPE_LE: return 0x7e;
   default: ICE("Unhandled jump type: %d", (int)type);
   }
+}
 
-  uint8_t op_escape = 0x0f;
+static void mcode_block_disp32(CodegenContext *context, FunctionLayout *layout, MIRBlock *target) {
   int32_t disp32 = 0;
+  mcode_n(context->object, &disp32, 4);
 
-  mcode_2(context->object, op_escape, op);
+  BlockFixup fixup = {0};
+  fixup.target = target;
+  fixup.end = code_section(context->object)->data.bytes.size - layout->start;
+  vector_push(layout->fixups, fixup);
+}
 
-  // Make disp32 relocation to lea from symbol
-  RelocationEntry reloc = {0};
+/// Emit a jump (if INST is MX64_JMP) or conditional jump (if INST is
+/// MX64_JCC) of the given type to a block of the current function.
+static void mcode_branch(CodegenContext *context, FunctionLayout *layout, MIROpcodex86_64 inst, IndirectJumpType type, MIRBlock *target) {
   Section *sec_code = code_section(context->object);
-  if (is_function) reloc.sym.type = GOBJ_SYMTYPE_FUNCTION;
-  reloc.sym.byte_offset = sec_code->data.bytes.size;
-  reloc.sym.name = strdup(label);
-  reloc.sym.section_name = strdup(sec_code->name);
-  reloc.type = RELOC_DISP32_PCREL;
-  vector_push(context->object->relocs, reloc);
+  Branch *branch = NULL;
+  if (layout->final) {
+    ASSERT(layout->next_branch < layout->branches.size, "Branch relaxation is missing a branch");
+    branch = layout->branches.data + layout->next_branch++;
+    ASSERT(branch->target == target, "Branch relaxation has branches out of order");
+  }
 
-  mcode_n(context->object, &disp32, 4);
-}
+  if (branch && branch->is_short) {
+    isz disp = (isz) layout->blocks.data[target->id] - (isz) (sec_code->data.bytes.size + 2 - layout->start);
+    ASSERT(disp >= INT8_MIN && disp <= INT8_MAX, "Relaxed branch to %S is out of range", target->name);
+    if (inst == MX64_JMP) mcode_2(context->object, 0xeb, (uint8_t) (int8_t) disp);
+    else mcode_2(context->object, jcc_short_opcode(type), (uint8_t) (int8_t) disp);
+    return;
+  }
 
-void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machine_instructions) {
-  DBGASSERT(context, "Invalid argument");
-  ASSERT(context->object, "Cannot emit into NULL generic object");
+  if (inst == MX64_JMP) mcode_1(context->object, 0xe9);
+  else mcode_2(context->object, 0x0f, jcc_short_opcode(type) + 0x10);
+  mcode_block_disp32(context, layout, target);
 
-  if (context->ast->is_module) {
-    string module_cereal = serialise_module(context, context->ast);
-    Section sec_module_metadata = {0};
-    sec_module_metadata.name = strdup(INTC_MODULE_SECTION_NAME);
-    sec_module_metadata.data.bytes.data = (uint8_t*)module_cereal.data;
-    sec_module_metadata.data.bytes.size = module_cereal.size;
-    sec_module_metadata.data.bytes.capacity = module_cereal.size;
-    vector_push(context->object->sections, sec_module_metadata);
+  if (!layout->final) {
+    Branch b = {0};
+    b.target = target;
+    b.end = sec_code->data.bytes.size - layout->start;
+    b.saving = inst == MX64_JMP ? 5 - 2 : 6 - 2;
+    vector_push(layout->branches, b);
   }
+}
 
-  foreach_val (function, machine_instructions) {
-    { // Function symbol
-      GObjSymbol sym = {0};
-      sym.type = !ir_func_is_definition(function->origin) ? GOBJ_SYMTYPE_EXTERNAL : GOBJ_SYMTYPE_FUNCTION;
-      sym.name = strdup(function->name.data);
-      sym.section_name = strdup(code_section(context->object)->name);
-      sym.byte_offset = code_section(context->object)->data.bytes.size;
-      vector_push(context->object->symbols, sym);
+/// Where OFFSET, as laid out, ends up once the branches marked as short
+/// so far are emitted in their short form. SAVED[N] is the number of
+/// bytes saved by the first N branches; since the branches are in order,
+/// we only have to find how many of them end at or before OFFSET.
+static usz relaxed_offset(FunctionLayout *layout, const usz *saved, usz offset) {
+  usz lo = 0, hi = layout->branches.size;
+  while (lo < hi) {
+    usz mid = lo + (hi - lo) / 2;
+    if (layout->branches.data[mid].end <= offset) lo = mid + 1;
+    else hi = mid;
+  }
+  return offset - saved[lo];
+}
+
+/// Mark every branch of the given layout that fits in its short form
+/// as such, and update the block offsets accordingly. Return true iff
+/// any branch was marked.
+///
+/// Shrinking a branch never moves any branch further away from its
+/// target, so branches once marked stay in range; we just keep marking
+/// until nothing changes anymore.
+static bool relax_branches(FunctionLayout *layout) {
+  bool relaxed = false;
+  Vector(bool) fits = {0};
+  Vector(usz) saved = {0};
+  for (;;) {
+    vector_clear(saved);
+    usz sum = 0;
+    vector_push(saved, sum);
+    foreach (branch, layout->branches) {
+      if (branch->is_short) sum += branch->saving;
+      vector_push(saved, sum);
+    }
+
+    vector_clear(fits);
+    foreach (branch, layout->branches) {
+      isz target = (isz) relaxed_offset(layout, saved.data, layout->blocks.data[branch->target->id]);
+      isz end = (isz) (relaxed_offset(layout, saved.data, branch->end) - branch->saving);
+      vector_push(fits, !branch->is_short && target - end >= INT8_MIN && target - end <= INT8_MAX);
     }
-    if (function->origin && !ir_func_is_definition(function->origin)) continue;
 
-    // Calculate stack offsets, frame size
-    isz frame_offset = 0;
-    isz frame_size = 0;
-    foreach (fo, function->frame_objects) {
-      frame_size += (isz) fo->size;
-      frame_offset -= (isz) fo->size;
-      fo->offset = frame_offset;
+    bool changed = false;
+    foreach_index (i, layout->branches) {
+      if (!fits.data[i]) continue;
+      layout->branches.data[i].is_short = true;
+      changed = true;
     }
 
-    STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-    StackFrameKind frame_kind = stack_frame_kind(function);
-    switch (frame_kind) {
-    case FRAME_NONE: break;
+    if (!changed) break;
+    relaxed = true;
+  }
 
-    case FRAME_MINIMAL: {
-      mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-    } break;
+  /// Nothing changed in the last round, so the sums are still current.
+  foreach (offset, layout->blocks) *offset = relaxed_offset(layout, saved.data, *offset);
+  vector_delete(fits);
+  vector_delete(saved);
+  return relaxed;
+}
 
-    case FRAME_FULL: {
-      // PUSH %RBP
-      // MOV %RSP, %RBP
-      mcode_reg(context, MX64_PUSH, REG_RBP, r64);
-      mcode_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
-      if (frame_size) mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
-    } break;
+/// Emit the prologue and body of a function. See `FunctionLayout`.
+static void mcode_function(CodegenContext *context, MIRFunction *function, FunctionLayout *layout) {
+  // Calculate stack offsets, frame size
+  isz frame_offset = 0;
+  isz frame_size = 0;
+  foreach (fo, function->frame_objects) {
+    frame_size += (isz) fo->size;
+    frame_offset -= (isz) fo->size;
+    fo->offset = frame_offset;
+  }
 
-    case FRAME_COUNT: FALLTHROUGH;
-    default: UNREACHABLE();
+  STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+  StackFrameKind frame_kind = stack_frame_kind(function);
+  switch (frame_kind) {
+  case FRAME_NONE: break;
 
-    }
+  case FRAME_MINIMAL: {
+    mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
+  } break;
+
+  case FRAME_FULL: {
+    // PUSH %RBP
+    // MOV %RSP, %RBP
+    mcode_reg(context, MX64_PUSH, REG_RBP, r64);
+    mcode_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
+    if (frame_size) mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
+  } break;
+
+  case FRAME_COUNT: FALLTHROUGH;
+  default: UNREACHABLE();
 
-    foreach_index (block_index, function->blocks) {
-      MIRBlock* block = function->blocks.data[block_index];
-      { // Block label symbol
-        GObjSymbol sym = {0};
-        sym.type = GOBJ_SYMTYPE_STATIC;
-        sym.name = strdup(block->name.data);
-        sym.section_name = strdup(code_section(context->object)->name);
-        sym.byte_offset = code_section(context->object)->data.bytes.size;
-        vector_push(context->object->symbols, sym);
+  }
+
+  foreach_index (block_index, function->blocks) {
+    MIRBlock* block = function->blocks.data[block_index];
+    if (layout->final) {
+      ASSERT(code_section(context->object)->data.bytes.size - layout->start == layout->blocks.data[block->id],
+             "Block %S is not where branch relaxation expects it to be", block->name);
+    } else {
+      ASSERT(block->id == block_index, "Block %S of function %S is not numbered correctly", block->name, function->name);
+      vector_push(layout->blocks, code_section(context->object)->data.bytes.size - layout->start);
+    }
+    foreach_val (instruction, block->instructions) {
+      if (instruction->opcode < MX64_START) {
+        eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
+        print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+        ICE("It seems instruction selection has not lowered a general MIR instruction");
       }
-      foreach_val (instruction, block->instructions) {
-        if (instruction->opcode < MX64_START) {
-          eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
+      switch ((MIROpcodex86_64)instruction->opcode) {
+      default: {
+        print("Unhandled opcode (mcode): %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      } break;
+
+      case MX64_IMUL: {
+        // TODO: Three address versions of imul.
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
+          }
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
           print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-          ICE("It seems instruction selection has not lowered a general MIR instruction");
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
         }
-        switch ((MIROpcodex86_64)instruction->opcode) {
-        default: {
-          print("Unhandled opcode (mcode): %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
-        } break;
-
-        case MX64_IMUL: {
-          // TODO: Three address versions of imul.
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      } break; // case MX64_IMUL
+
+      case MX64_NOT: FALLTHROUGH;
+      case MX64_DIV: FALLTHROUGH;
+      case MX64_IDIV: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_IDIV
+
+      case MX64_AND: FALLTHROUGH;
+      case MX64_OR: FALLTHROUGH;
+      case MX64_ADD: FALLTHROUGH;
+      case MX64_SUB: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_IMUL
-
-        case MX64_NOT: FALLTHROUGH;
-        case MX64_DIV: FALLTHROUGH;
-        case MX64_IDIV: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, address, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *addr = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+          // imm to mem (local) | imm, local
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+          MIRFrameObject *fo = mir_get_frame_object(function, local->value.local_ref);
+          mcode_imm_to_mem(context, instruction->opcode, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+          // reg to mem (local) | src, local
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+          MIRFrameObject *fo = mir_get_frame_object(function, local->value.local_ref);
+          if (!reg->value.reg.size) reg->value.reg.size = regsize_from_bytes(fo->size);
+          mcode_reg_to_mem(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size, REG_RBP, fo->offset);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_ADD
+
+      case MX64_MOV: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_IDIV
-
-        case MX64_AND: FALLTHROUGH;
-        case MX64_OR: FALLTHROUGH;
-        case MX64_ADD: FALLTHROUGH;
-        case MX64_SUB: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, address, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *addr = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+          // imm to mem (local) | imm, local
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
+                 (int)local->value.local_ref, function->frame_objects.size);
+          MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
+          mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
+          // imm to mem (static) | imm, static
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          mcode_imm_to_offset_name(context, MX64_MOV,
+                                   imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
+                                   REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
+          mcode_reg_to_reg(context, MX64_MOV, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
+          // reg to mem (static) | src, static
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_ADD
-
-        case MX64_MOV: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
-            // imm to mem (local) | imm, local
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
-                   (int)local->value.local_ref, function->frame_objects.size);
-            MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
-            mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
-            // imm to mem (static) | imm, static
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            mcode_imm_to_offset_name(context, MX64_MOV,
-                                     imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
-                                     REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
-            mcode_reg_to_reg(context, MX64_MOV, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
-            // reg to mem (static) | src, static
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                              REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
-            // reg to mem (local) | src, local
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-
-            mcode_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            TODO("MOV(IMM, REG, IMM) would normally be in the 'imm to mem' form, but an extra size operand is required (how many bytes to store)");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, addr, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // reg to mem | src, addr, offset
-            MIROperand *reg_source = mir_get_op(instruction, 0);
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            mcode_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            TODO("MOV(REG, IMM, REG) would normally be in the 'mem to reg' form, but an extra size operand is required (how many bytes to store)");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // mem to reg | addr, offset, dst, size
-            MIROperand *reg_address = mir_get_op(instruction, 0);
-            MIROperand *offset = mir_get_op(instruction, 1);
-            MIROperand *reg_dst = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            // mem (local) to reg | local, src
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            mcode_mem_to_reg(context, MX64_MOV,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
-                             reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            // mem (static) to reg | static, dst
-            MIROperand *stc = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                            REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+          // reg to mem (local) | src, local
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
           }
 
-        } break; // case MX64_MOV
+          mcode_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          TODO("MOV(IMM, REG, IMM) would normally be in the 'imm to mem' form, but an extra size operand is required (how many bytes to store)");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, addr, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // reg to mem | src, addr, offset
+          MIROperand *reg_source = mir_get_op(instruction, 0);
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          mcode_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          TODO("MOV(REG, IMM, REG) would normally be in the 'mem to reg' form, but an extra size operand is required (how many bytes to store)");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // mem to reg | addr, offset, dst, size
+          MIROperand *reg_address = mir_get_op(instruction, 0);
+          MIROperand *offset = mir_get_op(instruction, 1);
+          MIROperand *reg_dst = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          // mem (local) to reg | local, src
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          mcode_mem_to_reg(context, MX64_MOV,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
+                           reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          // mem (static) to reg | static, dst
+          MIROperand *stc = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 6, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // mem (SIB) to reg | base, index, scale, disp, dst, size
+          MIROperand *base = mir_get_op(instruction, 0);
+          MIROperand *index = mir_get_op(instruction, 1);
+          MIROperand *scale = mir_get_op(instruction, 2);
+          MIROperand *disp = mir_get_op(instruction, 3);
+          MIROperand *reg_dst = mir_get_op(instruction, 4);
+          MIROperand *size = mir_get_op(instruction, 5);
+          mcode_sib_to_reg(context, MX64_MOV, base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm,
+                           reg_dst->value.reg.value, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 5, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // reg to mem (SIB) | src, base, index, scale, disp
+          MIROperand *reg_source = mir_get_op(instruction, 0);
+          MIROperand *base = mir_get_op(instruction, 1);
+          MIROperand *index = mir_get_op(instruction, 2);
+          MIROperand *scale = mir_get_op(instruction, 3);
+          MIROperand *disp = mir_get_op(instruction, 4);
+          mcode_reg_to_sib(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size,
+                           base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 6, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem (SIB) | imm, base, index, scale, disp, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *base = mir_get_op(instruction, 1);
+          MIROperand *index = mir_get_op(instruction, 2);
+          MIROperand *scale = mir_get_op(instruction, 3);
+          MIROperand *disp = mir_get_op(instruction, 4);
+          MIROperand *size = mir_get_op(instruction, 5);
+          mcode_imm_to_sib(context, MX64_MOV, imm->value.imm, base->value.reg.value, index->value.reg.value,
+                           scale->value.imm, disp->value.imm, (RegSize)size->value.imm);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
 
-        case MX64_CALL: {
-          MIROperand *dst = mir_get_op(instruction, 0);
+      } break; // case MX64_MOV
 
-          switch (dst->kind) {
+      case MX64_CALL: {
+        MIROperand *dst = mir_get_op(instruction, 0);
 
-          case MIR_OP_REGISTER: {
-            mcode_indirect_branch(context, MX64_CALL, dst->value.reg.value);
-          } break;
-          case MIR_OP_NAME: {
-            mcode_name(context, MX64_CALL, dst->value.name, false);
-          } break;
-          case MIR_OP_BLOCK: {
-            mcode_name(context, MX64_CALL, dst->value.block->name.data, false);
-          } break;
-          case MIR_OP_FUNCTION: {
-            mcode_name(context, MX64_CALL, dst->value.function->name.data, true);
-          } break;
+        switch (dst->kind) {
 
-          default: ICE("Unhandled operand kind in CALL: %d (%s)", dst->kind, mir_operand_kind_string(dst->kind));
+        case MIR_OP_REGISTER: {
+          mcode_indirect_branch(context, MX64_CALL, dst->value.reg.value);
+        } break;
+        case MIR_OP_NAME: {
+          mcode_name(context, MX64_CALL, dst->value.name, false);
+        } break;
+        case MIR_OP_BLOCK: {
+          mcode_1(context->object, 0xe8);
+          mcode_block_disp32(context, layout, dst->value.block);
+        } break;
+        case MIR_OP_FUNCTION: {
+          mcode_name(context, MX64_CALL, dst->value.function->name.data, true);
+        } break;
 
-          } // switch (dst->kind)
+        default: ICE("Unhandled operand kind in CALL: %d (%s)", dst->kind, mir_operand_kind_string(dst->kind));
 
-        } break;
+        } // switch (dst->kind)
 
-        case MX64_RET: {
+      } break;
 
-          STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-          switch (frame_kind) {
-          case FRAME_NONE: break;
+      case MX64_RET: {
 
-          case FRAME_FULL: {
-            // MOV %RBP, %RSP
-            // POP %RBP
-            mcode_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
-            mcode_reg(context, MX64_POP, REG_RBP, r64);
-          } break;
+        STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+        switch (frame_kind) {
+        case FRAME_NONE: break;
 
-          case FRAME_MINIMAL: {
-            mcode_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-          } break;
+        case FRAME_FULL: {
+          // MOV %RBP, %RSP
+          // POP %RBP
+          mcode_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
+          mcode_reg(context, MX64_POP, REG_RBP, r64);
+        } break;
 
-          case FRAME_COUNT: FALLTHROUGH;
-          default: UNREACHABLE();
+        case FRAME_MINIMAL: {
+          mcode_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
+        } break;
 
-          }
+        case FRAME_COUNT: FALLTHROUGH;
+        default: UNREACHABLE();
 
-          mcode_none(context, MX64_RET);
+        }
 
-        } break;
+        mcode_none(context, MX64_RET);
 
-        case MX64_SHL: FALLTHROUGH;
-        case MX64_SAR: FALLTHROUGH;
-        case MX64_SHR: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      } break;
 
-        case MX64_POP: FALLTHROUGH;
-        case MX64_PUSH: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      case MX64_SHL: FALLTHROUGH;
+      case MX64_SAR: FALLTHROUGH;
+      case MX64_SHR: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_LEA: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_mem_to_reg(context, MX64_LEA, REG_RBP, function->frame_objects.data[local->value.local_ref].offset, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            MIROperand *object = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            mcode_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
-            MIROperand *f = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            mcode_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      case MX64_POP: FALLTHROUGH;
+      case MX64_PUSH: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_JMP: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.block->name.data, false);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.function->name.data, true);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.name, false);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      case MX64_LEA: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_CMP: FALLTHROUGH;
-        case MX64_TEST: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *lhs = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!lhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              lhs->value.reg.size = r64;
-            }
-            if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              rhs->value.reg.size = r64;
-            }
-            mcode_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              rhs->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_mem_to_reg(context, MX64_LEA, REG_RBP, function->frame_objects.data[local->value.local_ref].offset, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          MIROperand *object = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_SETCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *compare_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
-            mcode_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          mcode_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
+          MIROperand *f = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          mcode_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 5, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // address (SIB) to reg | base, index, scale, disp, dst
+          MIROperand *base = mir_get_op(instruction, 0);
+          MIROperand *index = mir_get_op(instruction, 1);
+          MIROperand *scale = mir_get_op(instruction, 2);
+          MIROperand *disp = mir_get_op(instruction, 3);
+          MIROperand *reg_dst = mir_get_op(instruction, 4);
+          // Addresses are always computed in 64 bits.
+          mcode_sib_to_reg(context, MX64_LEA, base->value.reg.value, index->value.reg.value, scale->value.imm, disp->value.imm,
+                           reg_dst->value.reg.value, r64);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_SYSCALL:
-        case MX64_UD2:
-        case MX64_INT3:
-        case MX64_CWD:
-        case MX64_CDQ:
-        case MX64_CQO: {
-          mcode_none(context, (MIROpcodex86_64)instruction->opcode);
-        } break;
+      case MX64_JMP: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_branch(context, layout, MX64_JMP, JUMP_TYPE_COUNT, destination->value.block);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_name(context, MX64_JMP, destination->value.function->name.data, true);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_name(context, MX64_JMP, destination->value.name, false);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_JCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
-            MIROperand *jump_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
-            mcode_jcc(context, (IndirectJumpType)jump_type->value.imm, destination->value.block->name.data, false);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      case MX64_CMP: FALLTHROUGH;
+      case MX64_TEST: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *lhs = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!lhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            lhs->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_MOVSX: FALLTHROUGH;
-        case MX64_MOVZX: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (!rhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            rhs->value.reg.size = r64;
           }
-        } break; // case MX64_MOVZX
+          mcode_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!rhs->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            rhs->value.reg.size = r64;
+          }
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_XOR: FALLTHROUGH;
-        case MX64_XCHG:
-          TODO("Implement machine code emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      case MX64_SETCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *compare_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
+          mcode_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_START: FALLTHROUGH;
-        case MX64_END: FALLTHROUGH;
-        case MX64_COUNT: UNREACHABLE();
+      case MX64_CMOVCC: {
+        if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *compare_type = mir_get_op(instruction, 0);
+          MIROperand *source = mir_get_op(instruction, 1);
+          MIROperand *destination = mir_get_op(instruction, 2);
+          ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for cmovcc: %I", compare_type->value.imm);
+          if (!destination->value.reg.size) destination->value.reg.size = source->value.reg.size;
+          mcode_cmovcc(
+            context,
+            (enum ComparisonType)compare_type->value.imm,
+            source->value.reg.value,
+            destination->value.reg.value,
+            destination->value.reg.size == r8 ? r32 : destination->value.reg.size
+          );
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        } // switch (instruction->opcode)
-      }
-    }
-  }
+      case MX64_SYSCALL:
+      case MX64_UD2:
+      case MX64_INT3:
+      case MX64_CWD:
+      case MX64_CDQ:
+      case MX64_CQO: {
+        mcode_none(context, (MIROpcodex86_64)instruction->opcode);
+      } break;
 
-  // Resolve local label (".Lxxxx") relocations.
-  Vector(size_t) relocations_to_remove = {0};
-  foreach_index (idx, context->object->relocs) {
-    RelocationEntry *reloc = context->object->relocs.data + idx;
-    GObjSymbol *sym = &reloc->sym;
-    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0) {
-      // We have to go sym->byte_offset bytes into the ByteBuffer of
-      // the code section and then fill in the next bytes depending on the
-      // relocation type.
-      GObjSymbol *label_sym = NULL;
-      foreach (s, context->object->symbols) {
-        if (strcmp(s->name, sym->name) == 0) {
-          label_sym = s;
-          break;
+      case MX64_JCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
+          MIROperand *jump_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
+          mcode_branch(context, layout, MX64_JCC, (IndirectJumpType)jump_type->value.imm, destination->value.block);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
         }
-      }
-      if (!label_sym) ICE("Could not find local label referenced by relocation: \"%s\"", sym->name);
+      } break;
+
+      case MX64_MOVSX: FALLTHROUGH;
+      case MX64_MOVZX: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_MOVZX
+
+      case MX64_XOR: {
+        if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER))
+          TODO("Implement machine code emission of xor with operands other than two registers");
+        MIROperand *src = mir_get_op(instruction, 0);
+        MIROperand *dst = mir_get_op(instruction, 1);
+        mcode_reg_to_reg(context, MX64_XOR, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+      } break; // case MX64_XOR
+
+      case MX64_XCHG:
+        TODO("Implement machine code emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
 
-      // TODO: Handle endianess
-      // NOTE: 4 == sizeof relocation displacement
-      int32_t disp32 = (int32_t)label_sym->byte_offset - (4 + (int32_t)sym->byte_offset);
-      uint8_t *src_it = (uint8_t*)&disp32;
-      uint8_t *dst_it = code_section(context->object)->data.bytes.data + sym->byte_offset;
-      for (int i = 0; i < 4; ++i)
-        *dst_it++ = *src_it++;
+      case MX64_START: FALLTHROUGH;
+      case MX64_END: FALLTHROUGH;
+      case MX64_COUNT: UNREACHABLE();
 
-      vector_push(relocations_to_remove, idx);
+      } // switch (instruction->opcode)
     }
   }
-  foreach_rev (idx, relocations_to_remove) {
-    vector_remove_index(context->object->relocs, *idx);
+
+  // Now that we know where all blocks are, fill in the displacements.
+  uint8_t *code = code_section(context->object)->data.bytes.data + layout->start;
+  foreach (fixup, layout->fixups) {
+    int32_t disp32 = (int32_t) layout->blocks.data[fixup->target->id] - (int32_t) fixup->end;
+    memcpy(code + fixup->end - 4, &disp32, 4);
   }
+  vector_clear(layout->fixups);
+}
+
+void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machine_instructions) {
+  DBGASSERT(context, "Invalid argument");
+  ASSERT(context->object, "Cannot emit into NULL generic object");
 
-  // Remove all local label symbols (".Lxxxx")
-  Vector(size_t) symbols_to_remove = {0};
-  foreach_index (idx, context->object->symbols) {
-    GObjSymbol *sym = context->object->symbols.data + idx;
-    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0)
-      vector_push(symbols_to_remove, idx);
+  if (context->ast->is_module) {
+    string module_cereal = serialise_module(context, context->ast);
+    Section sec_module_metadata = {0};
+    sec_module_metadata.name = strdup(INTC_MODULE_SECTION_NAME);
+    sec_module_metadata.data.bytes.data = (uint8_t*)module_cereal.data;
+    sec_module_metadata.data.bytes.size = module_cereal.size;
+    sec_module_metadata.data.bytes.capacity = module_cereal.size;
+    vector_push(context->object->sections, sec_module_metadata);
   }
-  foreach_rev (idx, symbols_to_remove) {
-    vector_remove_index(context->object->symbols, *idx);
+
+  foreach_val (function, machine_instructions) {
+    { // Function symbol
+      GObjSymbol sym = {0};
+      sym.type = !ir_func_is_definition(function->origin) ? GOBJ_SYMTYPE_EXTERNAL : GOBJ_SYMTYPE_FUNCTION;
+      sym.name = strdup(function->name.data);
+      sym.section_name = strdup(code_section(context->object)->name);
+      sym.byte_offset = code_section(context->object)->data.bytes.size;
+      vector_push(context->object->symbols, sym);
+    }
+    if (function->origin && !ir_func_is_definition(function->origin)) continue;
+
+    // Emit the function once with every intra-function branch in its
+    // long form to lay it out, and then again for real with as many of
+    // them relaxed to their short form as possible.
+    Section *sec_code = code_section(context->object);
+    usz relocs_before = context->object->relocs.size;
+    FunctionLayout layout = {0};
+    layout.start = sec_code->data.bytes.size;
+    mcode_function(context, function, &layout);
+
+    if (relax_branches(&layout)) {
+      sec_code->data.bytes.size = layout.start;
+      while (context->object->relocs.size > relocs_before) {
+        RelocationEntry reloc = vector_pop(context->object->relocs);
+        free(reloc.sym.name);
+        free(reloc.sym.section_name);
+      }
+      layout.final = true;
+      mcode_function(context, function, &layout);
+    }
+
+    vector_delete(layout.blocks);
+    vector_delete(layout.branches);
+    vector_delete(layout.fixups);
+
   }
 }
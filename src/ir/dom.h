@@ -61,16 +61,56 @@
 ///                B2      B6
 ///                |
 ///                B5
-/// Depth-first search tree.
+///
+/// The *dominance frontier* of a block B1 is the set of blocks B2 such
+/// that B1 dominates a predecessor of B2, but does not strictly dominate
+/// B2 itself; these are the blocks where the paths that go through B1
+/// meet paths that don’t. In the example above, the dominance frontier
+/// of B1 is { B4 }.
+///
+/// Blocks are indexed by their ID, which dom_tree_build() sets; the tree
+/// is invalidated by any change to the control flow graph of the function.
 typedef struct DominatorTree {
-  /// Map from blocks to their immediate dominators.
-  IRBlockMap doms;
+  /// Reachable blocks in reverse postorder; the entry block is first.
+  IRBlockVector rpo;
+
+  /// Immediate dominator of each block. NULL for the entry block
+  /// and for unreachable blocks.
+  IRBlockVector idoms;
+
+  /// Blocks immediately dominated by each block.
+  Vector(IRBlockVector) children;
+
+  /// Dominance frontier of each block.
+  Vector(IRBlockVector) frontiers;
+
+  /// Pre- and postorder number of each block in the dominator tree;
+  /// used to check dominance in constant time. Zero if unreachable.
+  Vector(usz) pre;
+  Vector(usz) post;
 } DominatorTree;
 
 /// Build the dominator tree of a function.
+///
+/// This also renumbers the blocks of the function.
 DominatorTree dom_tree_build(IRFunction *f);
 
 /// Free the memory used by the dominator tree.
 void dom_tree_free(DominatorTree *info);
 
+/// Get the immediate dominator of a block.
+IRBlock *dom_idom(DominatorTree *dom, IRBlock *b);
+
+/// Get the blocks immediately dominated by a block.
+IRBlockVector *dom_children(DominatorTree *dom, IRBlock *b);
+
+/// Get the dominance frontier of a block.
+IRBlockVector *dom_frontier(DominatorTree *dom, IRBlock *b);
+
+/// Check if a block is reachable from the entry block.
+bool dom_reachable(DominatorTree *dom, IRBlock *b);
+
+/// Check if \p a dominates \p b.
+bool dom_dominates(DominatorTree *dom, IRBlock *a, IRBlock *b);
+
 #endif // FUNCOMPILER_DOM_H
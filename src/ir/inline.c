@@ -217,7 +217,7 @@ static inline_result ir_inline_call(
       copy->type = inst->type;
 
       /// Copy instruction-specific data.
-      STATIC_ASSERT(IR_COUNT == 40, "Handle all instructions in inliner");
+      STATIC_ASSERT(IR_COUNT == 41, "Handle all instructions in inliner");
       switch (inst->kind) {
         case IR_LIT_INTEGER:
         case IR_LIT_STRING:
@@ -298,6 +298,12 @@ static inline_result ir_inline_call(
           copy->store.addr = MAP(inst->store.addr);
           break;
 
+        case IR_SELECT:
+          copy->select.cond = MAP(inst->select.cond);
+          copy->select.then = MAP(inst->select.then);
+          copy->select.else_ = MAP(inst->select.else_);
+          break;
+
         case IR_BRANCH:
           copy->destination_block = MAP_BLOCK(inst->destination_block);
           break;
@@ -63,6 +63,11 @@ typedef struct IRInstruction {
       IRInstruction *addr;
       IRInstruction *value;
     } store;
+    struct {
+      IRInstruction *cond;
+      IRInstruction *then;
+      IRInstruction *else_;
+    } select;
     struct {
       IRInstruction *lhs;
       IRInstruction *rhs;
@@ -121,6 +126,9 @@ typedef struct IRFunction {
   // MIRFunction that was created to represent this IRFunction.
   MIRFunction *machine_func;
 
+  /// Cached loop nest; see loop_info_get().
+  LoopInfo *loops;
+
   usz registers_in_use;
 
   SymbolLinkage linkage;
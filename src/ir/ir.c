@@ -3,6 +3,7 @@
 #include <codegen/x86_64/arch_x86_64.h>
 #include <ir/dom.h>
 #include <ir/ir-impl.h>
+#include <ir/loops.h>
 #include <ir/ir.h>
 #include <platform.h>
 #include <stdlib.h>
@@ -130,7 +131,7 @@ static void ir_internal_unmark_usee(IRInstruction *user, IRInstruction **child,
 void ir_free_instruction_data(IRInstruction *i) {
   if (!i) return;
 
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instruction types.");
   switch (i->kind) {
     default: break;
     case IR_INTRINSIC:
@@ -180,7 +181,7 @@ static void ir_emit_instruction(
     format_to(out, "  %31│ ");
   }
 
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instruction types.");
   switch (inst->kind) {
   case IR_POISON:
     format_to(out, "%33poison");
@@ -249,6 +250,16 @@ static void ir_emit_instruction(
     format_to(out, "%33not %34%%%u", inst->operand->id);
     break;
 
+  case IR_SELECT:
+    format_to(
+      out,
+      "%33select %34%%%u%31, %34%%%u%31, %34%%%u",
+      inst->select.cond->id,
+      inst->select.then->id,
+      inst->select.else_->id
+    );
+    break;
+
   case IR_ZERO_EXTEND:
     format_to(out, "%33z.ext %34%%%u", inst->operand->id);
     break;
@@ -359,7 +370,7 @@ void ir_for_each_child(
   void callback(IRInstruction *user, IRInstruction **child, void *data),
   void *data
 ) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instruction types.");
   switch (user->kind) {
   case IR_PHI:
       foreach (arg, user->phi_args) {
@@ -385,6 +396,12 @@ void ir_for_each_child(
     callback(user, &user->store.value, data);
     break;
 
+  case IR_SELECT:
+    callback(user, &user->select.cond, data);
+    callback(user, &user->select.then, data);
+    callback(user, &user->select.else_, data);
+    break;
+
   ALL_BINARY_INSTRUCTION_CASES()
     callback(user, &user->lhs, data);
     callback(user, &user->rhs, data);
@@ -416,7 +433,7 @@ void ir_for_each_child(
 }
 
 bool ir_is_value(IRInstruction *instruction) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instruction types.");
   // NOTE: If you are changing this switch, you also need to change
   // `needs_register()` in register_allocation.c
   switch (instruction->kind) {
@@ -427,6 +444,7 @@ bool ir_is_value(IRInstruction *instruction) {
     case IR_LOAD:
     case IR_PHI:
     case IR_COPY:
+    case IR_SELECT:
     case IR_PARAMETER:
     case IR_REGISTER:
     case IR_ALLOCA:
@@ -619,13 +637,29 @@ static void ir_print_dot_dj_function(IRFunction *f, FILE* file) {
   foreach_val (block, f->blocks)
     fprint(file, "    Block%p [label=\"{bb%u}\", shape=record, style=filled]\n", block, block->id);
 
-  /// We don’t have join edges yet, so just print the
-  /// dominator tree for now.
-  foreach (entry, dom.doms)
-    if (entry->value)
-      fprint(file, "    Block%p -> Block%p;\n", entry->value, entry->key);
+  /// Dominator tree edges.
+  foreach_val (block, f->blocks)
+    if (dom_idom(&dom, block))
+      fprint(file, "    Block%p -> Block%p;\n", dom_idom(&dom, block), block);
+
+  /// Join edges are the CFG edges that aren’t also tree edges.
+  foreach_val (block, f->blocks) {
+    if (!dom_reachable(&dom, block)) continue;
+    IRInstruction *br = ir_terminator(block);
+    IRBlock *succs[2] = {0};
+    if (ir_kind(br) == IR_BRANCH) succs[0] = ir_dest(br);
+    else if (ir_kind(br) == IR_BRANCH_CONDITIONAL) {
+      succs[0] = ir_then(br);
+      succs[1] = ir_else(br);
+    }
+
+    for (usz i = 0; i < 2; i++)
+      if (succs[i] && dom_idom(&dom, succs[i]) != block)
+        fprint(file, "    Block%p -> Block%p [style=dashed];\n", block, succs[i]);
+  }
 
   fprint(file, "}\n");
+  dom_tree_free(&dom);
   vector_delete(sb);
 }
 
@@ -926,6 +960,24 @@ IRStaticVariable *ir_create_static(
   return v;
 }
 
+Inst *ir_create_select(
+  CodegenContext *ctx,
+  Type *type,
+  Inst *condition,
+  Inst *then_value,
+  Inst *else_value
+) {
+  Inst *sel = alloc(ctx, IR_SELECT);
+  sel->type = type;
+  sel->select.cond = condition;
+  sel->select.then = then_value;
+  sel->select.else_ = else_value;
+  mark_used(condition, sel);
+  mark_used(then_value, sel);
+  mark_used(else_value, sel);
+  return sel;
+}
+
 Inst *ir_create_static_ref(CodegenContext *ctx, IRStaticVariable *var) {
   Inst *ref = alloc(ctx, IR_STATIC_REF);
   ref->static_ref = var;
@@ -1016,6 +1068,15 @@ Block *ir_block_attach(CodegenContext *context, Block *block) {
   return block;
 }
 
+Block *ir_block_attach_before(Block *before, Block *block) {
+  ASSERT(before->function);
+  ASSERT(!block->function);
+  IRFunction *f = before->function;
+  vector_insert(f->blocks, vector_find_if(el, f->blocks, *el == before), block);
+  block->function = f;
+  return block;
+}
+
 /// Insert an instruction into the current insert point.
 ///
 /// \param context The codegen context.
@@ -1085,6 +1146,17 @@ Inst *ir_insert_before(
   return instruction;
 }
 
+Inst *ir_move_before(
+  Inst *before,
+  Inst *instruction
+) {
+  ASSERT(instruction->parent_block, "Cannot move floating instruction");
+  ASSERT(before != instruction, "Cannot move instruction before itself");
+  vector_remove_element(instruction->parent_block->instructions, instruction);
+  instruction->parent_block = NULL;
+  return ir_insert_before(before, instruction);
+}
+
 Inst *ir_insert_alloca(CodegenContext *context, Type *type) {
   return ir_insert(context, ir_create_alloca(context, type));
 }
@@ -1133,6 +1205,10 @@ Inst *ir_insert_return(CodegenContext *context, Inst *ret) {
   return ir_insert(context, ir_create_return(context, ret));
 }
 
+Inst *ir_insert_select(CodegenContext *context, Type *type, Inst *condition, Inst *then_value, Inst *else_value) {
+  return ir_insert(context, ir_create_select(context, type, condition, then_value, else_value));
+}
+
 Inst *ir_insert_sext(CodegenContext *context, Type *result_type, Inst *value) {
   return ir_insert(context, ir_create_sext(context, result_type, value));
 }
@@ -1241,7 +1317,7 @@ Inst *ir_inst_get(Block *block, usz n) {
 }
 
 bool ir_is_branch(Inst *i) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all branch types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types.");
   switch (i->kind) {
     case IR_BRANCH:
     case IR_BRANCH_CONDITIONAL:
@@ -1258,7 +1334,7 @@ IRType ir_kind(Inst *i) {
 }
 
 span ir_kind_to_str(IRType t) {
-  STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all instruction types.");
   switch (t) {
     case IR_IMMEDIATE: return literal_span("imm");
     case IR_LIT_INTEGER: return literal_span("lit.int");
@@ -1280,6 +1356,7 @@ span ir_kind_to_str(IRType t) {
     case IR_TRUNCATE: return literal_span("truncate");
     case IR_BITCAST: return literal_span("bitcast");
     case IR_COPY: return literal_span("copy");
+    case IR_SELECT: return literal_span("select");
     case IR_PARAMETER: return literal_span(".param");
     case IR_RETURN: return literal_span("ret");
     case IR_BRANCH: return literal_span("br");
@@ -1428,8 +1505,9 @@ void ir_delete_function(IRFunction *f) {
     vector_push(ctx->free_instructions, i);
   }
 
-  /// Free the name, params, and block list.
+  /// Free the name, params, block list, and cached analyses.
   free(f->name.data);
+  loop_info_free(f->loops);
   vector_delete(f->parameters);
   vector_delete(f->blocks);
 
@@ -1970,6 +2048,42 @@ void ir_rhs_impl_set(Inst *i, Inst *val) {
   mark_used(val, i);
 }
 
+Inst *ir_select_cond_impl_get(Inst *i) {
+  ASSERT(i->kind == IR_SELECT);
+  return i->select.cond;
+}
+
+void ir_select_cond_impl_set(Inst *i, Inst *val) {
+  ASSERT(i->kind == IR_SELECT);
+  remove_use(i->select.cond, i);
+  i->select.cond = val;
+  mark_used(val, i);
+}
+
+Inst *ir_select_then_impl_get(Inst *i) {
+  ASSERT(i->kind == IR_SELECT);
+  return i->select.then;
+}
+
+void ir_select_then_impl_set(Inst *i, Inst *val) {
+  ASSERT(i->kind == IR_SELECT);
+  remove_use(i->select.then, i);
+  i->select.then = val;
+  mark_used(val, i);
+}
+
+Inst *ir_select_else_impl_get(Inst *i) {
+  ASSERT(i->kind == IR_SELECT);
+  return i->select.else_;
+}
+
+void ir_select_else_impl_set(Inst *i, Inst *val) {
+  ASSERT(i->kind == IR_SELECT);
+  remove_use(i->select.else_, i);
+  i->select.else_ = val;
+  mark_used(val, i);
+}
+
 Inst *ir_static_var_init_impl_get(IRStaticVariable *var) {
   return var->init;
 }
@@ -2024,4 +2138,5 @@ DEFINE_ACCESSORS(ir_location_f, Func *, loc, source_location);
 DEFINE_ACCESSORS(ir_mir_i, Inst *, MIRInstruction *, machine_inst);
 DEFINE_ACCESSORS(ir_mir_b, Block *, MIRBlock *, machine_block);
 DEFINE_ACCESSORS(ir_mir_f, Func *, MIRFunction *, machine_func);
+DEFINE_ACCESSORS(ir_loops, Func *, LoopInfo *, loops);
 DEFINE_ACCESSORS(ir_register, Inst *, Register, result);
@@ -203,6 +203,10 @@ typedef union IRValue {
   IRStaticVariable*: ir_linkage_impl_v  \
 )(obj)
 
+/// Access the cached loop nest of a function. Use loop_info_get()
+/// instead of reading this directly.
+#define ir_loops(func, ...) IR_PROPERTY(ir_loops, func, __VA_ARGS__)
+
 /// Access a location of an instruction or function.
 #define ir_location(obj, ...) \
   _Generic((VA_FIRST(__VA_ARGS__ __VA_OPT__(,) ((struct no_generic_argument*)NULL))), \
@@ -258,6 +262,15 @@ typedef union IRValue {
 /// Access the RHS of a binary expression.
 #define ir_rhs(expr, ...) IR_PROPERTY(ir_rhs, expr, __VA_ARGS__)
 
+/// Access the condition of a select.
+#define ir_select_cond(sel, ...) IR_PROPERTY(ir_select_cond, sel, __VA_ARGS__)
+
+/// Access the value of a select if its condition is true.
+#define ir_select_then(sel, ...) IR_PROPERTY(ir_select_then, sel, __VA_ARGS__)
+
+/// Access the value of a select if its condition is false.
+#define ir_select_else(sel, ...) IR_PROPERTY(ir_select_else, sel, __VA_ARGS__)
+
 /// Access initialiser of static variable.
 #define ir_static_var_init(var, ...) IR_PROPERTY(ir_static_var_init, var, __VA_ARGS__)
 
@@ -526,6 +539,22 @@ NODISCARD IRStaticVariable *ir_create_static(
   string name
 );
 
+/// Create a select instruction.
+///
+/// \param context The codegen context.
+/// \param type The type of the result.
+/// \param condition The condition; any value other than zero is true.
+/// \param then_value The result if the condition is true.
+/// \param else_value The result if the condition is false.
+/// \return The created instruction.
+NODISCARD IRInstruction *ir_create_select(
+  CodegenContext *context,
+  Type *type,
+  IRInstruction *condition,
+  IRInstruction *then_value,
+  IRInstruction *else_value
+);
+
 /// Create a reference to a variable with static storage duration.
 NODISCARD IRInstruction *ir_create_static_ref(CodegenContext *context, IRStaticVariable *var);
 
@@ -576,6 +605,15 @@ ALL_BINARY_INSTRUCTION_TYPES(F)
 /// \return The attached block.
 IRBlock *ir_block_attach(CodegenContext *context, IRBlock *block);
 
+/// Attach a block to the function of another block, right before it.
+///
+/// Unlike ir_block_attach(), this does not change the insert point.
+///
+/// \param before The block before which to insert.
+/// \param block The block to attach.
+/// \return The attached block.
+IRBlock *ir_block_attach_before(IRBlock *before, IRBlock *block);
+
 /// Insert an instruction into the current insert point.
 ///
 /// \param context The codegen context.
@@ -640,6 +678,20 @@ IRInstruction *ir_insert_before(
   IRInstruction *instruction
 );
 
+/// Move an instruction from its block to before another instruction.
+///
+/// The uses and operands of the instruction are left untouched; it
+/// is up to the caller to ensure that the operands still dominate it
+/// and that it still dominates its users at its new position.
+///
+/// \param before The instruction before which to move it.
+/// \param instruction The instruction to move.
+/// \return The moved instruction.
+IRInstruction *ir_move_before(
+  IRInstruction *before,
+  IRInstruction *instruction
+);
+
 /// These `ir_insert_X` functions are the same as calling
 /// `ir_insert(context, ir_X(...))`.
 IRInstruction *ir_insert_alloca(CodegenContext *context, Type *type);
@@ -654,6 +706,7 @@ IRInstruction *ir_insert_load(CodegenContext *context, Type *type, IRInstruction
 IRInstruction *ir_insert_not(CodegenContext *context, IRInstruction *source);
 IRInstruction *ir_insert_phi(CodegenContext *context, Type *type);
 IRInstruction *ir_insert_return(CodegenContext *context, IRInstruction *ret);
+IRInstruction *ir_insert_select(CodegenContext *context, Type *type, IRInstruction *condition, IRInstruction *then_value, IRInstruction *else_value);
 IRInstruction *ir_insert_sext(CodegenContext *context, Type *result_type, IRInstruction *value);
 IRInstruction *ir_insert_static_ref(CodegenContext *context, IRStaticVariable *var);
 IRInstruction *ir_insert_store(CodegenContext *context, IRInstruction *data, IRInstruction *address);
@@ -814,12 +867,16 @@ DECLARE_ACCESSORS(ir_intrinsic_kind, IRInstruction *, enum IntrinsicKind);
 DECLARE_ACCESSORS(ir_lhs, IRInstruction *, IRInstruction *);
 DECLARE_ACCESSORS(ir_location_i, IRInstruction *, loc);
 DECLARE_ACCESSORS(ir_location_f, IRFunction *, loc);
+DECLARE_ACCESSORS(ir_loops, IRFunction *, LoopInfo *);
 DECLARE_ACCESSORS(ir_mir_i, IRInstruction *, MIRInstruction *);
 DECLARE_ACCESSORS(ir_mir_b, IRBlock *, MIRBlock *);
 DECLARE_ACCESSORS(ir_mir_f, IRFunction *, MIRFunction *);
 DECLARE_ACCESSORS(ir_operand, IRInstruction *, IRInstruction *);
 DECLARE_ACCESSORS(ir_register, IRInstruction *, Register);
 DECLARE_ACCESSORS(ir_rhs, IRInstruction *, IRInstruction *);
+DECLARE_ACCESSORS(ir_select_cond, IRInstruction *, IRInstruction *);
+DECLARE_ACCESSORS(ir_select_then, IRInstruction *, IRInstruction *);
+DECLARE_ACCESSORS(ir_select_else, IRInstruction *, IRInstruction *);
 DECLARE_ACCESSORS(ir_static_var_init, IRStaticVariable *, IRInstruction *);
 DECLARE_ACCESSORS(ir_store_addr, IRInstruction *, IRInstruction *);
 DECLARE_ACCESSORS(ir_store_value, IRInstruction *, IRInstruction *);
@@ -0,0 +1,173 @@
+#include <ir/dom.h>
+#include <ir/ir.h>
+#include <ir/loops.h>
+
+/// Get the successors of a block.
+///
+/// \return The number of successors written to \p succs.
+static usz loop_successors(IRBlock *b, IRBlock *succs[2]) {
+  STATIC_ASSERT(IR_COUNT == 41, "Handle all branch types");
+  IRInstruction *br = ir_terminator(b);
+  switch (ir_kind(br)) {
+    default: return 0;
+    case IR_BRANCH:
+      succs[0] = ir_dest(br);
+      return 1;
+    case IR_BRANCH_CONDITIONAL:
+      succs[0] = ir_then(br);
+      succs[1] = ir_else(br);
+      return 2;
+  }
+}
+
+/// Compute the loop nest of a function.
+static LoopInfo *loop_info_build(IRFunction *f) {
+  LoopInfo *info = calloc(1, sizeof *info);
+  DominatorTree dom = dom_tree_build(f);
+  usz n = dom.idoms.size;
+
+  /// Record the CFG and compute the predecessors of each block.
+  Vector(IRBlockVector) preds = {0};
+  vector_resize(preds, n);
+  FOREACH_BLOCK (b, f) {
+    IRBlock *succs[2] = {0};
+    usz count = loop_successors(b, succs);
+    vector_push(info->blocks, b);
+    vector_push(info->successors, succs[0]);
+    vector_push(info->successors, succs[1]);
+    for (usz i = 0; i < count; i++) vector_push(preds.data[ir_id(succs[i])], b);
+  }
+
+  /// Headers dominate the blocks that have back edges to them, and
+  /// thus come before any loops nested in them in reverse postorder;
+  /// visiting the headers in that order means that a loop’s parent
+  /// has always already been built when we get to it.
+  vector_resize(info->innermost, n);
+  Vector(bool) in_loop = {0};
+  vector_resize(in_loop, n);
+  IRBlockVector worklist = {0};
+  foreach_val (h, dom.rpo) {
+    IRBlockVector *h_preds = preds.data + ir_id(h);
+    IRBlockVector latches = {0};
+    foreach_val (p, *h_preds)
+      if (dom_dominates(&dom, h, p))
+        vector_push(latches, p);
+    if (!latches.size) continue;
+
+    Loop *loop = calloc(1, sizeof *loop);
+    loop->header = h;
+    loop->latches = latches;
+    loop->parent = info->innermost.data[ir_id(h)];
+    loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+    if (loop->parent) vector_push(loop->parent->children, loop);
+    vector_push(info->loops, loop);
+
+    /// Collect the blocks that can reach a latch without going
+    /// through the header.
+    in_loop.data[ir_id(h)] = true;
+    vector_push(loop->blocks, h);
+    foreach_val (l, latches) {
+      if (in_loop.data[ir_id(l)]) continue;
+      in_loop.data[ir_id(l)] = true;
+      vector_push(worklist, l);
+    }
+
+    while (worklist.size) {
+      IRBlock *b = vector_pop(worklist);
+      vector_push(loop->blocks, b);
+      IRBlockVector *b_preds = preds.data + ir_id(b);
+      foreach_val (p, *b_preds) {
+        if (in_loop.data[ir_id(p)] || !dom_reachable(&dom, p)) continue;
+        in_loop.data[ir_id(p)] = true;
+        vector_push(worklist, p);
+      }
+    }
+
+    /// Collect the exits.
+    foreach_val (b, loop->blocks) {
+      IRBlock *succs[2];
+      usz count = loop_successors(b, succs);
+      for (usz i = 0; i < count; i++)
+        if (!in_loop.data[ir_id(succs[i])] && !vector_contains(loop->exits, succs[i]))
+          vector_push(loop->exits, succs[i]);
+    }
+
+    /// Find the preheader.
+    IRBlock *entering = NULL;
+    usz entering_count = 0;
+    foreach_val (p, *h_preds) {
+      if (in_loop.data[ir_id(p)] || !dom_reachable(&dom, p)) continue;
+      entering = p;
+      entering_count++;
+    }
+
+    IRBlock *succs[2];
+    if (entering_count == 1 && loop_successors(entering, succs) == 1) loop->preheader = entering;
+
+    /// Blocks of nested loops are overwritten when we get to those.
+    foreach_val (b, loop->blocks) {
+      info->innermost.data[ir_id(b)] = loop;
+      in_loop.data[ir_id(b)] = false;
+    }
+  }
+
+  foreach (ps, preds) vector_delete(*ps);
+  vector_delete(preds);
+  vector_delete(in_loop);
+  vector_delete(worklist);
+  dom_tree_free(&dom);
+  return info;
+}
+
+/// Check if the CFG of a function is still the one that a loop nest
+/// was computed for, and renumber the blocks the way we did back then.
+static bool loop_info_valid(LoopInfo *info, IRFunction *f) {
+  usz i = 0;
+  FOREACH_BLOCK (b, f) {
+    if (i == info->blocks.size || info->blocks.data[i] != b) return false;
+
+    IRBlock *succs[2] = {0};
+    loop_successors(b, succs);
+    if (info->successors.data[2 * i] != succs[0] || info->successors.data[2 * i + 1] != succs[1]) return false;
+
+    ir_id(b, (u32) ++i);
+  }
+
+  return i == info->blocks.size;
+}
+
+LoopInfo *loop_info_get(IRFunction *f) {
+  LoopInfo *info = ir_loops(f);
+  if (info && loop_info_valid(info, f)) return info;
+  loop_info_free(info);
+  info = loop_info_build(f);
+  ir_loops(f, info);
+  return info;
+}
+
+void loop_info_free(LoopInfo *info) {
+  if (!info) return;
+  foreach_val (loop, info->loops) {
+    vector_delete(loop->blocks);
+    vector_delete(loop->latches);
+    vector_delete(loop->exits);
+    vector_delete(loop->children);
+    free(loop);
+  }
+
+  vector_delete(info->loops);
+  vector_delete(info->innermost);
+  vector_delete(info->blocks);
+  vector_delete(info->successors);
+  free(info);
+}
+
+Loop *loop_of(LoopInfo *info, IRBlock *b) {
+  return info->innermost.data[ir_id(b)];
+}
+
+bool loop_contains(LoopInfo *info, Loop *loop, IRBlock *b) {
+  for (Loop *l = loop_of(info, b); l; l = l->parent)
+    if (l == loop) return true;
+  return false;
+}
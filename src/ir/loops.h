@@ -0,0 +1,103 @@
+#ifndef FUNCOMPILER_LOOPS_H
+#define FUNCOMPILER_LOOPS_H
+
+#include <codegen/codegen_forward.h>
+#include <stdbool.h>
+#include <vector.h>
+
+/// A natural loop.
+///
+/// An edge from a block B to a block H is a *back edge* iff H dominates
+/// B. The *natural loop* of that back edge consists of H, which is called
+/// the *header* of the loop, and all blocks that can reach B without going
+/// through H. Back edges that share a header are part of the same loop.
+///
+/// Natural loops are either disjoint or nested, so the loops of a function
+/// form a forest, which we call the *loop nest*.
+///
+/// For instance, in the CFG below, B3 → B1 and B2 → B2 are back edges; B1,
+/// B2 and B3 form a loop with header B1, and the loop consisting only of
+/// B2 is nested within it. B0 is the preheader of the outer loop, and B4
+/// its only exit.
+///
+///              B0
+///              |
+///        ┌───→ B1
+///        |     |
+///        |     B2 ←─┐
+///        |     | └──┘
+///        └──── B3
+///              |
+///              B4
+typedef struct Loop Loop;
+struct Loop {
+  /// The header; this dominates every block in the loop.
+  IRBlock *header;
+
+  /// The only predecessor of the header that is not part of the
+  /// loop, provided that the header is also its only successor.
+  /// NULL if there is no such block.
+  IRBlock *preheader;
+
+  /// All blocks in the loop, including those of nested loops; the
+  /// header is always first.
+  IRBlockVector blocks;
+
+  /// Blocks in the loop that branch back to the header.
+  IRBlockVector latches;
+
+  /// Blocks outside the loop that are branched to from within it.
+  IRBlockVector exits;
+
+  /// The innermost loop that contains this loop, if any.
+  Loop *parent;
+
+  /// Loops directly nested in this one.
+  Vector(Loop *) children;
+
+  /// Nesting depth; outermost loops have depth 1.
+  usz depth;
+};
+
+/// The loop nest of a function.
+///
+/// Blocks are indexed by their ID, which loop_info_get() sets; just like
+/// the dominator tree, this is invalidated by any change to the control
+/// flow graph of the function. Unlike the dominator tree, it is cached
+/// in the function and rebuilt on demand if the CFG has changed since.
+typedef struct LoopInfo {
+  /// All loops, ordered such that nested loops come after the
+  /// loops that contain them.
+  Vector(Loop *) loops;
+
+  /// Innermost loop of each block, or NULL if the block is not
+  /// part of any loop.
+  Vector(Loop *) innermost;
+
+  /// Blocks and their successors when this was built, to check
+  /// whether the CFG has changed.
+  IRBlockVector blocks;
+  IRBlockVector successors;
+} LoopInfo;
+
+/// Get the loop nest of a function.
+///
+/// This returns the cached loop nest if the CFG of the function hasn’t
+/// changed since it was last computed, and rebuilds it otherwise. The
+/// result is owned by the function and remains valid until the next
+/// call to this function or until the CFG is changed.
+///
+/// This also renumbers the blocks of the function.
+LoopInfo *loop_info_get(IRFunction *f);
+
+/// Free the memory used by a loop nest.
+void loop_info_free(LoopInfo *info);
+
+/// Get the innermost loop that contains a block, or NULL if the
+/// block isn’t part of any loop.
+Loop *loop_of(LoopInfo *info, IRBlock *b);
+
+/// Check if a block is part of a loop or one of its nested loops.
+bool loop_contains(LoopInfo *info, Loop *loop, IRBlock *b);
+
+#endif // FUNCOMPILER_LOOPS_H
@@ -15,6 +15,8 @@
 #include <module.h>
 #include <codegen/coff.h>
 #include <codegen/elf.h>
+#include <codegen/instruction_selection.h>
+#include <codegen/register_allocation.h>
 
 static void print_usage(char **argv) {
   print("\nUSAGE: %s [FLAGS] [OPTIONS] <path to file to compile>\n", 0[argv]);
@@ -28,6 +30,9 @@ static void print_usage(char **argv) {
         "   `--print-scopes     :: Print the scope tree.\n"
         "   `--print-ir`        :: Print the intermediate representation.\n"
         "   `--annotate-code    :: Emit comments in generated code.\n"
+        "   `--isel-stats`      :: Print how often each instruction selection pattern was applied.\n"
+        "   `--peephole-stats`  :: Print how often each peephole optimisation was applied.\n"
+        "   `--isel-linear`     :: Only match instruction selection patterns against adjacent instructions.\n"
         "   `-O`, `--optimize`  :: Optimize the generated code.\n"
         "   `-v`, `--verbose`   :: Print out more information.\n");
   print("Options:\n"
@@ -39,6 +44,9 @@ static void print_usage(char **argv) {
         "   `--dot-dj <func>`   :: Print the DJ-graph of a function in DOT format and exit.\n"
         "    `-L`               :: Check for modules within the given directory.\n"
         "    `--colours`        :: Set whether to use colours in diagnostics.\n"
+        "    `--regalloc`       :: Set the register allocator to the one given.\n"
+        "    `--isel <file>`    :: Use the ISel patterns in the given file instead of the built-in ones.\n"
+        "    `--isel-tablegen <file>` :: Write the ISel patterns given with `--isel` to the given file as C tables and exit.\n"
         "Anything other arguments are treated as input filepaths (source code).\n");
 }
 
@@ -47,6 +55,12 @@ int output_filepath_index = -1;
 CodegenArchitecture output_arch = ARCH_DEFAULT;
 CodegenTarget output_target = TARGET_DEFAULT;
 enum CodegenCallingConvention output_calling_convention = CG_CALL_CONV_DEFAULT;
+RegisterAllocator register_allocator = RA_ALLOCATOR_DEFAULT;
+const char *isel_patterns_filepath = NULL;
+const char *isel_tablegen_filepath = NULL;
+bool print_isel_stats = false;
+bool isel_match_trees = true;
+bool print_peephole_stats = false;
 
 int verbosity = 0;
 int optimise = 0;
@@ -97,6 +111,14 @@ static void print_acceptable_colour_settings() {
          " -> never\n");
 }
 
+static void print_acceptable_register_allocators() {
+  STATIC_ASSERT(RA_ALLOCATOR_COUNT == 3, "Exhaustive handling of register allocators when printing out all available");
+  print("Acceptable register allocators include:\n"
+         " -> default -- linear scan, or graph colouring with `-O`\n"
+         " -> graph\n"
+         " -> linear\n");
+}
+
 /// @return Zero if everything goes well, otherwise return non-zero value.
 static int handle_command_line_arguments(int argc, char **argv) {
   /// Default settings.
@@ -123,6 +145,12 @@ static int handle_command_line_arguments(int argc, char **argv) {
       syntax_only = true;
     } else if (strcmp(argument, "--annotate-code") == 0) {
       annotate_code = true;
+    } else if (strcmp(argument, "--isel-stats") == 0) {
+      print_isel_stats = true;
+    } else if (strcmp(argument, "--peephole-stats") == 0) {
+      print_peephole_stats = true;
+    } else if (strcmp(argument, "--isel-linear") == 0) {
+      isel_match_trees = false;
     } else if (strcmp(argument, "--dot-cfg") == 0) {
       print_dot_cfg = true;
       if (++i >= argc)
@@ -270,6 +298,32 @@ static int handle_command_line_arguments(int argc, char **argv) {
         print_acceptable_calling_conventions();
         return 1;
       }
+    } else if (strcmp(argument, "--regalloc") == 0) {
+      i++;
+      if (i >= argc) {
+        ICE("Expected register allocator after command line argument %s", argument);
+      }
+      STATIC_ASSERT(RA_ALLOCATOR_COUNT == 3, "Exhaustive handling of register allocators in command line argument parsing");
+      if (strcmp(argv[i], "default") == 0) {
+        register_allocator = RA_ALLOCATOR_DEFAULT;
+      } else if (strcmp(argv[i], "graph") == 0) {
+        register_allocator = RA_ALLOCATOR_GRAPH_COLOURING;
+      } else if (strcmp(argv[i], "linear") == 0) {
+        register_allocator = RA_ALLOCATOR_LINEAR_SCAN;
+      } else {
+        print("Expected register allocator after command line argument %s\n"
+              "Instead, got unrecognized: \"%s\".\n", argument, argv[i]);
+        print_acceptable_register_allocators();
+        return 1;
+      }
+    } else if (strcmp(argument, "--isel") == 0 || strcmp(argument, "--isel-tablegen") == 0) {
+      if (++i >= argc) {
+        print("Expected filepath after command line argument %s\n", argument);
+        print_usage(argv);
+        return 1;
+      }
+      if (strcmp(argument, "--isel") == 0) isel_patterns_filepath = i[argv];
+      else isel_tablegen_filepath = i[argv];
     } else if (strcmp(argument, "-L") == 0) {
       i++;
       if (i >= argc) {
@@ -404,6 +458,28 @@ int main(int argc, char **argv) {
 
   int status = handle_command_line_arguments(argc, argv);
   if (status) return status;
+
+  /// Used by the build to compile the ISel patterns to C tables.
+  if (isel_tablegen_filepath) {
+    if (!isel_patterns_filepath) {
+      print("`--isel-tablegen` requires a pattern file given with `--isel`\n");
+      print_usage(argv);
+      return 1;
+    }
+
+    FILE *table = fopen(isel_tablegen_filepath, "wb");
+    if (!table) {
+      print("Could not open \"%s\" for writing\n", isel_tablegen_filepath);
+      return 1;
+    }
+
+    ISelPatterns patterns = isel_parse_file(isel_patterns_filepath);
+    isel_write_table(table, patterns, "isel_table");
+    fclose(table);
+    isel_patterns_delete(&patterns);
+    return 0;
+  }
+
   if (input_filepath_index == -1) {
     print("Input file path was not provided.");
     print_usage(argv);